@@ -12,6 +12,7 @@
 
 #include "errors.h"
 #include "fileio.h"
+#include "partition.h"
 
 int check_bootsector(struct sBootSector *bs) {
   /*
@@ -62,7 +63,7 @@ int check_bootsector(struct sBootSector *bs) {
   return 0;
 }
 
-int read_bootsector(FILE *fd, struct sBootSector *bs) {
+int read_bootsector(struct sDevice *fd, struct sBootSector *bs) {
   /*
    * reads bootsector
    */
@@ -74,11 +75,7 @@ int read_bootsector(FILE *fd, struct sBootSector *bs) {
   }
 
   if (!fs_read(bs, 1, sizeof(struct sBootSector), fd)) {
-    if (feof(fd)) {
-      myerror("Boot sector is too short!");
-    }
-    else
-      myerror("Failed to read from file!");
+    myerror("Failed to read boot sector, device may be too short!");
     return -1;
   }
 
@@ -135,11 +132,14 @@ int checkFSType(struct sBootSector *bs) {
 
 int checkFAT32s(struct sFileSystem *fs) {
   /*
-   * checks whether all FAT32s have the same content
+   * checks whether all FAT32s have the same content, all copies are read
+   * chunk by chunk in lockstep, so memory usage doesn't depend on the size
+   * of the FAT32s and the first difference is found as early as possible
    */
 
-  unsigned FAT32SizeInBytes;
-  int i, BSOffset, result = 0;
+  unsigned FAT32SizeInBytes, chunkSize, pos, len, j;
+  int i, result = 0;
+  int64_t BSOffset;
 
   char *FS1, *FSx;
 
@@ -149,64 +149,122 @@ int checkFAT32s(struct sFileSystem *fs) {
 
   FAT32SizeInBytes = fs->FAT32Size * fs->sectorSize;
 
-  FS1 = malloc(FAT32SizeInBytes);
+  // chunks are a multiple of the sector size
+  chunkSize = FAT32_CHECK_CHUNK_SIZE / fs->sectorSize * fs->sectorSize;
+  if (!chunkSize)
+    chunkSize = fs->sectorSize;
+
+  FS1 = malloc(chunkSize * 2);
   if (!FS1) {
     stderror();
     return -1;
   }
-  FSx = malloc(FAT32SizeInBytes);
-  if (!FSx) {
-    stderror();
-    free(FS1);
-    return -1;
-  }
-  BSOffset = fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec;
-  if (fs_seek(fs->fd, BSOffset, SEEK_SET) == -1) {
-    myerror("Seek error!");
-    free(FS1);
-    free(FSx);
-    return -1;
-  }
-  if (!fs_read(FS1, 1, FAT32SizeInBytes, fs->fd)) {
-    myerror("Failed to read from file!");
-    free(FS1);
-    free(FSx);
-    return -1;
-  }
+  FSx = FS1 + chunkSize;
+
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec;
+
+  for (pos = 0; pos < FAT32SizeInBytes && !result; pos += len) {
+    len = FAT32SizeInBytes - pos < chunkSize ? FAT32SizeInBytes - pos :
+      chunkSize;
 
-  for (i = 1; i < fs->bs.BS_NumFAT32s; i++) {
-    if (fs_seek(fs->fd, BSOffset + (int) FAT32SizeInBytes, SEEK_SET) == -1) {
+    if (fs_seek(fs->fd, BSOffset + (int64_t) pos, SEEK_SET) == -1) {
       myerror("Seek error!");
       free(FS1);
-      free(FSx);
       return -1;
     }
-    if (!fs_read(FSx, 1, FAT32SizeInBytes, fs->fd)) {
+    if (!fs_read(FS1, 1, len, fs->fd)) {
       myerror("Failed to read from file!");
       free(FS1);
-      free(FSx);
       return -1;
     }
 
-    result = memcmp(FS1, FSx, FAT32SizeInBytes);
-    if (result) {
-      break; // FAT32s do not match
+    for (i = 1; i < fs->bs.BS_NumFAT32s; i++) {
+      if (fs_seek(fs->fd, BSOffset + (int64_t) i * FAT32SizeInBytes +
+          (int64_t) pos, SEEK_SET) == -1) {
+        myerror("Seek error!");
+        free(FS1);
+        return -1;
+      }
+      if (!fs_read(FSx, 1, len, fs->fd)) {
+        myerror("Failed to read from file!");
+        free(FS1);
+        return -1;
+      }
+
+      result = memcmp(FS1, FSx, len);
+      if (result) {
+        // FAT32s do not match, locate the first differing byte
+        for (j = 0; FS1[j] == FSx[j]; j++);
+        myerror("FAT32 %d differs from FAT32 0 at offset %#x (cluster %u)!",
+          i, pos + j, (pos + j) / 4);
+        break;
+      }
     }
-
   }
 
   free(FS1);
-  free(FSx);
 
   return result;
 }
 
+int hashFAT32(struct sFileSystem *fs, uint64_t *hash) {
+  /*
+   * calculates the FNV-1a hash of the first FAT32, it changes whenever
+   * clusters are allocated or freed
+   */
+
+  unsigned FAT32SizeInBytes, chunkSize, pos, len, j;
+  int64_t BSOffset;
+
+  unsigned char *chunk;
+
+  FAT32SizeInBytes = fs->FAT32Size * fs->sectorSize;
+
+  // chunks are a multiple of the sector size
+  chunkSize = FAT32_CHECK_CHUNK_SIZE / fs->sectorSize * fs->sectorSize;
+  if (!chunkSize)
+    chunkSize = fs->sectorSize;
+
+  chunk = malloc(chunkSize);
+  if (!chunk) {
+    stderror();
+    return -1;
+  }
+
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec;
+  if (fs_seek(fs->fd, BSOffset, SEEK_SET) == -1) {
+    myerror("Seek error!");
+    free(chunk);
+    return -1;
+  }
+
+  *hash = 0xcbf29ce484222325ULL;
+  for (pos = 0; pos < FAT32SizeInBytes; pos += len) {
+    len = FAT32SizeInBytes - pos < chunkSize ? FAT32SizeInBytes - pos :
+      chunkSize;
+
+    if (!fs_read(chunk, 1, len, fs->fd)) {
+      myerror("Failed to read from file!");
+      free(chunk);
+      return -1;
+    }
+
+    for (j = 0; j < len; j++)
+      *hash = (*hash ^ chunk[j]) * 0x100000001b3ULL;
+  }
+
+  free(chunk);
+
+  return 0;
+}
+
 int getFAT32Entry(struct sFileSystem *fs, unsigned cluster, unsigned *data) {
   /*
    * retrieves FAT32 entry for a cluster number
    */
 
-  int BSOffset, FAT32Offset;
+  int64_t BSOffset;
+  unsigned FAT32Offset;
 
   *data = 0;
 
@@ -215,33 +273,213 @@ int getFAT32Entry(struct sFileSystem *fs, unsigned cluster, unsigned *data) {
     return -1;
   }
 
-  BSOffset =
-    fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec +
-    (int) (cluster * sizeof cluster);
-  FAT32Offset = BSOffset % (int) fs->sectorSize;
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec +
+    (int64_t) cluster * 4;
+  FAT32Offset = (unsigned) (BSOffset % fs->sectorSize);
   if (fs_seek(fs->fd, BSOffset - FAT32Offset, SEEK_SET) == -1) {
     myerror("Seek error!");
     return -1;
   }
-  char *go = malloc(fs->sectorSize);
-  if (!fs_read(go, 1, fs->sectorSize, fs->fd)) {
+  if (!fs_read(fs->sectorBuf, 1, fs->sectorSize, fs->fd)) {
     myerror("Failed to read from file!");
     return -1;
   }
-  memcpy(data, go + FAT32Offset, sizeof *data);
+  memcpy(data, fs->sectorBuf + FAT32Offset, sizeof *data);
   *data = *data & 0x0fffffff;
   return 0;
 
 }
 
-int getClusterOffset(struct sFileSystem *fs, unsigned cluster) {
+int setFAT32Entry(struct sFileSystem *fs, unsigned cluster, unsigned data) {
+  /*
+   * sets FAT32 entry for a cluster number in all FAT32s, the reserved upper
+   * four bits of the entry are preserved
+   */
+
+  int64_t BSOffset, sector;
+  unsigned FAT32Offset, value;
+  int i;
+  char *buf;
+
+  if (fs->FSType == -1) {
+    myerror("File system not FAT32!");
+    return -1;
+  }
+  if (cluster < 2 || cluster >= (unsigned) fs->clusters + 2) {
+    myerror("Cluster %08x does not exist!", cluster);
+    return -1;
+  }
+
+  // pending writes to freed clusters must not overwrite their next owner
+  if (!data) {
+    discardBufferedCluster(&fs->wb, cluster);
+    forgetWrittenCluster(&fs->verify, cluster);
+    forgetCachedCluster(&fs->cache, cluster);
+  }
+
+  // devices are read and written in whole sectors
+  buf = fs->sectorBuf;
+
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec +
+    (int64_t) cluster * 4;
+  FAT32Offset = (unsigned) (BSOffset % fs->sectorSize);
+
+  for (i = 0; i < fs->bs.BS_NumFAT32s; i++) {
+    sector = BSOffset - (int64_t) FAT32Offset +
+      (int64_t) i * fs->FAT32Size * fs->sectorSize;
+    if (fs_seek(fs->fd, sector, SEEK_SET) == -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_read(buf, 1, fs->sectorSize, fs->fd)) {
+      myerror("Failed to read from file!");
+      return -1;
+    }
+
+    memcpy(&value, buf + FAT32Offset, sizeof(value));
+    value = (value & 0xF0000000U) | (data & 0x0FFFFFFFU);
+    memcpy(buf + FAT32Offset, &value, sizeof(value));
+
+    if (fs_seek(fs->fd, sector, SEEK_SET) == -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_write(buf, 1, fs->sectorSize, fs->fd)) {
+      myerror("Failed to write to file!");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int updateFSInfo(struct sFileSystem *fs, int freed, unsigned nextFree) {
+  /*
+   * adds freed clusters to the free count of the FSInfo sector and sets the
+   * next free hint unless nextFree is zero, unknown counts and missing
+   * FSInfo sectors are left alone
+   */
+
+  struct sFSInfo *info;
+  char *buf;
+
+  if (!fs->bs.BS_FSInfo || fs->bs.BS_FSInfo == 0xFFFF ||
+    fs->bs.BS_FSInfo >= fs->bs.BS_RsvdSecCnt ||
+    fs->sectorSize < sizeof(struct sFSInfo))
+    return 0;
+
+  buf = fs->sectorBuf;
+
+  if (fs_seek(fs->fd, (int64_t) fs->bs.BS_FSInfo * fs->sectorSize, SEEK_SET) ==
+    -1) {
+    myerror("Seek error!");
+    return -1;
+  }
+  if (!fs_read(buf, 1, fs->sectorSize, fs->fd)) {
+    myerror("Failed to read from file!");
+    return -1;
+  }
+
+  info = (struct sFSInfo *) buf;
+  if (info->FSI_LeadSig != FSI_LEAD_SIG ||
+    info->FSI_StrucSig != FSI_STRUC_SIG ||
+    info->FSI_TrailSig != FSI_TRAIL_SIG ||
+    info->FSI_Free_Count == FSI_UNKNOWN) {
+    return 0;
+  }
+  info->FSI_Free_Count += (unsigned) freed;
+  if (nextFree)
+    info->FSI_Nxt_Free = nextFree;
+
+  if (fs_seek(fs->fd, (int64_t) fs->bs.BS_FSInfo * fs->sectorSize, SEEK_SET) ==
+    -1) {
+    myerror("Seek error!");
+    return -1;
+  }
+  if (!fs_write(buf, 1, fs->sectorSize, fs->fd)) {
+    myerror("Failed to write to file!");
+    return -1;
+  }
+
+  return 0;
+}
+
+void *allocBuffer(struct sFileSystem *fs, size_t size) {
+  /*
+   * allocates an I/O buffer, the counter shows that buffers are reused
+   * instead of being allocated per directory
+   */
+
+  void *buf = malloc(size);
+
+  if (!buf) {
+    stderror();
+    return 0;
+  }
+  fs->allocations++;
+
+  return buf;
+}
+
+int readCluster(struct sFileSystem *fs, unsigned cluster, void *buf) {
+  /*
+   * reads a cluster of the data region, cached clusters and buffered
+   * clusters are not read from the device again
+   */
+
+  const char *data;
+
+  data = findCachedCluster(&fs->cache, cluster);
+  if (!data)
+    data = findBufferedCluster(&fs->wb, cluster);
+  if (data) {
+    memcpy(buf, data, fs->clusterSize);
+    return 0;
+  }
+
+  if (fs_seek(fs->fd, getClusterOffset(fs, cluster), SEEK_SET) == -1) {
+    myerror("Seek error!");
+    return -1;
+  }
+  if (!fs_read(buf, 1, fs->clusterSize, fs->fd)) {
+    myerror("Failed to read from file!");
+    return -1;
+  }
+
+  if (cacheCluster(fs, cluster, buf)) {
+    myerror("Failed to cache cluster!");
+    return -1;
+  }
+
+  return 0;
+}
+
+int writeCluster(struct sFileSystem *fs, unsigned cluster, const void *buf) {
+  /*
+   * writes a directory cluster to the write-back buffer, the cache is
+   * written through
+   */
+
+  if (bufferCluster(fs, cluster, buf)) {
+    myerror("Failed to buffer cluster!");
+    return -1;
+  }
+  if (cacheCluster(fs, cluster, buf)) {
+    myerror("Failed to cache cluster!");
+    return -1;
+  }
+
+  return 0;
+}
+
+int64_t getClusterOffset(struct sFileSystem *fs, unsigned cluster) {
   /*
    * returns the offset of a specific cluster in the data region of the file
-   * system
+   * system, offsets of large file systems don't fit into 32 bits
    */
 
-  return (int) (((cluster - 2) * fs->bs.BS_SecPerClus +
-      fs->firstDataSector) * fs->sectorSize);
+  return ((int64_t) (cluster - 2) * fs->bs.BS_SecPerClus +
+    fs->firstDataSector) * fs->sectorSize;
 
 }
 
@@ -263,22 +501,51 @@ int parseEntry(union sDirEntry *de) {
 int calculateChecksum(char *sname) {
   int len, sum = 0;
   for (len = 11; len != 0; len--)
-    sum = ((sum & 1) ? 0x80 : 0 + (sum >> 1) + *sname++) & 0xFF;
+    sum = (((sum & 1) ? 0x80 : 0) + (sum >> 1) + (*sname++ & 0xFF)) & 0xFF;
   return sum;
 }
 
 
-int openFileSystem(char *path, char *mode, struct sFileSystem *fs) {
+void freeScratchBuffers(struct sFileSystem *fs) {
+  /*
+   * frees the scratch buffers of a file system
+   */
+
+  free(fs->sectorBuf);
+  free(fs->clusterBuf);
+  free(fs->dirBuf);
+  fs->sectorBuf = fs->clusterBuf = fs->dirBuf = 0;
+}
+
+int openFileSystem(char *path, char *mode, int flags,
+  const struct sPartition *part, const struct sMediaModel *model,
+  struct sFileSystem *fs) {
   /*
    * opens file system and assemlbes file system information into data
    * structure
    */
 
-  fs->fd = fs_open(path, mode);
+  memset(&fs->wb, 0, sizeof(fs->wb));
+  memset(&fs->verify, 0, sizeof(fs->verify));
+  memset(&fs->cache, 0, sizeof(fs->cache));
+  memset(&fs->names, 0, sizeof(fs->names));
+  fs->sectorBuf = fs->clusterBuf = fs->dirBuf = 0;
+  fs->allocations = 0;
+
+  // other partitions of the device may be processed concurrently
+  fs->fd = fs_open(path, mode, part ? flags | FS_SHARED : flags);
   if (!fs->fd) {
     stderror();
     return -1;
   }
+  if (part && fs_setPartition(fs->fd, (int64_t) part->offset,
+      (int64_t) part->size)) {
+    stderror();
+    fs_close(fs->fd);
+    return -1;
+  }
+  if (model)
+    fs_simulate(fs->fd, model);
 
   // read boot sector
   if (read_bootsector(fs->fd, &(fs->bs))) {
@@ -293,6 +560,13 @@ int openFileSystem(char *path, char *mode, struct sFileSystem *fs) {
     return -1;
   }
 
+  if (part && (uint64_t) fs->bs.BS_TotSec32 * fs->bs.BS_BytesPerSec >
+    part->size) {
+    myerror("File system is larger than partition %u!", part->number);
+    fs_close(fs->fd);
+    return -1;
+  }
+
   fs->FSType = checkFSType(&(fs->bs));
   if (fs->FSType == -1) {
     myerror("File system not FAT32!");
@@ -347,10 +621,45 @@ int openFileSystem(char *path, char *mode, struct sFileSystem *fs) {
     fs->bs.BS_RsvdSecCnt + (fs->bs.BS_NumFAT32s * fs->FAT32Size)
     + rootDirSectors;
 
+  // scratch buffers are reused by all reads and writes, the directory buffer
+  // holds the largest possible directory
+  fs->dirBufSize = ((size_t) MAX_DIR_ENTRIES * DIR_ENTRY_SIZE +
+    fs->clusterSize - 1) / fs->clusterSize * fs->clusterSize;
+  fs->sectorBuf = allocBuffer(fs, fs->sectorSize);
+  fs->clusterBuf = allocBuffer(fs, fs->clusterSize);
+  fs->dirBuf = allocBuffer(fs, fs->dirBufSize);
+  if (!fs->sectorBuf || !fs->clusterBuf || !fs->dirBuf) {
+    myerror("Failed to allocate scratch buffers!");
+    freeScratchBuffers(fs);
+    fs_close(fs->fd);
+    return -1;
+  }
+
   // convert utf 16 le to local charset
   fs->cd = iconv_open("", "UTF-16LE");
   if (fs->cd == (iconv_t) -1) {
     myerror("iconv_open failed!");
+    freeScratchBuffers(fs);
+    fs_close(fs->fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+int syncFileSystem(struct sFileSystem *fs) {
+  /*
+   * writes buffered clusters and flushes them to the device, the data is
+   * durable afterwards
+   */
+
+  if (flushWriteBack(fs)) {
+    myerror("Failed to write buffered clusters!");
+    return -1;
+  }
+  if (fs_sync(fs->fd)) {
+    stderror();
+    myerror("Failed to flush device!");
     return -1;
   }
 
@@ -359,11 +668,22 @@ int openFileSystem(char *path, char *mode, struct sFileSystem *fs) {
 
 int closeFileSystem(struct sFileSystem *fs) {
   /*
-   * closes file system
+   * closes file system, buffered clusters are written but not flushed
    */
 
+  int ret = 0;
+
+  if (flushWriteBack(fs)) {
+    myerror("Failed to write buffered clusters!");
+    ret = -1;
+  }
+  freeWriteBack(&fs->wb);
+  freeVerify(&fs->verify);
+  freeClusterCache(&fs->cache);
+  freeNameTable(&fs->names);
+  freeScratchBuffers(fs);
   fs_close(fs->fd);
   iconv_close(fs->cd);
 
-  return 0;
+  return ret;
 }
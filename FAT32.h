@@ -31,10 +31,32 @@
 #define MAX_FILE_LEN 0xFFFFFFFF
 #define MAX_DIR_ENTRIES 65536
 
+// size of the chunks in which the FAT32 copies are compared
+#define FAT32_CHECK_CHUNK_SIZE 65536U
+
+// special FAT32 entries
+#define FAT32_BAD_CLUSTER 0x0FFFFFF7U
+#define FAT32_EOC 0x0FFFFFF8U // smallest end of chain mark
+#define FAT32_EOC_MARK 0x0FFFFFFFU // end of chain mark written by rosso
+
+// FSInfo signatures
+#define FSI_LEAD_SIG 0x41615252U
+#define FSI_STRUC_SIG 0x61417272U
+#define FSI_TRAIL_SIG 0xAA550000U
+#define FSI_UNKNOWN 0xFFFFFFFFU
+
 #include <stdio.h>
 #include <iconv.h>
 
 #include <stdint.h>
+#include "clustercache.h"
+#include "nametable.h"
+#include "verify.h"
+#include "writeback.h"
+
+struct sDevice;
+struct sMediaModel;
+struct sPartition;
 
 // Directory entry structures
 
@@ -122,7 +144,7 @@ struct sFSInfo {
 
 // holds information about the file system
 struct sFileSystem {
-  FILE *fd;
+  struct sDevice *fd;
   uint32_t mode;
   struct sBootSector bs;
   int32_t FSType;
@@ -137,14 +159,27 @@ struct sFileSystem {
   uint32_t maxClusterChainLength;
   uint32_t firstDataSector;
   iconv_t cd;
+  struct sWriteBack wb; // dirty directory clusters
+  struct sVerify verify; // checksums of written directory clusters
+  struct sClusterCache cache; // recently read and written directory clusters
+  struct sNameTable names; // names of parsed entries with their sort keys
+  char *sectorBuf, *clusterBuf; // scratch buffers of one sector and cluster
+  char *dirBuf; // scratch buffer of a whole directory
+  size_t dirBufSize;
+  unsigned long allocations; // heap allocations of I/O buffers
 };
 
 // functions
 
-// opens file system and calculates file system information
-int32_t openFileSystem(char *path, char *mode, struct sFileSystem *fs);
+// opens file system and calculates file system information, flags are
+// passed to fs_open(), the file system starts at the offset of part or at
+// the beginning of the device if it is 0, all transfers are charged with
+// the latency of model unless it is 0
+int32_t openFileSystem(char *path, char *mode, int32_t flags,
+  const struct sPartition *part, const struct sMediaModel *model,
+  struct sFileSystem *fs);
 
-// sync file system
+// writes buffered clusters and flushes them to the device
 int32_t syncFileSystem(struct sFileSystem *fs);
 
 // closes file system
@@ -157,8 +192,26 @@ int32_t check_bootsector(struct sBootSector *bs);
 int32_t getFAT32Entry(struct sFileSystem *fs, uint32_t cluster,
   uint32_t *data);
 
+// sets FAT32 entry for a cluster number in all FAT32s
+int32_t setFAT32Entry(struct sFileSystem *fs, uint32_t cluster,
+  uint32_t data);
+
+// adds freed clusters to the free count of the FSInfo sector
+int32_t updateFSInfo(struct sFileSystem *fs, int32_t freed,
+  uint32_t nextFree);
+
+// allocates an I/O buffer and counts the allocation
+void *allocBuffer(struct sFileSystem *fs, size_t size);
+
+// reads a cluster of the data region
+int32_t readCluster(struct sFileSystem *fs, uint32_t cluster, void *buf);
+
+// writes a directory cluster to the write-back buffer
+int32_t writeCluster(struct sFileSystem *fs, uint32_t cluster,
+  const void *buf);
+
 // returns the offset of a specific cluster in the data region of the FS
-int32_t getClusterOffset(struct sFileSystem *fs, uint32_t cluster);
+int64_t getClusterOffset(struct sFileSystem *fs, uint32_t cluster);
 
 // parses one directory entry
 int32_t parseEntry(union sDirEntry *de);
@@ -169,4 +222,7 @@ int32_t calculateChecksum(char *sname);
 // checks whether all FAT32s have the same content
 int32_t checkFAT32s(struct sFileSystem *fs);
 
+// calculates a hash of the first FAT32
+int32_t hashFAT32(struct sFileSystem *fs, uint64_t *hash);
+
 #endif // __FAT32_h__
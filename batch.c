@@ -0,0 +1,123 @@
+/*
+ * This file contains/describes functions that process several devices in
+ * one invocation on a pool of worker threads.
+ */
+
+#include "batch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "errors.h"
+
+struct sBatch {
+  /*
+   * state shared by the worker threads
+   */
+  struct sTarget *targets;
+  int count, next; // next is the first target that is not taken yet
+  int (*process)(const struct sTarget *target);
+  pthread_mutex_t lock;
+};
+
+void *batchWorker(void *arg) {
+  /*
+   * take targets from the batch until all of them are processed
+   */
+
+  struct sBatch *batch = arg;
+  struct sTarget *target;
+
+  for (;;) {
+    pthread_mutex_lock(&batch->lock);
+    target = batch->next < batch->count ? &batch->targets[batch->next++] : 0;
+    pthread_mutex_unlock(&batch->lock);
+
+    if (!target)
+      return 0;
+
+    target->status = batch->process(target);
+  }
+}
+
+int runBatch(struct sTarget *targets, int count, int jobs,
+  int (*process)(const struct sTarget *target)) {
+  /*
+   * process all targets with up to jobs worker threads, returns the number
+   * of failed targets
+   */
+
+  struct sBatch batch;
+  pthread_t *threads;
+  int j, started, failures = 0;
+
+  batch.targets = targets;
+  batch.count = count;
+  batch.next = 0;
+  batch.process = process;
+
+  if (jobs > count)
+    jobs = count;
+
+  if (pthread_mutex_init(&batch.lock, 0)) {
+    myerror("Failed to initialize mutex!");
+    return -1;
+  }
+
+  if (jobs <= 1) {
+    // no threads needed, keep the order of the targets
+    batchWorker(&batch);
+  }
+  else {
+    threads = malloc((size_t) jobs * sizeof(pthread_t));
+    if (!threads) {
+      stderror();
+      pthread_mutex_destroy(&batch.lock);
+      return -1;
+    }
+
+    for (started = 0; started < jobs; started++) {
+      if (pthread_create(&threads[started], 0, batchWorker, &batch)) {
+        // continue with the threads that are running already
+        myerror("Failed to start worker thread!");
+        break;
+      }
+    }
+
+    // process targets in this thread if no worker could be started
+    if (!started)
+      batchWorker(&batch);
+
+    for (j = 0; j < started; j++)
+      pthread_join(threads[j], 0);
+
+    free(threads);
+  }
+
+  pthread_mutex_destroy(&batch.lock);
+
+  for (j = 0; j < count; j++) {
+    if (targets[j].status)
+      failures++;
+  }
+
+  return failures;
+}
+
+void printBatchSummary(const struct sTarget *targets, int count) {
+  /*
+   * print the result of every target
+   */
+
+  int j, failures = 0;
+
+  printf("\nSummary:\n");
+  for (j = 0; j < count; j++) {
+    printf("  %-6s %s\n", targets[j].status ? "FAILED" : "OK",
+      targets[j].name);
+    if (targets[j].status)
+      failures++;
+  }
+  printf("%d of %d devices processed successfully.\n", count - failures,
+    count);
+}
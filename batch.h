@@ -0,0 +1,31 @@
+/*
+ * This file contains/describes functions that process several devices in
+ * one invocation on a pool of worker threads.
+ */
+
+#ifndef __batch_h__
+#define __batch_h__
+
+#include "partition.h"
+
+// upper limit for the number of worker threads
+#define MAX_JOBS 256
+
+struct sTarget {
+  /*
+   * one device of a batch
+   */
+  char *filename;
+  char *name; // filename or partition like "disk.img#2"
+  struct sPartition partition; // number 0 is the whole device
+  int status; // result of processing the device, -1 on failure
+};
+
+// process all targets with up to jobs worker threads
+int runBatch(struct sTarget *targets, int count, int jobs,
+  int (*process)(const struct sTarget *target));
+
+// print the result of every target
+void printBatchSummary(const struct sTarget *targets, int count);
+
+#endif // __batch_h__
@@ -0,0 +1,84 @@
+#!/bin/dash -e
+if [ "$#" != 0 ]
+then
+  cat <<'eof'
+SYNOPSIS
+  alloc.sh
+
+EXAMPLE
+  check/alloc.sh
+
+NOTES
+  Builds rosso for the host and sorts generated trees of 32, 128 and 512
+  directories with -m. The number of allocated I/O buffers must not grow
+  with the number of directories. The write-back limit is lowered, so the
+  write-back buffer reaches its size on the smallest tree already. Run it
+  from the source directory, it needs a C compiler only.
+eof
+  exit 1
+fi
+
+t=$(mktemp -d)
+trap 'rm -rf "$t"' EXIT
+
+${CC:-cc} -D_GNU_SOURCE -DWRITEBACK_LIMIT=0x10000 -std=c11 -O \
+  -o "$t/rosso" *.c -lpthread
+${CC:-cc} -std=c11 -O -o "$t/mkimage" check/mkimage.c
+
+# tree DIRS: unsorted directories with 40 files each and a sub directory
+tree() {
+  g=$1
+  while [ $g -gt 0 ]
+  do
+    echo "d /dir $g"
+    k=40
+    while [ $k -gt 0 ]
+    do
+      echo "f 100 /dir $g/track $k.mp3"
+      k=$((k - 1))
+    done
+    echo "d /dir $g/extra"
+    echo "f 100 /dir $g/extra/notes.txt"
+    g=$((g - 1))
+  done
+}
+
+for dirs in 32 128 512
+do
+  tree $dirs | "$t/mkimage" "$t/tree$dirs.img"
+done
+
+failures=0
+
+# check NAME [OPTION...]
+check() {
+  name=$1
+  shift
+
+  counts=
+  for dirs in 32 128 512
+  do
+    cp "$t/tree$dirs.img" "$t/run.img"
+    counts="$counts $("$t/rosso" -m "$@" "$t/run.img" |
+      awk '/Allocated [0-9]+ I\/O buffers/ { print $(NF - 2) }')"
+  done
+
+  set -- $counts
+  if [ "$#" = 3 ] && [ "$1" = "$2" ] && [ "$2" = "$3" ]
+  then
+    printf '\33[1;32m%-4s\33[m %s\n' ok "$name"
+  else
+    printf '\33[1;31m%-4s\33[m %s\n' FAIL "$name"
+    failures=$((failures + 1))
+  fi
+  printf '     allocations for 32, 128 and 512 directories:%s\n' "$counts"
+}
+
+check 'sort'
+check 'sort ignoring case' -c
+check 'compact' --compact --compact-free
+check 'defrag directories' --defrag-dirs
+check 'reorder files' --reorder-files
+check 'verify' --verify
+
+[ $failures = 0 ]
@@ -0,0 +1,692 @@
+/*
+ * This file contains the comparator benchmark. It sorts generated name
+ * corpora in all name sort modes and prints the cost per comparison and the
+ * total sort time as tab separated values. The sort paths of small and
+ * large directories are timed over growing directories to find the size
+ * from which RADIX_SORT_THRESHOLD switches to radix or merge sort.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <locale.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "../entrylist.h"
+#include "../errors.h"
+#include "../FAT32.h"
+#include "../nametable.h"
+#include "../natstrcmp.h"
+#include "../options.h"
+#include "../sortkey.h"
+#include "../stringlist.h"
+
+// comparisons per timed comparator run
+#define BENCH_COMPARES 0x100000
+
+// entries sorted per mode, small corpora are sorted several times
+#define BENCH_SORTED_ENTRIES 0x40000
+
+// number of precomputed index pairs for comparisons
+#define BENCH_PAIRS 0x1000
+
+// largest directory of the crossover benchmark, a power of two
+#define BENCH_CROSSOVER_MAX 0x1000
+
+// entries sorted per directory size and sort path
+#define BENCH_CROSSOVER_ENTRIES 0x8000
+
+// sort paths of sortDirEntryList()
+#define PATH_INSERTION 0
+#define PATH_MERGE 1
+#define PATH_RADIX 2
+
+struct sCorpus {
+  /*
+   * generated directory
+   */
+  const char *name;
+  size_t n;
+  char **lnames, **snames;
+  uint16_t *dates, *times;
+  uint8_t *attrs;
+};
+
+struct sBenchMode {
+  /*
+   * sort mode given by a sort key specification and the legacy options
+   */
+  const char *name;
+  const char *spec;
+  int ascii, icase, natural, prefixes;
+};
+
+// options of the benchmarked sort mode
+struct sOptions OPTIONS;
+
+const struct sBenchMode benchModes[] = {
+  {"locale", "type,name", 0, 0, 0, 0},
+  {"ascii", "type,name", 1, 0, 0, 0},
+  {"icase", "type,name", 0, 1, 0, 0},
+  {"natural", "type,name", 0, 0, 1, 0},
+  {"natural-icase", "type,name", 0, 1, 1, 0},
+  {"prefixes", "type,name", 0, 0, 0, 1},
+  {"mtime", "type,mtime", 0, 0, 0, 0},
+  {0, 0, 0, 0, 0, 0}
+};
+
+const char *artists[] = {
+  "The Beatles", "A Tribe Called Quest", "The Who", "Radiohead",
+  "The National", "Air", "A Perfect Circle", "Daft Punk", "The xx",
+  "Boards of Canada", "Portishead", "The Velvet Underground"
+};
+
+const char *words[] = {
+  "Love", "night", "Blue", "song", "Dream", "road", "Home", "light",
+  "Fire", "rain", "Heart", "city", "Summer", "time", "Gold", "river"
+};
+
+const char *unicodeWords[] = {
+  "Ångström", "naïve", "Ærøskøbing", "Москва", "Привет", "東京", "音楽",
+  "Ελληνικά", "Straße", "café", "Łódź", "Öl", "日本語のタイトル",
+  "Zürich", "Čeština", "Ñandú"
+};
+
+// sort modes with a radix sort by name or time and without a radix sort
+const struct sBenchMode crossoverModes[] = {
+  {"locale", "type,name", 0, 0, 0, 0},
+  {"mtime", "type,mtime", 0, 0, 0, 0},
+  {"natural", "type,name", 0, 0, 1, 0},
+  {0, 0, 0, 0, 0, 0}
+};
+
+const char *sortPaths[] = { "insertion", "merge", "radix" };
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+uint32_t nextRandom(uint32_t *state) {
+  /*
+   * xorshift generator, corpora are the same in every run
+   */
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+double now() {
+  /*
+   * returns a monotonic time in seconds
+   */
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double) count.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+int addName(struct sCorpus *corpus, size_t j, const char *lname,
+  const char *sname, uint32_t *state) {
+  /*
+   * store entry j of a corpus
+   */
+
+  corpus->lnames[j] = malloc(strlen(lname) + 1);
+  corpus->snames[j] = malloc(strlen(sname) + 1);
+  if (!corpus->lnames[j] || !corpus->snames[j]) {
+    stderror();
+    return -1;
+  }
+  strcpy(corpus->lnames[j], lname);
+  strcpy(corpus->snames[j], sname);
+
+  // dates between 2000 and 2031, a few directories
+  corpus->dates[j] = (uint16_t) ((20 + nextRandom(state) % 32) << 9 |
+    (1 + nextRandom(state) % 12) << 5 | (1 + nextRandom(state) % 28));
+  corpus->times[j] = (uint16_t) (nextRandom(state) % 0xC000);
+  corpus->attrs[j] = nextRandom(state) % 20 ? ATTR_ARCHIVE : ATTR_DIRECTORY;
+
+  return 0;
+}
+
+void makeShortName(const char *lname, size_t j, char *sname) {
+  /*
+   * derive a numbered short name like "BEATLE~1.MP3" from a long name
+   */
+
+  const char *ext = strrchr(lname, '.');
+  size_t len = 0;
+
+  for (; *lname && lname != ext && len < 6; lname++) {
+    if ((*lname >= 'A' && *lname <= 'Z') || (*lname >= '0' && *lname <= '9'))
+      sname[len++] = *lname;
+    else if (*lname >= 'a' && *lname <= 'z')
+      sname[len++] = (char) (*lname - 'a' + 'A');
+  }
+  sprintf(sname + len, "~%u", (unsigned) (j % 9 + 1));
+  if (ext) {
+    strcat(sname, ".");
+    strncat(sname, ext + 1, 3);
+  }
+}
+
+void makeMusicName(uint32_t *state, size_t j, char *lname, char *sname) {
+  /*
+   * track names like "The Who - 07 - Blue night.mp3"
+   */
+
+  sprintf(lname, "%s - %02u - %s %s.mp3",
+    artists[nextRandom(state) % COUNT(artists)],
+    (unsigned) (nextRandom(state) % 24 + 1),
+    words[nextRandom(state) % COUNT(words)],
+    words[nextRandom(state) % COUNT(words)]);
+  makeShortName(lname, j, sname);
+}
+
+void makeCameraName(uint32_t *state, size_t j, char *lname, char *sname) {
+  /*
+   * DCIM names, they fit into short names and have no long names
+   */
+
+  static const char *formats[] = {
+    "IMG_%04u.JPG", "DSC%05u.JPG", "P%07u.JPG", "MVI_%04u.MOV"
+  };
+
+  (void) j;
+  sprintf(sname, formats[nextRandom(state) % COUNT(formats)],
+    (unsigned) (nextRandom(state) % 10000));
+  lname[0] = 0;
+}
+
+void makeUnicodeName(uint32_t *state, size_t j, char *lname, char *sname) {
+  /*
+   * long names of four to ten words with non ASCII characters
+   */
+
+  unsigned k, words = 4 + nextRandom(state) % 7;
+
+  lname[0] = 0;
+  for (k = 0; k < words; k++) {
+    if (k)
+      strcat(lname, " ");
+    strcat(lname, unicodeWords[nextRandom(state) % COUNT(unicodeWords)]);
+  }
+  strcat(lname, ".flac");
+  makeShortName(lname, j, sname);
+}
+
+int makeCorpus(struct sCorpus *corpus, const char *name, size_t n,
+  int generator) {
+  /*
+   * generate a corpus of n entries, generator 3 mixes all generators
+   */
+
+  char lname[PATH_MAX + 1], sname[PATH_MAX + 1];
+  uint32_t state = 0x2545F491U;
+  size_t j;
+  int g;
+
+  corpus->name = name;
+  corpus->n = n;
+  corpus->lnames = calloc(n, sizeof(char *));
+  corpus->snames = calloc(n, sizeof(char *));
+  corpus->dates = malloc(n * sizeof(uint16_t));
+  corpus->times = malloc(n * sizeof(uint16_t));
+  corpus->attrs = malloc(n);
+  if (!corpus->lnames || !corpus->snames || !corpus->dates ||
+    !corpus->times || !corpus->attrs) {
+    stderror();
+    return -1;
+  }
+
+  for (j = 0; j < n; j++) {
+    g = generator == 3 ? (int) (nextRandom(&state) % 3) : generator;
+    if (g == 0)
+      makeMusicName(&state, j, lname, sname);
+    else if (g == 1)
+      makeCameraName(&state, j, lname, sname);
+    else
+      makeUnicodeName(&state, j, lname, sname);
+    if (addName(corpus, j, lname, sname, &state))
+      return -1;
+  }
+
+  return 0;
+}
+
+void freeCorpus(struct sCorpus *corpus) {
+  /*
+   * free names of a corpus
+   */
+
+  size_t j;
+
+  for (j = 0; j < corpus->n; j++) {
+    if (corpus->lnames)
+      free(corpus->lnames[j]);
+    if (corpus->snames)
+      free(corpus->snames[j]);
+  }
+  free(corpus->lnames);
+  free(corpus->snames);
+  free(corpus->dates);
+  free(corpus->times);
+  free(corpus->attrs);
+}
+
+struct sDirEntryList *makeDirEntryList(const struct sCorpus *corpus,
+  struct sNameTable *names) {
+  /*
+   * build an unsorted directory entry list from a corpus, names are
+   * interned in names
+   */
+
+  struct sDirEntryList *list, *last, *de;
+  struct sShortDirEntry sde;
+  size_t j;
+
+  list = newDirEntryList();
+  if (!list)
+    return 0;
+
+  last = list;
+  for (j = 0; j < corpus->n; j++) {
+    memset(&sde, 0, sizeof(sde));
+    memset(sde.DIR_Name, ' ', sizeof(sde.DIR_Name));
+    memcpy(sde.DIR_Name, corpus->snames[j], strcspn(corpus->snames[j], ".") <
+      8 ? strcspn(corpus->snames[j], ".") : 8);
+    sde.DIR_Atrr = corpus->attrs[j];
+    sde.DIR_WrtDate = corpus->dates[j];
+    sde.DIR_WrtTime = corpus->times[j];
+
+    de = newDirEntry(names, corpus->snames[j], corpus->lnames[j], &sde, 0,
+      1);
+    if (!de) {
+      freeDirEntryList(list);
+      return 0;
+    }
+    last->next = de;
+    last = de;
+  }
+
+  return list;
+}
+
+int setBenchMode(const struct sBenchMode *mode) {
+  /*
+   * set the options of a sort mode and compile its sort keys
+   */
+
+  OPTIONS.ascii = mode->ascii;
+  OPTIONS.ignoreCase = mode->icase;
+  OPTIONS.naturalSort = mode->natural;
+
+  freeStringList(OPTIONS.ignorePrefixes);
+  OPTIONS.ignorePrefixes = newStringList();
+  if (!OPTIONS.ignorePrefixes)
+    return -1;
+  if (mode->prefixes &&
+    (addStringToStringList(OPTIONS.ignorePrefixes, "The ") ||
+      addStringToStringList(OPTIONS.ignorePrefixes, "A ")))
+    return -1;
+
+  return compileSortSpec(&OPTIONS, mode->spec);
+}
+
+void makePairs(size_t n, size_t *pairs) {
+  /*
+   * random index pairs for comparisons
+   */
+
+  uint32_t state = 0x9E3779B9U;
+  size_t j;
+
+  for (j = 0; j < BENCH_PAIRS * 2; j++)
+    pairs[j] = nextRandom(&state) % n;
+}
+
+int benchSort(const struct sCorpus *corpus, const struct sBenchMode *mode,
+  const size_t *pairs) {
+  /*
+   * sort a corpus in one mode, print comparator cost and sort time
+   */
+
+  struct sDirEntryList *list, **array, *tmp;
+  struct sNameTable names = { 0 };
+  double start, best = 0, t;
+  volatile int sink = 0;
+  size_t j, rounds, r;
+
+  if (setBenchMode(mode)) {
+    myerror("Failed to set sort mode '%s'!", mode->name);
+    return -1;
+  }
+
+  rounds = BENCH_SORTED_ENTRIES / corpus->n;
+  if (!rounds)
+    rounds = 1;
+
+  /*
+   * the fastest round counts, list construction is not timed. every round
+   * interns the names again, so sort keys are built within the timed sort
+   */
+  for (r = 0; r < rounds; r++) {
+    list = makeDirEntryList(corpus, &names);
+    if (!list) {
+      freeNameTable(&names);
+      return -1;
+    }
+    start = now();
+    if (sortDirEntryList(&OPTIONS.sortSpec, list, (int) corpus->n)) {
+      freeDirEntryList(list);
+      freeNameTable(&names);
+      return -1;
+    }
+    t = now() - start;
+    if (!r || t < best)
+      best = t;
+    if (r + 1 < rounds) {
+      freeDirEntryList(list);
+      freeNameTable(&names);
+    }
+  }
+
+  // compare random pairs of the sorted entries, their keys are built
+  array = malloc(corpus->n * sizeof(*array));
+  if (!array) {
+    stderror();
+    freeDirEntryList(list);
+    freeNameTable(&names);
+    return -1;
+  }
+  for (j = 0, tmp = list->next; tmp; tmp = tmp->next)
+    array[j++] = tmp;
+
+  start = now();
+  for (j = 0; j < BENCH_COMPARES; j++) {
+    sink += cmpEntries(&OPTIONS.sortSpec, array[pairs[j % BENCH_PAIRS * 2]],
+      array[pairs[j % BENCH_PAIRS * 2 + 1]]);
+  }
+  t = now() - start;
+
+  printf("%s\tsort:%s\t%zu\t%.1f\t%.3f\n", corpus->name, mode->name,
+    corpus->n, t * 1e9 / BENCH_COMPARES, best * 1e3);
+
+  free(array);
+  freeDirEntryList(list);
+  freeNameTable(&names);
+
+  return 0;
+}
+
+double timeSortPath(const struct sSortSpec *spec, struct sDirEntryList *list,
+  struct sDirEntryList **order, struct sDirEntryList **array,
+  struct sDirEntryList **aux, size_t n, int path) {
+  /*
+   * sort the entries of order into list like sortDirEntryList() does on one
+   * of its paths, returns the time in seconds
+   */
+
+  struct sDirEntryList *tmp;
+  double start;
+  size_t i;
+
+  start = now();
+  if (path == PATH_INSERTION) {
+    list->next = 0;
+    for (i = 0; i < n; i++)
+      insertDirEntryList(spec, order[i], list);
+  }
+  else {
+    memcpy(array, order, n * sizeof(*array));
+    if (path == PATH_RADIX)
+      radixSortDirEntryList(spec, array, aux, n);
+    else
+      mergeSortDirEntryList(spec, array, aux, n);
+    tmp = list;
+    for (i = 0; i < n; i++) {
+      tmp->next = array[i];
+      tmp = tmp->next;
+    }
+    tmp->next = 0;
+  }
+
+  return now() - start;
+}
+
+int benchCrossover(const struct sCorpus *corpus,
+  const struct sBenchMode *mode) {
+  /*
+   * time the sort paths over directories of growing size, the keys are
+   * built before, and print the smallest size from which the path of large
+   * directories is faster than insertion
+   */
+
+  struct sDirEntryList *list, *tmp, **order, **array, **aux;
+  struct sNameTable names = { 0 };
+  struct sCorpus dir = *corpus;
+  const struct sSortSpec *spec = &OPTIONS.sortSpec;
+  double best[3], t;
+  size_t n, i, rounds, r, crossover = 0;
+  int path, large;
+
+  if (setBenchMode(mode)) {
+    myerror("Failed to set sort mode '%s'!", mode->name);
+    return -1;
+  }
+  large = spec->radix != RADIX_NONE ? PATH_RADIX : PATH_MERGE;
+
+  order = malloc(corpus->n * sizeof(*order));
+  array = malloc(corpus->n * sizeof(*array));
+  aux = malloc(corpus->n * sizeof(*aux));
+  if (!order || !array || !aux) {
+    stderror();
+    free(order);
+    free(array);
+    free(aux);
+    return -1;
+  }
+
+  for (n = 8; n <= corpus->n; n *= 2) {
+    dir.n = n;
+    list = makeDirEntryList(&dir, &names);
+    if (!list) {
+      free(order);
+      free(array);
+      free(aux);
+      freeNameTable(&names);
+      return -1;
+    }
+    for (i = 0, tmp = list->next; tmp; tmp = tmp->next) {
+      if (spec->needsNameKey && buildSortKey(spec, tmp)) {
+        myerror("Failed to build sort key!");
+        freeDirEntryList(list);
+        free(order);
+        free(array);
+        free(aux);
+        freeNameTable(&names);
+        return -1;
+      }
+      order[i++] = tmp;
+    }
+
+    // the fastest round counts
+    rounds = BENCH_CROSSOVER_ENTRIES / n;
+    if (!rounds)
+      rounds = 1;
+    for (path = PATH_INSERTION; path <= large; path++) {
+      if (path == PATH_MERGE && large == PATH_RADIX)
+        continue;
+      for (r = 0; r < rounds; r++) {
+        t = timeSortPath(spec, list, order, array, aux, n, path);
+        if (!r || t < best[path])
+          best[path] = t;
+      }
+      printf("%s\tcrossover:%s:%s\t%zu\t%.1f\t%.3f\n", corpus->name,
+        mode->name, sortPaths[path], n, best[path] * 1e9 / (double) n,
+        best[path] * 1e3);
+    }
+    if (!crossover && best[large] < best[PATH_INSERTION])
+      crossover = n;
+    else if (best[large] >= best[PATH_INSERTION])
+      crossover = 0;
+
+    freeDirEntryList(list);
+    freeNameTable(&names);
+  }
+
+  // 0 if insertion stays faster up to the largest directory
+  printf("%s\tcrossover:%s\t%zu\t-\t-\n", corpus->name, mode->name,
+    crossover);
+
+  free(order);
+  free(array);
+  free(aux);
+
+  return 0;
+}
+
+const char *getName(const struct sCorpus *corpus, size_t j) {
+  /*
+   * returns the long name of an entry or its short name if it has none
+   */
+
+  return corpus->lnames[j][0] ? corpus->lnames[j] : corpus->snames[j];
+}
+
+void benchFunctions(const struct sCorpus *corpus, const size_t *pairs) {
+  /*
+   * time the building blocks of the name sort keys
+   */
+
+  char buf[PATH_MAX * 2 + 1];
+  const char *a, *b;
+  double start;
+  volatile size_t sink = 0;
+  size_t j;
+
+  start = now();
+  for (j = 0; j < BENCH_COMPARES; j++) {
+    a = getName(corpus, pairs[j % BENCH_PAIRS * 2]);
+    b = getName(corpus, pairs[j % BENCH_PAIRS * 2 + 1]);
+    sink += (size_t) natstrcmp(a, b);
+  }
+  printf("%s\tnatstrcmp\t%zu\t%.1f\t-\n", corpus->name, corpus->n,
+    (now() - start) * 1e9 / BENCH_COMPARES);
+
+  start = now();
+  for (j = 0; j < BENCH_COMPARES; j++) {
+    a = getName(corpus, pairs[j % BENCH_PAIRS * 2]);
+    b = getName(corpus, pairs[j % BENCH_PAIRS * 2 + 1]);
+    sink += (size_t) natstrcasecmp(a, b);
+  }
+  printf("%s\tnatstrcasecmp\t%zu\t%.1f\t-\n", corpus->name, corpus->n,
+    (now() - start) * 1e9 / BENCH_COMPARES);
+
+  start = now();
+  for (j = 0; j < corpus->n; j++)
+    sink += strxfrm(buf, getName(corpus, j), sizeof(buf));
+  printf("%s\tstrxfrm\t%zu\t%.1f\t-\n", corpus->name, corpus->n,
+    (now() - start) * 1e9 / (double) corpus->n);
+
+  start = now();
+  for (j = 0; j < corpus->n; j++)
+    sink += (size_t) stripSpecialPrefixes(OPTIONS.ignorePrefixes,
+      (char *) getName(corpus, j), buf);
+  printf("%s\tstripSpecialPrefixes\t%zu\t%.1f\t-\n", corpus->name, corpus->n,
+    (now() - start) * 1e9 / (double) corpus->n);
+}
+
+int main() {
+  /*
+   * run all benchmarks on all corpora
+   */
+
+  static const struct {
+    const char *name;
+    size_t n;
+    int generator;
+  } corpora[] = {
+    {"music", 2000, 0},
+    {"dcim", 9999, 1},
+    {"unicode", 4000, 2},
+    {"mixed", 65536, 3}
+  };
+
+  struct sCorpus corpus;
+  const struct sBenchMode *mode;
+  size_t pairs[BENCH_PAIRS * 2], j;
+
+  if (!setlocale(LC_ALL, "")) {
+    myerror("Could not set locale!");
+    return 1;
+  }
+
+  // defaults of the command line options
+  if (initOptions(&OPTIONS)) {
+    myerror("Failed to initialize options!");
+    return 1;
+  }
+
+  printf("corpus\tbenchmark\tentries\tns/op\tsort ms\n");
+  for (j = 0; j < COUNT(corpora); j++) {
+    memset(&corpus, 0, sizeof(corpus));
+    if (makeCorpus(&corpus, corpora[j].name, corpora[j].n,
+        corpora[j].generator)) {
+      myerror("Failed to generate corpus!");
+      freeCorpus(&corpus);
+      return 1;
+    }
+    makePairs(corpus.n, pairs);
+
+    benchFunctions(&corpus, pairs);
+
+    for (mode = benchModes; mode->name; mode++) {
+      if (benchSort(&corpus, mode, pairs)) {
+        myerror("Failed to benchmark sort mode '%s'!", mode->name);
+        freeCorpus(&corpus);
+        return 1;
+      }
+    }
+
+    freeCorpus(&corpus);
+    fflush(stdout);
+  }
+
+  // the threshold is a size from which the large directory paths win
+  memset(&corpus, 0, sizeof(corpus));
+  if (makeCorpus(&corpus, "crossover", BENCH_CROSSOVER_MAX, 3)) {
+    myerror("Failed to generate corpus!");
+    freeCorpus(&corpus);
+    return 1;
+  }
+  for (mode = crossoverModes; mode->name; mode++) {
+    if (benchCrossover(&corpus, mode)) {
+      myerror("Failed to benchmark crossover of sort mode '%s'!",
+        mode->name);
+      freeCorpus(&corpus);
+      return 1;
+    }
+  }
+  freeCorpus(&corpus);
+
+  freeOptions(&OPTIONS);
+
+  return 0;
+}
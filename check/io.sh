@@ -0,0 +1,101 @@
+#!/bin/dash -e
+if [ "$#" != 0 ]
+then
+  cat <<'eof'
+SYNOPSIS
+  io.sh
+
+EXAMPLE
+  check/io.sh
+
+NOTES
+  Builds rosso for the host with -DIO_TRACE and compares the reads, writes,
+  seeks and transferred bytes of sort, list and info runs on generated
+  images against upper bounds. Run it from the source directory, it needs
+  a C compiler only.
+eof
+  exit 1
+fi
+
+t=$(mktemp -d)
+trap 'rm -rf "$t"' EXIT
+
+${CC:-cc} -D_GNU_SOURCE -DIO_TRACE -std=c11 -O -o "$t/rosso" *.c -lpthread
+${CC:-cc} -std=c11 -O -o "$t/mkimage" check/mkimage.c
+
+# unsorted tree of four directories with 40 files each and a sub directory
+tree() {
+  for g in delta charlie bravo alfa
+  do
+    echo "d /$g"
+    k=40
+    while [ $k -gt 0 ]
+    do
+      echo "f 3000 /$g/track $k.mp3"
+      k=$((k - 1))
+    done
+    echo "d /$g/extra"
+    echo "f 100 /$g/extra/notes.txt"
+  done
+}
+
+# two directories that grow in turns, so their clusters interleave
+fragmented() {
+  echo "d /one"
+  echo "d /two"
+  k=60
+  while [ $k -gt 0 ]
+  do
+    echo "f 1000 /one/song $k.mp3"
+    echo "f 1000 /two/song $k.mp3"
+    k=$((k - 1))
+  done
+}
+
+tree | "$t/mkimage" "$t/tree.img"
+fragmented | "$t/mkimage" "$t/fragmented.img"
+cp "$t/tree.img" "$t/sorted.img"
+"$t/rosso" "$t/sorted.img" > /dev/null
+
+failures=0
+
+# bounds are about 10% above the counts of the current version
+
+# check NAME IMAGE READS WRITES SEEKS BYTES [OPTION...]
+check() {
+  name=$1
+  image=$2
+  reads=$3
+  writes=$4
+  seeks=$5
+  bytes=$6
+  shift 6
+
+  cp "$t/$image.img" "$t/run.img"
+  rm -f "$t/trace"
+  ROSSO_IO_TRACE="$t/trace" "$t/rosso" "$@" "$t/run.img" > /dev/null
+
+  set -- $(awk '$1 == "T" { r += $3; w += $5; s += $7; b += $9 + $11 }
+    END { print r + 0, w + 0, s + 0, b + 0 }' "$t/trace")
+  if [ "$1" -le "$reads" ] && [ "$2" -le "$writes" ] &&
+    [ "$3" -le "$seeks" ] && [ "$4" -le "$bytes" ]
+  then
+    printf '\33[1;32m%-4s\33[m %s\n' ok "$name"
+  else
+    printf '\33[1;31m%-4s\33[m %s\n' FAIL "$name"
+    failures=$((failures + 1))
+  fi
+  printf '     reads %s/%s, writes %s/%s, seeks %s/%s, bytes %s/%s\n' \
+    "$1" "$reads" "$2" "$writes" "$3" "$seeks" "$4" "$bytes"
+}
+
+check 'sort unsorted tree' tree 85 27 100 670000
+check 'sort sorted tree' sorted 85 27 100 670000
+check 'sort single directory' tree 29 7 32 630000 -d /bravo/
+check 'list tree' tree 85 0 76 655000 -l
+check 'info' tree 52 0 42 945000 -i
+check 'sort fragmented directories' fragmented 52 17 65 647000
+check 'defrag fragmented directories' fragmented 133 94 219 1040000 \
+  --defrag-dirs
+
+[ $failures = 0 ]
@@ -0,0 +1,67 @@
+/*
+ * This file contains the driver of the library checks. It opens an image
+ * read only with librosso, lists one directory with rosso_list_dir() and
+ * prints the names of its entries, one per line. The exit status is 1 if
+ * the directory could not be listed.
+ */
+
+#include <locale.h>
+#include <stdio.h>
+#include "../errors.h"
+#include "../librosso.h"
+#include "../options.h"
+
+int printEntry(void *arg, const struct rosso_entry *entry) {
+  /*
+   * prints the name of an entry
+   */
+
+  (void) arg;
+
+  printf("%s\n", entry->name);
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  struct sOptions opts;
+  struct rosso_ctx *ctx;
+  int ret;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: lib IMAGE PATH\n");
+    return 1;
+  }
+
+  if (!setlocale(LC_ALL, "")) {
+    myerror("Could not set locale!");
+    return 1;
+  }
+
+  if (initOptions(&opts)) {
+    myerror("Failed to initialize options!");
+    return 1;
+  }
+  opts.list = 1;
+  if (prepareOptions(&opts)) {
+    myerror("Failed to prepare options!");
+    freeOptions(&opts);
+    return 1;
+  }
+
+  ctx = rosso_open(argv[1], &opts);
+  if (!ctx) {
+    myerror("Failed to open '%s'!", argv[1]);
+    freeOptions(&opts);
+    return 1;
+  }
+
+  ret = rosso_list_dir(ctx, argv[2], printEntry, 0);
+
+  if (rosso_close(ctx))
+    ret = -1;
+  freeOptions(&opts);
+
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+#!/bin/dash -e
+if [ "$#" != 0 ]
+then
+  cat <<'eof'
+SYNOPSIS
+  lib.sh
+
+EXAMPLE
+  check/lib.sh
+
+NOTES
+  Builds a small program on top of librosso and looks up paths on a
+  generated image with rosso_list_dir(). Directories must be listed, paths
+  through files and "." or ".." components must fail with an error that
+  names the right directory. Run it from the source directory, it needs a
+  C compiler only.
+eof
+  exit 1
+fi
+
+t=$(mktemp -d)
+trap 'rm -rf "$t"' EXIT
+
+objs=
+for f in *.c
+do
+  [ "$f" = rosso.c ] || objs="$objs $f"
+done
+${CC:-cc} -D_GNU_SOURCE -std=c11 -O -o "$t/lib" check/lib.c $objs -lpthread
+${CC:-cc} -std=c11 -O -o "$t/mkimage" check/mkimage.c
+
+# music directory with an album, files next to it and in it
+tree() {
+  echo "d /Music"
+  echo "f 3000 /Music/song.mp3"
+  echo "d /Music/Album One"
+  echo "f 3000 /Music/Album One/track 1.mp3"
+  echo "f 3000 /Music/Album One/track 2.mp3"
+  echo "f 100 /notes.txt"
+}
+
+tree | "$t/mkimage" "$t/tree.img"
+
+failures=0
+
+# check NAME PATH STATUS EXPECTED: EXPECTED is a line of the output or of
+# the error messages
+check() {
+  name=$1
+  path=$2
+  status=$3
+  expected=$4
+
+  ret=0
+  "$t/lib" "$t/tree.img" "$path" > "$t/out" 2>&1 || ret=$?
+
+  if [ "$ret" = "$status" ] && grep -qF -- "$expected" "$t/out"
+  then
+    printf '\33[1;32m%-4s\33[m %s\n' ok "$name"
+  else
+    printf '\33[1;31m%-4s\33[m %s\n' FAIL "$name"
+    failures=$((failures + 1))
+    sed 's/^/     /' "$t/out"
+  fi
+}
+
+check 'list root directory' / 0 'notes.txt'
+check 'list directory' /Music/ 0 'Album One'
+check 'list directory ignoring case' '/music/album one' 0 'track 2.mp3'
+check 'file is not a directory' /Music/song.mp3 1 \
+  "Directory '/Music/song.mp3' not found!"
+check 'path through a file' /Music/song.mp3/x 1 \
+  "Directory '/Music/song.mp3' not found!"
+check 'missing directory' '/Music/Album Two/x' 1 \
+  "Directory '/Music/Album Two' not found!"
+check 'dot dot component' '/Music/Album One/..' 1 \
+  "Path component '..' of '/Music/Album One/..' is not supported!"
+check 'dot component' /Music/./ 1 \
+  "Path component '.' of '/Music/./' is not supported!"
+
+[ $failures = 0 ]
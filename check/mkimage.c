@@ -0,0 +1,301 @@
+/*
+ * This file contains a generator of small FAT32 images for the checks that
+ * run without a real card. The tree is read from stdin, one entry per line:
+ *
+ *   d PATH         directory
+ *   f SIZE PATH    file of SIZE bytes
+ *
+ * Entries are created in the order of the lines and clusters are allocated
+ * first fit like a player would do, so directories that grow while files are
+ * added elsewhere end up fragmented.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR_SIZE 512
+#define CLUSTERS 70000
+#define RESERVED_SECTORS 32
+#define FAT_SIZE ((CLUSTERS + 2) * 4 / SECTOR_SIZE + 1)
+#define DATA_SECTOR (RESERVED_SECTORS + 2 * FAT_SIZE)
+#define TOTAL_SECTORS (DATA_SECTOR + CLUSTERS)
+#define ENTRIES_PER_CLUSTER (SECTOR_SIZE / 32)
+#define MAX_DIRS 4096
+#define MAX_CHAIN 256
+#define EOC 0x0FFFFFFFU
+
+struct sDir {
+  /*
+   * directory of the image
+   */
+  char path[256];
+  uint32_t chain[MAX_CHAIN]; // clusters of the directory
+  unsigned clusters, entries;
+};
+
+FILE *image;
+uint32_t fat[CLUSTERS + 2];
+struct sDir dirs[MAX_DIRS];
+unsigned dirCount, names, nextFree = 3;
+
+void put16(unsigned char *p, unsigned v) {
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+}
+
+void put32(unsigned char *p, uint32_t v) {
+  put16(p, v & 0xFFFF);
+  put16(p + 2, v >> 16);
+}
+
+void writeAt(long offset, const void *data, size_t len) {
+  if (fseek(image, offset, SEEK_SET) || fwrite(data, 1, len, image) != len) {
+    perror("mkimage");
+    exit(1);
+  }
+}
+
+long clusterOffset(uint32_t cluster) {
+  return (long) (DATA_SECTOR + cluster - 2) * SECTOR_SIZE;
+}
+
+uint32_t allocClusters(unsigned n) {
+  /*
+   * allocate a contiguous chain of n clusters, returns its first cluster
+   */
+  uint32_t start = nextFree, j;
+
+  if (nextFree + n > CLUSTERS + 2) {
+    fprintf(stderr, "mkimage: image is full\n");
+    exit(1);
+  }
+  for (j = 0; j < n; j++)
+    fat[start + j] = j + 1 < n ? start + j + 1 : EOC;
+  nextFree += n;
+
+  return start;
+}
+
+struct sDir *findDir(const char *path) {
+  unsigned j;
+
+  for (j = 0; j < dirCount; j++) {
+    if (!strcmp(dirs[j].path, path))
+      return &dirs[j];
+  }
+  fprintf(stderr, "mkimage: no directory '%s'\n", path);
+  exit(1);
+}
+
+void addEntry(struct sDir *dir, const unsigned char *entry) {
+  /*
+   * append a directory entry, full directories grow by one cluster
+   */
+  uint32_t cluster;
+  unsigned char zero[SECTOR_SIZE] = { 0 };
+
+  if (dir->entries == dir->clusters * ENTRIES_PER_CLUSTER) {
+    if (dir->clusters == MAX_CHAIN) {
+      fprintf(stderr, "mkimage: directory '%s' is full\n", dir->path);
+      exit(1);
+    }
+    cluster = allocClusters(1);
+    fat[dir->chain[dir->clusters - 1]] = cluster;
+    dir->chain[dir->clusters++] = cluster;
+    writeAt(clusterOffset(cluster), zero, sizeof(zero));
+  }
+
+  writeAt(clusterOffset(dir->chain[dir->entries / ENTRIES_PER_CLUSTER]) +
+    (long) (dir->entries % ENTRIES_PER_CLUSTER) * 32, entry, 32);
+  dir->entries++;
+}
+
+void makeShortEntry(unsigned char *entry, const char *sname, unsigned attr,
+  uint32_t cluster, uint32_t size) {
+  memset(entry, 0, 32);
+  memcpy(entry, sname, 11);
+  entry[11] = (unsigned char) attr;
+  put16(entry + 20, cluster >> 16);
+  put16(entry + 22, names & 0xFFFF);
+  put16(entry + 24, 0x5000 + names % 0x100);
+  put16(entry + 26, cluster & 0xFFFF);
+  put32(entry + 28, size);
+}
+
+void addNamedEntry(struct sDir *dir, const char *name, unsigned attr,
+  uint32_t cluster, uint32_t size) {
+  /*
+   * add long name entries and a numbered short name entry
+   */
+  unsigned char entry[32], sum = 0;
+  char sname[12];
+  size_t len = strlen(name), count, k, j, pos;
+  static const int offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28,
+    30 };
+
+  sprintf(sname, "N%07u%s", ++names, attr & 0x10 ? "   " : "DAT");
+  for (j = 0; j < 11; j++)
+    sum = (unsigned char) (((sum & 1) << 7) + (sum >> 1) + sname[j]);
+
+  count = (len + 12) / 13;
+  for (k = count; k > 0; k--) {
+    memset(entry, 0, 32);
+    entry[0] = (unsigned char) (k | (k == count ? 0x40 : 0));
+    entry[11] = 0x0F;
+    entry[13] = sum;
+    for (j = 0; j < 13; j++) {
+      pos = (k - 1) * 13 + j;
+      if (pos < len)
+        put16(entry + offsets[j], (unsigned char) name[pos]);
+      else
+        put16(entry + offsets[j], pos == len ? 0 : 0xFFFF);
+    }
+    addEntry(dir, entry);
+  }
+
+  makeShortEntry(entry, sname, attr, cluster, size);
+  addEntry(dir, entry);
+}
+
+void splitPath(char *path, char **parent, char **name) {
+  /*
+   * split "/a/b" into "/a" and "b", the parent of "/b" is "/"
+   */
+  char *slash = strrchr(path, '/');
+
+  *name = slash + 1;
+  if (slash == path)
+    *parent = "/";
+  else {
+    *slash = 0;
+    *parent = path;
+  }
+}
+
+void writeBootSector() {
+  unsigned char bs[SECTOR_SIZE] = { 0 }, info[SECTOR_SIZE] = { 0 };
+
+  memcpy(bs, "\xEB\x58\x90MSWIN4.1", 11);
+  put16(bs + 11, SECTOR_SIZE);
+  bs[13] = 1;
+  put16(bs + 14, RESERVED_SECTORS);
+  bs[16] = 2;
+  bs[21] = 0xF8;
+  put32(bs + 32, TOTAL_SECTORS);
+  put32(bs + 36, FAT_SIZE);
+  put32(bs + 44, 2);
+  put16(bs + 48, 1);
+  put16(bs + 50, 6);
+  bs[66] = 0x29;
+  memcpy(bs + 71, "NO NAME    FAT32   ", 19);
+  put16(bs + 510, 0xAA55);
+  writeAt(0, bs, sizeof(bs));
+  writeAt(6 * SECTOR_SIZE, bs, sizeof(bs));
+
+  put32(info, 0x41615252);
+  put32(info + 484, 0x61417272);
+  put32(info + 488, CLUSTERS + 2 - nextFree);
+  put32(info + 492, nextFree);
+  put32(info + 508, 0xAA550000);
+  writeAt(SECTOR_SIZE, info, sizeof(info));
+}
+
+int main(int argc, char *argv[]) {
+  char line[512], path[256], *parent, *name, *end;
+  unsigned char entry[32], raw[4], zero[SECTOR_SIZE] = { 0 };
+  unsigned long size;
+  struct sDir *dir, *sub;
+  uint32_t cluster, j;
+  int k;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: mkimage IMAGE < TREE\n");
+    return 1;
+  }
+  image = fopen(argv[1], "w+b");
+  if (!image) {
+    perror("mkimage");
+    return 1;
+  }
+
+  fat[0] = 0x0FFFFFF8;
+  fat[1] = EOC;
+  fat[2] = EOC;
+  strcpy(dirs[0].path, "/");
+  dirs[0].chain[0] = 2;
+  dirs[0].clusters = 1;
+  dirCount = 1;
+  writeAt(clusterOffset(2), zero, sizeof(zero));
+  makeShortEntry(entry, "ROSSOCHECK ", 0x08, 0, 0);
+  addEntry(&dirs[0], entry);
+
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!line[0] || line[0] == '#')
+      continue;
+
+    // the path is the rest of the line and may contain spaces
+    size = 0;
+    end = line + 2;
+    if (line[0] == 'f') {
+      size = strtoul(line + 2, &end, 10);
+      end = *end == ' ' ? end + 1 : line + strlen(line);
+    }
+    if ((line[0] != 'd' && line[0] != 'f') || line[1] != ' ' ||
+      end[0] != '/' || !end[1] || strlen(end) >= sizeof(path)) {
+      fprintf(stderr, "mkimage: invalid line '%s'\n", line);
+      return 1;
+    }
+    strcpy(path, end);
+    splitPath(path, &parent, &name);
+    dir = findDir(parent);
+
+    if (line[0] == 'd') {
+      if (dirCount == MAX_DIRS) {
+        fprintf(stderr, "mkimage: too many directories\n");
+        return 1;
+      }
+      sub = &dirs[dirCount++];
+      strcpy(sub->path, end);
+      sub->chain[0] = allocClusters(1);
+      sub->clusters = 1;
+      writeAt(clusterOffset(sub->chain[0]), zero, sizeof(zero));
+
+      makeShortEntry(entry, ".          ", 0x10, sub->chain[0], 0);
+      addEntry(sub, entry);
+      makeShortEntry(entry, "..         ", 0x10, dir == dirs ? 0 :
+        dir->chain[0], 0);
+      addEntry(sub, entry);
+      addNamedEntry(dir, name, 0x10, sub->chain[0], 0);
+    }
+    else {
+      cluster = size ? allocClusters((unsigned) ((size + SECTOR_SIZE - 1) /
+          SECTOR_SIZE)) : 0;
+      addNamedEntry(dir, name, 0x20, cluster, (uint32_t) size);
+    }
+  }
+
+  // both copies of the FAT32
+  for (k = 0; k < 2; k++) {
+    for (j = 0; j < CLUSTERS + 2; j++) {
+      if (!fat[j])
+        continue;
+      put32(raw, fat[j]);
+      writeAt((long) (RESERVED_SECTORS + k * FAT_SIZE) * SECTOR_SIZE +
+        (long) j * 4, raw, 4);
+    }
+  }
+  writeBootSector();
+
+  // the image has the size of the file system
+  writeAt((long) TOTAL_SECTORS * SECTOR_SIZE - 1, "", 1);
+
+  if (fclose(image)) {
+    perror("mkimage");
+    return 1;
+  }
+
+  return 0;
+}
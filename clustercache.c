@@ -0,0 +1,190 @@
+/*
+ * This file contains/describes the cache of directory clusters. Clusters
+ * are kept in a bounded number of cluster sized buffers and the least
+ * recently used one is replaced. Written clusters update the cache, so it
+ * never holds content that differs from the device or the write-back buffer.
+ */
+
+#include "clustercache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "FAT32.h"
+
+void unlinkCachedCluster(struct sClusterCache *cache, size_t e) {
+  /*
+   * removes an entry from the list ordered by last use
+   */
+
+  struct sCachedCluster *entry = &cache->entries[e];
+
+  if (entry->prev != CACHE_NONE)
+    cache->entries[entry->prev].next = entry->next;
+  else
+    cache->head = entry->next;
+  if (entry->next != CACHE_NONE)
+    cache->entries[entry->next].prev = entry->prev;
+  else
+    cache->tail = entry->prev;
+}
+
+void linkCachedCluster(struct sClusterCache *cache, size_t e, int first) {
+  /*
+   * inserts an entry as most recently used one or, if first is 0, as the
+   * one that is replaced next
+   */
+
+  struct sCachedCluster *entry = &cache->entries[e];
+
+  if (first) {
+    entry->prev = CACHE_NONE;
+    entry->next = cache->head;
+    if (cache->head != CACHE_NONE)
+      cache->entries[cache->head].prev = e;
+    else
+      cache->tail = e;
+    cache->head = e;
+  }
+  else {
+    entry->prev = cache->tail;
+    entry->next = CACHE_NONE;
+    if (cache->tail != CACHE_NONE)
+      cache->entries[cache->tail].next = e;
+    else
+      cache->head = e;
+    cache->tail = e;
+  }
+}
+
+int allocClusterCache(struct sFileSystem *fs) {
+  /*
+   * allocates entries and buffers for CLUSTER_CACHE_SIZE bytes of clusters
+   */
+
+  struct sClusterCache *cache = &fs->cache;
+
+  cache->count = CLUSTER_CACHE_SIZE / fs->clusterSize;
+  if (cache->count < CLUSTER_CACHE_MIN)
+    cache->count = CLUSTER_CACHE_MIN;
+
+  cache->entries = calloc(cache->count, sizeof(*cache->entries));
+  if (!cache->entries) {
+    stderror();
+    freeClusterCache(cache);
+    return -1;
+  }
+  cache->data = allocBuffer(fs, cache->count * fs->clusterSize);
+  if (!cache->data) {
+    freeClusterCache(cache);
+    return -1;
+  }
+
+  cache->clusterSize = fs->clusterSize;
+  cache->len = 0;
+  cache->head = cache->tail = CACHE_NONE;
+
+  return 0;
+}
+
+const char *findCachedCluster(struct sClusterCache *cache, uint32_t cluster) {
+  /*
+   * returns the cached content of a cluster or 0, a hit makes the cluster
+   * the most recently used one
+   */
+
+  struct sClusterSlot *slot = findCluster(&cache->table, cluster);
+  size_t e;
+
+  if (!slot) {
+    cache->misses++;
+    return 0;
+  }
+  cache->hits++;
+
+  e = slot->value.entry;
+  if (cache->head != e) {
+    unlinkCachedCluster(cache, e);
+    linkCachedCluster(cache, e, 1);
+  }
+
+  return cache->data + e * cache->clusterSize;
+}
+
+int cacheCluster(struct sFileSystem *fs, uint32_t cluster, const void *data) {
+  /*
+   * cache the content of a cluster that was read or written, the least
+   * recently used cluster is replaced if the cache is full
+   */
+
+  struct sClusterCache *cache = &fs->cache;
+  struct sClusterSlot *slot;
+  size_t e;
+  int grown;
+
+  if (!cache->entries && allocClusterCache(fs))
+    return -1;
+
+  slot = findCluster(&cache->table, cluster);
+  if (slot) {
+    e = slot->value.entry;
+    unlinkCachedCluster(cache, e);
+  }
+  else {
+    if (cache->len < cache->count)
+      e = cache->len++;
+    else {
+      e = cache->tail;
+      unlinkCachedCluster(cache, e);
+      if (cache->entries[e].cluster) {
+        removeClusterSlot(&cache->table,
+          findCluster(&cache->table, cache->entries[e].cluster));
+      }
+    }
+    slot = addCluster(&cache->table, cluster, &grown);
+    if (!slot) {
+      // the entry is unused and the next one to be replaced
+      cache->entries[e].cluster = 0;
+      linkCachedCluster(cache, e, 0);
+      return -1;
+    }
+    cache->entries[e].cluster = cluster;
+    slot->value.entry = e;
+  }
+
+  linkCachedCluster(cache, e, 1);
+  memcpy(cache->data + e * cache->clusterSize, data, cache->clusterSize);
+
+  return 0;
+}
+
+void forgetCachedCluster(struct sClusterCache *cache, uint32_t cluster) {
+  /*
+   * drop a freed cluster, its entry is the next one to be replaced
+   */
+
+  struct sClusterSlot *slot = findCluster(&cache->table, cluster);
+  size_t e;
+
+  if (!slot)
+    return;
+
+  e = slot->value.entry;
+  removeClusterSlot(&cache->table, slot);
+  cache->entries[e].cluster = 0;
+  unlinkCachedCluster(cache, e);
+  linkCachedCluster(cache, e, 0);
+}
+
+void freeClusterCache(struct sClusterCache *cache) {
+  /*
+   * free the cached clusters, the counters are kept
+   */
+
+  free(cache->entries);
+  freeClusterTable(&cache->table);
+  free(cache->data);
+  cache->entries = 0;
+  cache->data = 0;
+  cache->count = cache->len = 0;
+}
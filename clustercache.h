@@ -0,0 +1,61 @@
+/*
+ * This file contains/describes the cache of directory clusters. Clusters
+ * are kept in a bounded number of cluster sized buffers and the least
+ * recently used one is replaced. Written clusters update the cache, so it
+ * never holds content that differs from the device or the write-back buffer.
+ */
+
+#ifndef __clustercache_h__
+#define __clustercache_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "clustertable.h"
+
+struct sFileSystem;
+
+// bytes of cached clusters
+#define CLUSTER_CACHE_SIZE 0x400000
+
+// fewest cached clusters, even if they exceed CLUSTER_CACHE_SIZE
+#define CLUSTER_CACHE_MIN 16
+
+// end of the list of cached clusters
+#define CACHE_NONE ((size_t) -1)
+
+struct sCachedCluster {
+  /*
+   * cached cluster in the list ordered by last use
+   */
+  uint32_t cluster; // 0 for unused entries
+  size_t prev, next; // more and less recently used entry or CACHE_NONE
+};
+
+struct sClusterCache {
+  /*
+   * cached clusters with a hash table of their entry numbers, the buffers
+   * are allocated when the first cluster is cached
+   */
+  struct sCachedCluster *entries;
+  char *data; // one buffer per entry
+  size_t clusterSize; // bytes of a buffer
+  size_t count, len; // available and used entries
+  struct sClusterTable table; // entry number of every cached cluster
+  size_t head, tail; // most and least recently used entry
+  unsigned long long hits, misses;
+};
+
+// returns the cached content of a cluster or 0, a hit makes the cluster the
+// most recently used one
+const char *findCachedCluster(struct sClusterCache *cache, uint32_t cluster);
+
+// cache the content of a cluster that was read or written
+int cacheCluster(struct sFileSystem *fs, uint32_t cluster, const void *data);
+
+// drop a cluster from the cache, used for freed clusters
+void forgetCachedCluster(struct sClusterCache *cache, uint32_t cluster);
+
+// free the cached clusters
+void freeClusterCache(struct sClusterCache *cache);
+
+#endif // __clustercache_h__
@@ -0,0 +1,141 @@
+/*
+ * This file contains/describes the hash table of clusters that the
+ * write-back buffer, the cluster cache and the verification share. Clusters
+ * are kept in an open addressing table with linear probing, every cluster
+ * carries one value of the module that uses the table.
+ */
+
+#include "clustertable.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+
+size_t hashCluster(const struct sClusterTable *table, uint32_t cluster) {
+  /*
+   * returns the home slot of a cluster
+   */
+
+  return (size_t) (cluster * 2654435761U) & (table->size - 1);
+}
+
+size_t findClusterSlot(const struct sClusterTable *table, uint32_t cluster) {
+  /*
+   * returns the slot that holds cluster or the free slot where it belongs
+   */
+
+  size_t j;
+
+  for (j = hashCluster(table, cluster); table->slots[j].cluster &&
+    table->slots[j].cluster != cluster; j = (j + 1) & (table->size - 1));
+
+  return j;
+}
+
+int growClusterTable(struct sClusterTable *table) {
+  /*
+   * doubles the hash table
+   */
+
+  struct sClusterSlot *old = table->slots;
+  size_t size = table->size, j;
+
+  table->size = size ? size * 2 : CLUSTER_TABLE_MIN;
+  table->slots = calloc(table->size, sizeof(*table->slots));
+  if (!table->slots) {
+    stderror();
+    table->slots = old;
+    table->size = size;
+    return -1;
+  }
+
+  for (j = 0; j < size; j++) {
+    if (old[j].cluster)
+      table->slots[findClusterSlot(table, old[j].cluster)] = old[j];
+  }
+  free(old);
+
+  return 0;
+}
+
+struct sClusterSlot *findCluster(const struct sClusterTable *table,
+  uint32_t cluster) {
+  /*
+   * returns the slot that holds cluster or 0
+   */
+
+  size_t j;
+
+  if (!table->len)
+    return 0;
+
+  j = findClusterSlot(table, cluster);
+
+  return table->slots[j].cluster ? &table->slots[j] : 0;
+}
+
+struct sClusterSlot *addCluster(struct sClusterTable *table, uint32_t cluster,
+  int *grown) {
+  /*
+   * returns the slot that holds cluster, a slot with a zero value is added
+   * if the table doesn't hold it yet
+   */
+
+  size_t j;
+
+  *grown = 0;
+  if ((table->len + 1) * 4 > table->size * 3) {
+    if (growClusterTable(table))
+      return 0;
+    *grown = 1;
+  }
+
+  j = findClusterSlot(table, cluster);
+  if (!table->slots[j].cluster) {
+    table->slots[j].cluster = cluster;
+    table->len++;
+  }
+
+  return &table->slots[j];
+}
+
+void removeClusterSlot(struct sClusterTable *table, struct sClusterSlot *slot) {
+  /*
+   * empties a slot, following clusters of the probe sequence are shifted
+   * back into the gap
+   */
+
+  size_t j = (size_t) (slot - table->slots), k, home;
+
+  for (k = (j + 1) & (table->size - 1); table->slots[k].cluster;
+    k = (k + 1) & (table->size - 1)) {
+    home = hashCluster(table, table->slots[k].cluster);
+    // move the cluster unless its home slot lies cyclically in (j, k]
+    if (j < k ? home <= j || home > k : home <= j && home > k) {
+      table->slots[j] = table->slots[k];
+      j = k;
+    }
+  }
+  memset(&table->slots[j], 0, sizeof(table->slots[j]));
+  table->len--;
+}
+
+void clearClusterTable(struct sClusterTable *table) {
+  /*
+   * empties the table, its slots are kept
+   */
+
+  if (table->slots)
+    memset(table->slots, 0, table->size * sizeof(*table->slots));
+  table->len = 0;
+}
+
+void freeClusterTable(struct sClusterTable *table) {
+  /*
+   * free the slots of the table
+   */
+
+  free(table->slots);
+  table->slots = 0;
+  table->len = table->size = 0;
+}
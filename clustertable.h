@@ -0,0 +1,57 @@
+/*
+ * This file contains/describes the hash table of clusters that the
+ * write-back buffer, the cluster cache and the verification share. Clusters
+ * are kept in an open addressing table with linear probing, every cluster
+ * carries one value of the module that uses the table.
+ */
+
+#ifndef __clustertable_h__
+#define __clustertable_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// slots of a table when the first cluster is added
+#define CLUSTER_TABLE_MIN 256
+
+struct sClusterSlot {
+  /*
+   * cluster and its value, unused slots are zero
+   */
+  uint32_t cluster; // 0 for unused slots
+  union {
+    char *data; // buffered content of the write-back buffer
+    size_t entry; // entry of the cluster cache
+    uint32_t crc; // checksum of the verification
+  } value;
+};
+
+struct sClusterTable {
+  /*
+   * clusters in an open addressing hash table, it is doubled when it is
+   * three quarters full
+   */
+  struct sClusterSlot *slots;
+  size_t len, size; // used and available slots, size is a power of two
+};
+
+// returns the slot that holds cluster or 0
+struct sClusterSlot *findCluster(const struct sClusterTable *table,
+  uint32_t cluster);
+
+// returns the slot that holds cluster, a slot with a zero value is added if
+// the table doesn't hold it yet, grown is set if the table was allocated,
+// 0 on failure
+struct sClusterSlot *addCluster(struct sClusterTable *table, uint32_t cluster,
+  int *grown);
+
+// empties a slot of the table, slots returned before are invalid afterwards
+void removeClusterSlot(struct sClusterTable *table, struct sClusterSlot *slot);
+
+// empties the table, its slots are kept
+void clearClusterTable(struct sClusterTable *table);
+
+// free the slots of the table
+void freeClusterTable(struct sClusterTable *table);
+
+#endif // __clustertable_h__
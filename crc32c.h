@@ -0,0 +1,16 @@
+/*
+ * This file contains/describes the CRC32C (Castagnoli) checksum of written
+ * directory clusters. The CRC32 instructions of SSE4.2 and ARMv8 are used if
+ * the processor has them, otherwise a table with one entry per byte.
+ */
+
+#ifndef __crc32c_h__
+#define __crc32c_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// continues the checksum crc with len bytes of data, start with crc 0
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif // __crc32c_h__
@@ -0,0 +1,437 @@
+/*
+ * This file contains/describes the directory filter that matches directory
+ * paths against the -d, -D, -x and -X options. The paths are compiled into a
+ * trie of path components that is advanced one level per directory during
+ * the traversal.
+ */
+
+#include "dirfilter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "stringlist.h"
+
+unsigned hashComponent(unsigned hash, const char *str, size_t len) {
+  /*
+   * FNV-1a hash of a path component, continued from the hash of its parent
+   */
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) str[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+int isGlob(const char *str, size_t len) {
+  /*
+   * evaluates whether a path component contains glob characters
+   */
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (str[i] == '*' || str[i] == '?' || str[i] == '[')
+      return 1;
+  }
+  return 0;
+}
+
+int matchesGlob(const char *pattern, const char *str) {
+  /*
+   * matches str against a glob pattern with *, ? and [] character classes
+   */
+
+  const char *starPattern = 0, *starStr = 0, *p;
+  int negate, found;
+
+  while (*str) {
+    if (*pattern == '*') {
+      // remember position to backtrack to
+      starPattern = ++pattern;
+      starStr = str;
+      continue;
+    }
+    if (*pattern == '?') {
+      pattern++;
+      str++;
+      continue;
+    }
+    if (*pattern == '[' && strchr(pattern + 1, ']')) {
+      p = pattern + 1;
+      negate = *p == '!' || *p == '^';
+      if (negate)
+        p++;
+      found = 0;
+      do {
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+          if ((unsigned char) *str >= (unsigned char) p[0] &&
+            (unsigned char) *str <= (unsigned char) p[2])
+            found = 1;
+          p += 3;
+        }
+        else {
+          if (*p == *str)
+            found = 1;
+          p++;
+        }
+      } while (*p && *p != ']');
+      if (found != negate) {
+        pattern = p + 1;
+        str++;
+        continue;
+      }
+    }
+    else if (*pattern == *str) {
+      pattern++;
+      str++;
+      continue;
+    }
+
+    // mismatch, let the last * consume one more character
+    if (!starPattern)
+      return 0;
+    pattern = starPattern;
+    str = ++starStr;
+  }
+
+  while (*pattern == '*')
+    pattern++;
+
+  return !*pattern;
+}
+
+struct sDirFilterNode *newDirFilterNode(struct sDirFilterNode *parent,
+  const char *name, size_t len) {
+  /*
+   * create a new trie node
+   */
+  struct sDirFilterNode *node;
+
+  node = calloc(1, sizeof(struct sDirFilterNode));
+  if (!node) {
+    stderror();
+    return 0;
+  }
+  node->name = malloc(len + 1);
+  if (!node->name) {
+    stderror();
+    free(node);
+    return 0;
+  }
+  memcpy(node->name, name, len);
+  node->name[len] = 0;
+  node->parent = parent;
+  node->hash = parent ? hashComponent(parent->hash, name, len) : 2166136261U;
+
+  return node;
+}
+
+struct sDirFilterNode *findDirFilterChild(const struct sDirFilter *filter,
+  const struct sDirFilterNode *parent, const char *name, size_t len) {
+  /*
+   * look up an exact child component of a trie node
+   */
+  struct sDirFilterNode *node;
+  unsigned hash;
+
+  hash = hashComponent(parent->hash, name, len);
+  node = filter->buckets[hash & (filter->bucketCount - 1)];
+  while (node) {
+    if (node->hash == hash && node->parent == parent &&
+      !strncmp(node->name, name, len) && !node->name[len])
+      return node;
+    node = node->bucket;
+  }
+  return 0;
+}
+
+int addDirFilterPath(struct sDirFilter *filter, const char *path,
+  unsigned flag) {
+  /*
+   * insert a path like "/a/b/" into the trie
+   */
+  struct sDirFilterNode *node = filter->root, *child;
+  const char *end;
+  size_t len;
+
+  while (*path) {
+    if (*path == '/') {
+      path++;
+      continue;
+    }
+    end = strchr(path, '/');
+    len = end ? (size_t) (end - path) : strlen(path);
+
+    if (isGlob(path, len)) {
+      child = node->globs;
+      while (child && (strncmp(child->name, path, len) || child->name[len]))
+        child = child->sibling;
+      if (!child) {
+        child = newDirFilterNode(node, path, len);
+        if (!child)
+          return -1;
+        child->sibling = node->globs;
+        node->globs = child;
+        filter->nodes++;
+      }
+    }
+    else {
+      child = findDirFilterChild(filter, node, path, len);
+      if (!child) {
+        child = newDirFilterNode(node, path, len);
+        if (!child)
+          return -1;
+        child->bucket =
+          filter->buckets[child->hash & (filter->bucketCount - 1)];
+        filter->buckets[child->hash & (filter->bucketCount - 1)] = child;
+        filter->nodes++;
+      }
+    }
+    node->children = 1;
+    node = child;
+    path += len;
+  }
+
+  node->flags |= flag;
+
+  return 0;
+}
+
+struct sDirFilter *newDirFilter(struct sStringList *includes,
+  struct sStringList *includes_recursion, struct sStringList *excludes,
+  struct sStringList *excludes_recursion) {
+  /*
+   * compile include and exclude lists into a directory filter
+   */
+
+  struct sStringList *lists[4] = { includes, includes_recursion, excludes,
+    excludes_recursion
+  };
+  const unsigned flags[4] = { FILTER_INCL, FILTER_INCL_REC, FILTER_EXCL,
+    FILTER_EXCL_REC
+  };
+  struct sDirFilter *filter;
+  struct sStringList *str;
+  size_t components = 0;
+  const char *c;
+  int i;
+
+  filter = calloc(1, sizeof(struct sDirFilter));
+  if (!filter) {
+    stderror();
+    return 0;
+  }
+
+  filter->root = newDirFilterNode(0, "", 0);
+  if (!filter->root) {
+    free(filter);
+    return 0;
+  }
+  filter->nodes = 1;
+
+  // size hash table for the total number of path components
+  for (i = 0; i < 4; i++) {
+    for (str = lists[i]->next; str; str = str->next) {
+      for (c = str->str; *c; c++)
+        components += *c == '/';
+    }
+  }
+  filter->bucketCount = 16;
+  while (filter->bucketCount < components * 2)
+    filter->bucketCount *= 2;
+  filter->buckets = calloc(filter->bucketCount, sizeof(*filter->buckets));
+  if (!filter->buckets) {
+    stderror();
+    freeDirFilter(filter);
+    return 0;
+  }
+
+  for (i = 0; i < 4; i++) {
+    for (str = lists[i]->next; str; str = str->next) {
+      if (addDirFilterPath(filter, str->str, flags[i])) {
+        myerror("Failed to add path to directory filter!");
+        freeDirFilter(filter);
+        return 0;
+      }
+    }
+  }
+
+  filter->includes = includes->next || includes_recursion->next;
+
+  return filter;
+}
+
+int pushDirFilterNode(struct sDirFilterStack *stack,
+  struct sDirFilterNode *node) {
+  /*
+   * push an active trie node on the filter stack
+   */
+  struct sDirFilterNode **nodes;
+  size_t size;
+
+  if (stack->len == stack->size) {
+    size = stack->size ? stack->size * 2 : 64;
+    nodes = realloc(stack->nodes, size * sizeof(*nodes));
+    if (!nodes) {
+      stderror();
+      return -1;
+    }
+    stack->nodes = nodes;
+    stack->size = size;
+  }
+  stack->nodes[stack->len++] = node;
+
+  return 0;
+}
+
+int enterRootDirFilter(struct sDirFilter *filter,
+  struct sDirFilterStack *stack, struct sDirFilterState *state) {
+  /*
+   * get filter state of the root directory
+   */
+
+  state->offset = stack->len;
+  state->count = 1;
+  state->flags = filter->root->flags;
+  if (filter->root->children)
+    state->flags |= FILTER_MORE;
+
+  return pushDirFilterNode(stack, filter->root);
+}
+
+int enterDirFilter(struct sDirFilter *filter, struct sDirFilterStack *stack,
+  const struct sDirFilterState *parent, const char *name,
+  struct sDirFilterState *state) {
+  /*
+   * get filter state of a subdirectory from the state of its parent
+   */
+
+  struct sDirFilterNode *node, *child;
+  size_t i;
+
+  state->offset = stack->len;
+  state->count = 0;
+
+  // recursive flags are inherited from all parent directories
+  state->flags = parent->flags & (FILTER_INCL_REC | FILTER_EXCL_REC);
+
+  for (i = parent->offset; i < parent->offset + parent->count; i++) {
+    node = stack->nodes[i];
+    if (!node->children)
+      continue;
+
+    child = findDirFilterChild(filter, node, name, strlen(name));
+    if (child) {
+      if (pushDirFilterNode(stack, child))
+        return -1;
+      state->flags |= child->flags | (child->children ? FILTER_MORE : 0);
+      state->count++;
+    }
+
+    for (child = node->globs; child; child = child->sibling) {
+      if (matchesGlob(child->name, name)) {
+        if (pushDirFilterNode(stack, child))
+          return -1;
+        state->flags |= child->flags | (child->children ? FILTER_MORE : 0);
+        state->count++;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void leaveDirFilter(struct sDirFilterStack *stack,
+  const struct sDirFilterState *state) {
+  /*
+   * drop the active nodes of a filter state and all states above it
+   */
+  stack->len = state->offset;
+}
+
+int matchesDirFilter(const struct sDirFilter *filter,
+  const struct sDirFilterState *state) {
+  /*
+   * evaluate whether a directory has to be sorted
+   */
+
+  // directories excluded via -x, or via -X for them or a parent
+  if (state->flags & (FILTER_EXCL | FILTER_EXCL_REC))
+    return 0;
+
+  /*
+   * without -d and -D all directories match, otherwise the directory has to
+   * be given via -d, or it or a parent via -D
+   */
+  return !filter->includes ||
+    (state->flags & (FILTER_INCL | FILTER_INCL_REC));
+}
+
+int descendsDirFilter(const struct sDirFilter *filter,
+  const struct sDirFilterState *state) {
+  /*
+   * evaluate whether a directory or one of its subdirectories may match
+   */
+
+  if (state->flags & FILTER_EXCL_REC)
+    return 0;
+
+  /*
+   * otherwise the directory has to match itself or a -d or -D path has to
+   * continue below it
+   */
+  return !filter->includes ||
+    state->flags & (FILTER_INCL | FILTER_INCL_REC | FILTER_MORE);
+}
+
+void freeDirFilterStack(struct sDirFilterStack *stack) {
+  /*
+   * free filter stack
+   */
+  free(stack->nodes);
+  stack->nodes = 0;
+  stack->len = stack->size = 0;
+}
+
+void freeDirFilterNodes(struct sDirFilterNode *node) {
+  /*
+   * free glob children of a node and the node itself
+   */
+  struct sDirFilterNode *tmp;
+
+  while (node) {
+    freeDirFilterNodes(node->globs);
+    tmp = node;
+    node = node->sibling;
+    free(tmp->name);
+    free(tmp);
+  }
+}
+
+void freeDirFilter(struct sDirFilter *filter) {
+  /*
+   * free directory filter
+   */
+  struct sDirFilterNode *node, *tmp;
+  size_t i;
+
+  if (!filter)
+    return;
+
+  // exact nodes are only linked in the hash table
+  for (i = 0; filter->buckets && i < filter->bucketCount; i++) {
+    node = filter->buckets[i];
+    while (node) {
+      freeDirFilterNodes(node->globs);
+      tmp = node;
+      node = node->bucket;
+      free(tmp->name);
+      free(tmp);
+    }
+  }
+  free(filter->buckets);
+  freeDirFilterNodes(filter->root);
+  free(filter);
+}
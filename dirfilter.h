@@ -0,0 +1,98 @@
+/*
+ * This file contains/describes the directory filter that matches directory
+ * paths against the -d, -D, -x and -X options. The paths are compiled into a
+ * trie of path components that is advanced one level per directory during
+ * the traversal.
+ */
+
+#ifndef __dirfilter_h__
+#define __dirfilter_h__
+
+#include <stddef.h>
+struct sStringList;
+
+// flags of trie nodes and filter states
+#define FILTER_INCL 0x01U // -d
+#define FILTER_INCL_REC 0x02U // -D
+#define FILTER_EXCL 0x04U // -x
+#define FILTER_EXCL_REC 0x08U // -X
+#define FILTER_MORE 0x10U // paths of the trie continue below a directory
+
+struct sDirFilterNode {
+  /*
+   * one path component in the trie
+   */
+  char *name; // component, may contain the glob characters *, ? and [
+  unsigned flags; // FILTER_* flags of paths that end in this node
+  int children; // node has exact or glob children
+  unsigned hash; // hash of parent and name for exact components
+  struct sDirFilterNode *parent;
+  struct sDirFilterNode *globs; // first child with glob characters
+  struct sDirFilterNode *sibling; // next glob sibling
+  struct sDirFilterNode *bucket; // next node in hash bucket
+};
+
+struct sDirFilter {
+  /*
+   * compiled directory filter
+   */
+  struct sDirFilterNode *root;
+  struct sDirFilterNode **buckets; // hash table of exact components
+  size_t bucketCount;
+  size_t nodes;
+  int includes; // -d or -D was given
+};
+
+struct sDirFilterStack {
+  /*
+   * trie nodes of all active filter states, states of child directories
+   * are pushed on top of their parents
+   */
+  struct sDirFilterNode **nodes;
+  size_t len, size;
+};
+
+struct sDirFilterState {
+  /*
+   * filter state of one directory
+   */
+  unsigned flags; // exact flags and inherited recursive flags
+  size_t offset, count; // active trie nodes on the filter stack
+};
+
+// matches str against a glob pattern with *, ? and [] character classes
+int matchesGlob(const char *pattern, const char *str);
+
+// compile include and exclude lists into a directory filter
+struct sDirFilter *newDirFilter(struct sStringList *includes,
+  struct sStringList *includes_recursion, struct sStringList *excludes,
+  struct sStringList *excludes_recursion);
+
+// get filter state of the root directory
+int enterRootDirFilter(struct sDirFilter *filter,
+  struct sDirFilterStack *stack, struct sDirFilterState *state);
+
+// get filter state of a subdirectory from the state of its parent
+int enterDirFilter(struct sDirFilter *filter, struct sDirFilterStack *stack,
+  const struct sDirFilterState *parent, const char *name,
+  struct sDirFilterState *state);
+
+// drop the active nodes of a filter state and all states above it
+void leaveDirFilter(struct sDirFilterStack *stack,
+  const struct sDirFilterState *state);
+
+// evaluate whether a directory has to be sorted
+int matchesDirFilter(const struct sDirFilter *filter,
+  const struct sDirFilterState *state);
+
+// evaluate whether a directory or one of its subdirectories may match
+int descendsDirFilter(const struct sDirFilter *filter,
+  const struct sDirFilterState *state);
+
+// free filter stack
+void freeDirFilterStack(struct sDirFilterStack *stack);
+
+// free directory filter
+void freeDirFilter(struct sDirFilter *filter);
+
+#endif // __dirfilter_h__
@@ -3,15 +3,19 @@
  * structures of FAT32 directory entries and entry lists.
  */
 
+#include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "entrylist.h"
 #include "errors.h"
 #include "FAT32.h"
-#include "natstrcmp.h"
-#include "options.h"
+#include "nametable.h"
+#include "orderfile.h"
+#include "radixsort.h"
+#include "sortkey.h"
 #include "stringlist.h"
 
 // random number
@@ -37,46 +41,66 @@ struct sDirEntryList *newDirEntryList() {
   return tmp;
 }
 
-struct sDirEntryList *newDirEntry(char *sname, char *lname,
-  struct sShortDirEntry *sde, struct sLongDirEntryList *ldel,
-  unsigned entries) {
+int getEntryRank(struct sDirEntryList *de) {
   /*
-   * create a new directory entry holder
+   * returns the fixed position class of an entry
+   */
+
+  // the volume label must always remain at the beginning of the directory
+  if ((de->sde->DIR_Atrr &
+      (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID |
+        ATTR_DIRECTORY)) == ATTR_VOLUME_ID) {
+    return RANK_VOLUME_LABEL;
+  }
+  // followed by the special "." and ".." directories
+  if (!strcmp(de->sname, "."))
+    return RANK_DOT;
+  if (!strcmp(de->sname, ".."))
+    return RANK_DOTDOT;
+  // deleted entries are moved to the end of the directory
+  if ((de->sname[0] & 0xFF) == DE_FREE)
+    return RANK_DELETED;
+
+  return RANK_ENTRY;
+}
+
+struct sDirEntryList *newDirEntry(struct sNameTable *names, const char *sname,
+  const char *lname, struct sShortDirEntry *sde,
+  struct sLongDirEntryList *ldel, unsigned entries) {
+  /*
+   * create a new directory entry holder, names that occurred before are
+   * shared with earlier entries
    */
   struct sDirEntryList *tmp;
+  struct sName *sn, *ln;
+
+  sn = internName(names, sname);
+  ln = internName(names, lname);
+  if (!sn || !ln)
+    return 0;
 
   tmp = malloc(sizeof(struct sDirEntryList));
   if (!tmp) {
     stderror();
     return 0;
   }
-  tmp->sname = malloc(strlen(sname) + 1);
-  if (!tmp->sname) {
-    stderror();
-    free(tmp);
-    return 0;
-  }
-  strcpy(tmp->sname, sname);
-  tmp->lname = malloc(strlen(lname) + 1);
-  if (!tmp->lname) {
-    stderror();
-    free(tmp->sname);
-    free(tmp);
-    return 0;
-  }
-  strcpy(tmp->lname, lname);
+  tmp->sname = sn->str;
+  tmp->lname = ln->str;
+  tmp->name = lname[0] ? ln : sn;
 
   tmp->sde = malloc(sizeof(struct sShortDirEntry));
   if (!tmp->sde) {
     stderror();
-    free(tmp->lname);
-    free(tmp->sname);
     free(tmp);
     return 0;
   }
   memcpy(tmp->sde, sde, DIR_ENTRY_SIZE);
   tmp->ldel = ldel;
   tmp->entries = entries;
+  tmp->key = 0;
+  tmp->keylen = 0;
+  tmp->rank = getEntryRank(tmp);
+  tmp->order = ORDER_UNLISTED;
   tmp->next = 0;
   return tmp;
 }
@@ -115,11 +139,12 @@ struct sLongDirEntryList *insertLongDirEntryList(struct sLongDirEntry *lde,
   }
 }
 
-int stripSpecialPrefixes(char *old, char *nw) {
+int stripSpecialPrefixes(const struct sStringList *prefixes,
+  const char *old, char *nw) {
   /*
-   * strip special prefixes "a" and "the"
+   * strip special prefixes like "a" and "the"
    */
-  struct sStringList *prefix = OPT_IGNORE_PREFIXES_LIST;
+  const struct sStringList *prefix = prefixes;
 
   size_t len, len_old;
 
@@ -138,147 +163,272 @@ int stripSpecialPrefixes(char *old, char *nw) {
   return 0;
 }
 
-int cmpEntries(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+int cmpEntries(const struct sSortSpec *spec, struct sDirEntryList *de1,
+  struct sDirEntryList *de2) {
   /*
    * compare two directory entries
    */
 
-  char s1[PATH_MAX + 1], s2[PATH_MAX + 1], s1_col[PATH_MAX * 2 + 1],
-    s2_col[PATH_MAX * 2 + 1];
+  int i, ret;
 
   /*
-   * the volume label must always remain at the beginning of the (root)
-   * directory
+   * the volume label, "." and ".." keep their place at the beginning and
+   * deleted entries at the end of the directory
    */
-  if ((de1->sde->DIR_Atrr &
-      (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID |
-        ATTR_DIRECTORY)) == ATTR_VOLUME_ID) {
-    return -1;
-  }
-  if ((de2->sde->DIR_Atrr &
-      (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID |
-        ATTR_DIRECTORY)) == ATTR_VOLUME_ID) {
-    return 1;
+  if (de1->rank != de2->rank)
+    return de1->rank < de2->rank ? -1 : 1;
+  if (de1->rank != RANK_ENTRY)
+    return 0;
+
+  for (i = 0; i < spec->count; i++) {
+    ret = spec->keys[i].cmp(de1, de2);
+    if (ret)
+      return ret * spec->keys[i].order;
   }
+
+  return 0;
+}
+
+void insertDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList *nw, struct sDirEntryList *list) {
   /*
-   * the special "." and ".." directories must always remain at the beginning
-   * of directories, in this order
+   * insert a directory entry into list
    */
-  if (!strcmp(de1->sname, "."))
-    return -1;
-  if (!strcmp(de2->sname, "."))
-    return 1;
-  if (!strcmp(de1->sname, ".."))
-    return -1;
-  if (!strcmp(de2->sname, ".."))
-    return 1;
-  // deleted entries should be moved to the end of the directory
-  if ((de1->sname[0] & 0xFF) == DE_FREE)
-    return 1;
-  if ((de2->sname[0] & 0xFF) == DE_FREE)
-    return -1;
 
-  char *ss1, *ss2;
+  struct sDirEntryList *tmp, *dummy;
 
-  if (de1->lname && de1->lname[0])
-    ss1 = de1->lname;
-  else
-    ss1 = de1->sname;
-  if (de2->lname && de2->lname[0])
-    ss2 = de2->lname;
-  else
-    ss2 = de2->sname;
+  tmp = list;
+
+  while (tmp->next && cmpEntries(spec, nw, tmp->next) >= 0)
+    tmp = tmp->next;
 
+  dummy = tmp->next;
+  tmp->next = nw;
+  nw->next = dummy;
+}
+
+int buildSortKey(const struct sSortSpec *spec, struct sDirEntryList *de) {
   /*
-   * it's not necessary to compare files for listing and randomization, each
-   * entry will be put to the end of the list
+   * compute the name sort key for an entry, natural order compares the
+   * names itself, all other orders compare the keys byte by byte. the key
+   * is kept with the interned name, so every distinct name is only
+   * transformed once
    */
-  if (OPT_LIST || OPT_RANDOM)
-    return 1;
 
-  // directories will be put above normal files
-  if (!OPT_ORDER) {
-    if (de1->sde->DIR_Atrr & ATTR_DIRECTORY && de2->sde->DIR_Atrr &
-      ~ATTR_DIRECTORY) {
-      return -1;
-    }
-    if (de1->sde->DIR_Atrr & ~ATTR_DIRECTORY && de2->sde->DIR_Atrr &
-      ATTR_DIRECTORY) {
-      return 1;
-    }
-  }
-  else if (OPT_ORDER == 1) {
-    if (de1->sde->DIR_Atrr & ATTR_DIRECTORY && de2->sde->DIR_Atrr &
-      ~ATTR_DIRECTORY) {
-      return 1;
-    }
-    if (de1->sde->DIR_Atrr & ~ATTR_DIRECTORY && de2->sde->DIR_Atrr &
-      ATTR_DIRECTORY) {
-      return -1;
-    }
-  }
+  char s[PATH_MAX + 1], s_col[PATH_MAX * 2 + 1];
+  const char *ss;
+  unsigned char *key;
+  size_t i, len;
 
-  // consider last modification time
-  if (OPT_MODIFICATION) {
-    int md1, md2;
-    md1 = de1->sde->DIR_WrtDate << 16 | de1->sde->DIR_WrtTime;
-    md2 = de2->sde->DIR_WrtDate << 16 | de2->sde->DIR_WrtTime;
-    if (md1 < md2)
-      return -OPT_REVERSE;
-    if (md1 > md2)
-      return OPT_REVERSE;
+  if (de->name->key) {
+    de->key = de->name->key;
+    de->keylen = de->name->keylen;
     return 0;
   }
 
+  ss = de->name->str;
+
   // strip special prefixes
-  if (OPT_IGNORE_PREFIXES_LIST->next) {
-    if (stripSpecialPrefixes(ss1, s1))
-      ss1 = s1;
-    if (stripSpecialPrefixes(ss2, s2)) {
-      ss2 = s2;
-    }
-  }
+  if (spec->prefixes && spec->prefixes->next &&
+    stripSpecialPrefixes(spec->prefixes, ss, s))
+    ss = s;
 
-  if (!OPT_ASCII) {
+  if (!(spec->nameFlags & (NAME_ASCII | NAME_NATURAL))) {
     // consider locale for comparison
-    if (strxfrm(s1_col, ss1, PATH_MAX * 2) == PATH_MAX * 2 ||
-      strxfrm(s2_col, ss2, PATH_MAX * 2) == PATH_MAX * 2) {
+    len = strxfrm(s_col, ss, PATH_MAX * 2);
+    if (len >= PATH_MAX * 2) {
       myerror("String collation error!");
-      exit(1);
+      return -1;
     }
+    ss = s_col;
+  }
+  else
+    len = strlen(ss);
+
+  key = malloc(len + 1);
+  if (!key) {
+    stderror();
+    return -1;
   }
 
-  if (OPT_NATURAL_SORT) {
-    if (OPT_IGNORE_CASE)
-      return natstrcasecmp(ss1, ss2) * OPT_REVERSE;
-    return natstrcmp(ss1, ss2) * OPT_REVERSE;
+  if ((spec->nameFlags & (NAME_IGNORE_CASE | NAME_NATURAL)) ==
+    NAME_IGNORE_CASE) {
+    for (i = 0; i < len; i++)
+      key[i] = (unsigned char) tolower((unsigned char) ss[i]);
   }
-  if (OPT_ASCII) {
-    // use plain ASCII corder
-    if (OPT_IGNORE_CASE)
-      return strcasecmp(ss1, ss2) * OPT_REVERSE;
-    return strcmp(ss1, ss2) * OPT_REVERSE;
+  else
+    memcpy(key, ss, len);
+  key[len] = 0;
+
+  de->name->key = de->key = key;
+  de->name->keylen = de->keylen = len;
+
+  return 0;
+}
+
+int getEntryClass(const struct sSortSpec *spec, struct sDirEntryList *de) {
+  /*
+   * returns the radix sort class of an entry, a leading type key splits
+   * normal entries into directories and files
+   */
+
+  if (de->rank < RANK_ENTRY)
+    return de->rank;
+  if (de->rank == RANK_DELETED)
+    return 5;
+  if (!spec->typeOrder)
+    return 3;
+  if (de->sde->DIR_Atrr & ATTR_DIRECTORY)
+    return spec->typeOrder > 0 ? 3 : 4;
+  return spec->typeOrder > 0 ? 4 : 3;
+}
+
+void radixSortDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList **array, struct sDirEntryList **aux, size_t n) {
+  /*
+   * sort entries by class and radix sort over sort keys, the result is
+   * stored in array
+   */
+
+  struct sDirEntryList *tmp;
+  size_t count[6] = { 0 }, start[6];
+  size_t i;
+  int class;
+
+  // stable counting sort by class
+  for (i = 0; i < n; i++)
+    count[getEntryClass(spec, array[i])]++;
+  start[0] = 0;
+  for (i = 1; i < 6; i++)
+    start[i] = start[i - 1] + count[i - 1];
+  for (i = 0; i < n; i++) {
+    tmp = array[i];
+    aux[start[getEntryClass(spec, tmp)]++] = tmp;
+  }
+  memcpy(array, aux, n * sizeof(*array));
+
+  // only entries of the name classes are compared by key
+  for (class = 3; class <= 4; class++) {
+    if (count[class] < 2)
+      continue;
+    i = start[class] - count[class];
+    if (spec->radix == RADIX_MTIME)
+      lsdRadixSort(array + i, aux + i, count[class],
+        spec->radixOrder < 0);
+    else if (spec->radix == RADIX_NAME)
+      msdRadixSort(array + i, aux + i, count[class],
+        spec->radixOrder < 0);
   }
-  if (OPT_IGNORE_CASE)
-    return strcasecmp(s1_col, s2_col) * OPT_REVERSE;
-  return strcmp(s1_col, s2_col) * OPT_REVERSE;
 }
 
-void insertDirEntryList(struct sDirEntryList *nw, struct sDirEntryList *list) {
+void mergeSortDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList **array, struct sDirEntryList **aux, size_t n) {
   /*
-   * insert a directory entry into list
+   * stable merge sort with cmpEntries()
    */
 
-  struct sDirEntryList *tmp, *dummy;
+  size_t i, j, k, mid;
 
-  tmp = list;
+  if (n < 2)
+    return;
+
+  mid = n / 2;
+  mergeSortDirEntryList(spec, array, aux, mid);
+  mergeSortDirEntryList(spec, array + mid, aux + mid, n - mid);
+
+  i = 0;
+  j = mid;
+  for (k = 0; k < n; k++) {
+    if (i < mid && (j == n || cmpEntries(spec, array[i], array[j]) <= 0))
+      aux[k] = array[i++];
+    else
+      aux[k] = array[j++];
+  }
+  memcpy(array, aux, n * sizeof(*array));
+}
+
+int sortDirEntryList(const struct sSortSpec *spec, struct sDirEntryList *list,
+  int entries) {
+  /*
+   * sort an unsorted directory entry list by the sort keys of spec
+   */
+
+  struct sDirEntryList **array, **aux, *tmp, *next;
+  size_t i, n = (size_t) entries;
+
+  // precompute name keys once per entry
+  if (spec->needsNameKey) {
+    for (tmp = list->next; tmp; tmp = tmp->next) {
+      if (tmp->rank == RANK_ENTRY && buildSortKey(spec, tmp)) {
+        myerror("Failed to build sort key!");
+        return -1;
+      }
+    }
+  }
 
-  while (tmp->next && cmpEntries(nw, tmp->next) >= 0)
+  if (entries < RADIX_SORT_THRESHOLD) {
+    tmp = list->next;
+    list->next = 0;
+    while (tmp) {
+      next = tmp->next;
+      insertDirEntryList(spec, tmp, list);
+      tmp = next;
+    }
+    return 0;
+  }
+
+  array = malloc(n * sizeof(*array));
+  if (!array) {
+    stderror();
+    return -1;
+  }
+  aux = malloc(n * sizeof(*aux));
+  if (!aux) {
+    stderror();
+    free(array);
+    return -1;
+  }
+
+  i = 0;
+  for (tmp = list->next; tmp; tmp = tmp->next)
+    array[i++] = tmp;
+
+  /*
+   * radix sort is used when it gives the same order as the comparator
+   * chain, i.e. for an optional type key followed by a single name (but not
+   * natural order) or modification time key
+   */
+  if (spec->radix != RADIX_NONE)
+    radixSortDirEntryList(spec, array, aux, n);
+  else
+    mergeSortDirEntryList(spec, array, aux, n);
+
+  // relink list in sorted order
+  tmp = list;
+  for (i = 0; i < n; i++) {
+    tmp->next = array[i];
     tmp = tmp->next;
+  }
+  tmp->next = 0;
 
-  dummy = tmp->next;
-  tmp->next = nw;
-  nw->next = dummy;
+  free(aux);
+  free(array);
+
+  return 0;
+}
+
+void freeLongDirEntryList(struct sLongDirEntryList *list) {
+  /*
+   * free long dir entry list
+   */
+  struct sLongDirEntryList *tmp;
+
+  while (list) {
+    free(list->lde);
+    tmp = list;
+    list = list->next;
+    free(tmp);
+  }
 }
 
 void freeDirEntryList(struct sDirEntryList *list) {
@@ -286,23 +436,13 @@ void freeDirEntryList(struct sDirEntryList *list) {
    * free dir entry list
    */
   struct sDirEntryList *tmp;
-  struct sLongDirEntryList *ldelist, *tmp2;
 
+  // names and sort keys belong to the name table
   while (list) {
-    if (list->sname)
-      free(list->sname);
-    if (list->lname)
-      free(list->lname);
     if (list->sde)
       free(list->sde);
 
-    ldelist = list->ldel;
-    while (ldelist) {
-      free(ldelist->lde);
-      tmp2 = ldelist;
-      ldelist = ldelist->next;
-      free(tmp2);
-    }
+    freeLongDirEntryList(list->ldel);
 
     tmp = list;
     list = list->next;
@@ -324,11 +464,7 @@ void randomizeDirEntryList(struct sDirEntryList *list, int entries) {
    * directory. the special "." and ".." directories must always remain at
    * the beginning of directories, so skip them
    */
-  while (randlist->next && ((randlist->next->sde->DIR_Atrr &
-        (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID |
-          ATTR_DIRECTORY)) == ATTR_VOLUME_ID ||
-      !strcmp(randlist->next->sname, ".") ||
-      !strcmp(randlist->next->sname, ".."))) {
+  while (randlist->next && randlist->next->rank < RANK_ENTRY) {
 
     randlist = randlist->next;
     skip++;
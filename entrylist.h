@@ -6,8 +6,32 @@
 #ifndef __entrylist_h__
 #define __entrylist_h__
 
+#include <stddef.h>
+
+/*
+ * directories with at least this many entries are sorted by radix sort over
+ * precomputed sort keys (or by merge sort if the sort keys can't be radix
+ * sorted) instead of by insertion with cmpEntries(), the crossover
+ * benchmark of check/bench.c has them win from 8 (name), 16 (natural) and
+ * 32 (mtime) entries on
+ */
+#ifndef RADIX_SORT_THRESHOLD
+#define RADIX_SORT_THRESHOLD 32
+#endif
+
+// fixed position classes of directory entries
+#define RANK_VOLUME_LABEL 0
+#define RANK_DOT 1
+#define RANK_DOTDOT 2
+#define RANK_ENTRY 3 // entries that are sorted by the sort keys
+#define RANK_DELETED 4
+
 struct sLongDirEntry;
+struct sName;
+struct sNameTable;
 struct sShortDirEntry;
+struct sSortSpec;
+struct sStringList;
 
 struct sLongDirEntryList {
   /*
@@ -23,10 +47,15 @@ struct sDirEntryList {
    * list structure for every file with short name entries and long name
    * entries
    */
-  char *sname, *lname; // short and long name strings
+  const char *sname, *lname; // interned short and long name strings
+  struct sName *name; // interned name that the sort key is built for
   struct sShortDirEntry *sde; // short dir entry
   struct sLongDirEntryList *ldel; // long name entries in a list
   unsigned entries; // number of entries
+  int rank; // fixed position class
+  unsigned order; // rank in the order file or ORDER_UNLISTED
+  unsigned char *key; // name sort key, owned by the interned name
+  size_t keylen; // length of name sort key
   struct sDirEntryList *next; // next dir entry
 };
 
@@ -36,20 +65,47 @@ struct sDirEntryList *newDirEntryList();
 // randomize entry list
 void randomizeDirEntryList(struct sDirEntryList *list, int entries);
 
-// create a new directory entry holder
-struct sDirEntryList *newDirEntry(char *sname, char *lname,
-  struct sShortDirEntry *sde, struct sLongDirEntryList *ldel,
-  unsigned entries);
+// create a new directory entry holder, its names are interned in names
+struct sDirEntryList *newDirEntry(struct sNameTable *names, const char *sname,
+  const char *lname, struct sShortDirEntry *sde,
+  struct sLongDirEntryList *ldel, unsigned entries);
 
 // insert a long directory entry to list
 struct sLongDirEntryList *insertLongDirEntryList(struct sLongDirEntry *lde,
   struct sLongDirEntryList *list);
 
-// compare two directory entries
-int cmpEntries(struct sDirEntryList *de1, struct sDirEntryList *de2);
+// strip the first matching prefix of a list from a name
+int stripSpecialPrefixes(const struct sStringList *prefixes,
+  const char *old, char *nw);
+
+// compute the name sort key for an entry or reuse the key of its interned
+// name
+int buildSortKey(const struct sSortSpec *spec, struct sDirEntryList *de);
+
+// compare two directory entries by the sort keys of spec
+int cmpEntries(const struct sSortSpec *spec, struct sDirEntryList *de1,
+  struct sDirEntryList *de2);
 
 // insert a directory entry into list
-void insertDirEntryList(struct sDirEntryList *q, struct sDirEntryList *list);
+void insertDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList *q, struct sDirEntryList *list);
+
+// sort an array of entries by position class and radix sort over their sort
+// keys, aux has room for n entries
+void radixSortDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList **array, struct sDirEntryList **aux, size_t n);
+
+// stable merge sort of an array of entries with cmpEntries(), aux has room
+// for n entries
+void mergeSortDirEntryList(const struct sSortSpec *spec,
+  struct sDirEntryList **array, struct sDirEntryList **aux, size_t n);
+
+// sort an unsorted directory entry list by the sort keys of spec
+int sortDirEntryList(const struct sSortSpec *spec, struct sDirEntryList *list,
+  int entries);
+
+// free long dir entry list
+void freeLongDirEntryList(struct sLongDirEntryList *list);
 
 // free dir entry list
 void freeDirEntryList(struct sDirEntryList *list);
@@ -0,0 +1,424 @@
+/*
+ * This file contains/describes functions that collect allocation and
+ * fragmentation statistics of FAT32 file systems.
+ */
+
+#include "fatstats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "errors.h"
+#include "FAT32.h"
+#include "fileio.h"
+
+int openFATRun(struct sFATScan *scan, uint32_t cluster) {
+  /*
+   * start a new run with cluster
+   */
+
+  struct sFATRun *runs;
+  size_t size;
+
+  if (scan->len == scan->size) {
+    size = scan->size ? scan->size * 2 : 1024;
+    runs = realloc(scan->runs, size * sizeof(struct sFATRun));
+    if (!runs) {
+      stderror();
+      return -1;
+    }
+    scan->runs = runs;
+    scan->size = size;
+  }
+
+  scan->runs[scan->len].start = cluster;
+  scan->runs[scan->len].link = NO_RUN;
+  scan->runs[scan->len].flags = 0;
+  scan->len++;
+  scan->open = 1;
+
+  return 0;
+}
+
+void closeFATRun(struct sFATScan *scan, uint32_t end, uint32_t next) {
+  /*
+   * end the last run with cluster end that points to next
+   */
+
+  scan->runs[scan->len - 1].end = end;
+  scan->runs[scan->len - 1].next = next;
+  scan->open = 0;
+}
+
+int scanFAT32Entry(struct sFATScan *scan, struct sFAT32Stats *stats,
+  uint32_t cluster, uint32_t data) {
+  /*
+   * account one FAT32 entry
+   */
+
+  if (!data || data == FAT32_BAD_CLUSTER) {
+    if (data)
+      stats->badClusters++;
+    else
+      stats->freeClusters++;
+    // the previous cluster points to this one
+    if (scan->open)
+      closeFATRun(scan, cluster - 1, cluster);
+    return 0;
+  }
+
+  if (!scan->open && openFATRun(scan, cluster)) {
+    myerror("Failed to add run!");
+    return -1;
+  }
+
+  if (data != cluster + 1) {
+    closeFATRun(scan, cluster, data);
+    if (data >= FAT32_EOC)
+      stats->EOCClusters++;
+  }
+
+  return 0;
+}
+
+int scanFAT32Entries(struct sFATScan *scan, struct sFAT32Stats *stats,
+  const uint32_t *entries, uint32_t first, uint32_t count) {
+  /*
+   * account a block of FAT32 entries starting with cluster first, blocks of
+   * contiguous or free clusters are skipped four entries at a time
+   */
+
+  uint32_t j = 0, k;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(0x0FFFFFFF);
+  const __m128i lanes = _mm_set_epi32(4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i data, next;
+
+  for (; j + 4 <= count; j += 4) {
+    data = _mm_and_si128(_mm_loadu_si128((const __m128i *) (entries + j)),
+      mask);
+
+    // every cluster points to the next one
+    next = _mm_add_epi32(_mm_set1_epi32((int) (first + j)), lanes);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(data, next)) == 0xFFFF) {
+      if (!scan->open && openFATRun(scan, first + j)) {
+        myerror("Failed to add run!");
+        return -1;
+      }
+      continue;
+    }
+
+    // all clusters are free
+    if (!scan->open &&
+      _mm_movemask_epi8(_mm_cmpeq_epi32(data, zero)) == 0xFFFF) {
+      stats->freeClusters += 4;
+      continue;
+    }
+
+    for (k = j; k < j + 4; k++) {
+      if (scanFAT32Entry(scan, stats, first + k, entries[k] & 0x0FFFFFFF))
+        return -1;
+    }
+  }
+#endif
+
+  for (k = j; k < count; k++) {
+    if (scanFAT32Entry(scan, stats, first + k, entries[k] & 0x0FFFFFFF))
+      return -1;
+  }
+
+  return 0;
+}
+
+int scanFAT32(struct sFileSystem *fs, struct sFATScan *scan,
+  struct sFAT32Stats *stats) {
+  /*
+   * read the first FAT32 chunk by chunk and split it into runs
+   */
+
+  uint32_t FAT32SizeInBytes, chunkSize, pos, len, first, count, last;
+  int64_t BSOffset;
+
+  uint32_t *chunk;
+
+  FAT32SizeInBytes = fs->FAT32Size * fs->sectorSize;
+  last = (uint32_t) fs->clusters + 2;
+  if (last > FAT32SizeInBytes / 4)
+    last = FAT32SizeInBytes / 4;
+
+  // chunks are a multiple of the sector size
+  chunkSize = FAT32_CHECK_CHUNK_SIZE / fs->sectorSize * fs->sectorSize;
+  if (!chunkSize)
+    chunkSize = fs->sectorSize;
+
+  chunk = malloc(chunkSize);
+  if (!chunk) {
+    stderror();
+    return -1;
+  }
+
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec;
+  if (fs_seek(fs->fd, BSOffset, SEEK_SET) == -1) {
+    myerror("Seek error!");
+    free(chunk);
+    return -1;
+  }
+
+  for (pos = 0; pos / 4 < last; pos += len) {
+    len = FAT32SizeInBytes - pos < chunkSize ? FAT32SizeInBytes - pos :
+      chunkSize;
+
+    if (!fs_read(chunk, 1, len, fs->fd)) {
+      myerror("Failed to read from file!");
+      free(chunk);
+      return -1;
+    }
+
+    // the first two entries are reserved
+    first = pos / 4 < 2 ? 2 : pos / 4;
+    count = (pos + len) / 4 < last ? (pos + len) / 4 - first : last - first;
+    if (scanFAT32Entries(scan, stats, chunk + (first - pos / 4), first,
+        count)) {
+      free(chunk);
+      return -1;
+    }
+  }
+
+  // the last cluster points behind the data region
+  if (scan->open)
+    closeFATRun(scan, last - 1, last);
+
+  free(chunk);
+
+  return 0;
+}
+
+size_t findFATRun(const struct sFATScan *scan, uint32_t cluster) {
+  /*
+   * find the run that starts with cluster
+   */
+
+  size_t low = 0, high = scan->len, mid;
+
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (scan->runs[mid].start < cluster)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if (low < scan->len && scan->runs[low].start == cluster)
+    return low;
+
+  return NO_RUN;
+}
+
+void linkFATRuns(struct sFATScan *scan, struct sFAT32Stats *stats) {
+  /*
+   * connect every run with the run its last cluster points to, links to
+   * clusters that don't start an unreferenced run are broken
+   */
+
+  size_t j, k;
+
+  for (j = 0; j < scan->len; j++) {
+    if (scan->runs[j].next >= FAT32_EOC)
+      continue;
+
+    k = findFATRun(scan, scan->runs[j].next);
+    if (k == NO_RUN || scan->runs[k].flags & RUN_REFERENCED) {
+      stats->brokenLinks++;
+      continue;
+    }
+    scan->runs[j].link = k;
+    scan->runs[k].flags |= RUN_REFERENCED;
+  }
+}
+
+int markDirectories(struct sFileSystem *fs, struct sFATScan *scan) {
+  /*
+   * flag the first runs of all directories that are reachable from the root
+   * directory
+   */
+
+  size_t *stack, len = 0, j, k;
+  uint32_t cluster, offset, start;
+  char *buf;
+  union sDirEntry *de;
+  int end;
+
+  j = findFATRun(scan, fs->bs.BS_RootClus);
+  if (j == NO_RUN || scan->runs[j].flags & RUN_REFERENCED)
+    return 0;
+
+  // every run is pushed at most once
+  stack = malloc(scan->len * sizeof(size_t));
+  buf = malloc(fs->clusterSize);
+  if (!stack || !buf) {
+    stderror();
+    free(stack);
+    free(buf);
+    return -1;
+  }
+
+  scan->runs[j].flags |= RUN_DIRECTORY;
+  stack[len++] = j;
+
+  while (len) {
+    end = 0;
+    for (j = stack[--len]; j != NO_RUN && !end; j = scan->runs[j].link) {
+      for (cluster = scan->runs[j].start; cluster <= scan->runs[j].end &&
+        !end; cluster++) {
+        if (fs_seek(fs->fd, getClusterOffset(fs, cluster), SEEK_SET) == -1) {
+          myerror("Seek error!");
+          free(stack);
+          free(buf);
+          return -1;
+        }
+        if (!fs_read(buf, 1, fs->clusterSize, fs->fd)) {
+          myerror("Failed to read from file!");
+          free(stack);
+          free(buf);
+          return -1;
+        }
+
+        for (offset = 0; offset < fs->clusterSize; offset += DIR_ENTRY_SIZE) {
+          de = (union sDirEntry *) (buf + offset);
+          if (!parseEntry(de)) {
+            end = 1;
+            break;
+          }
+          if ((de->ShortDirEntry.DIR_Name[0] & 0xFF) == DE_FREE ||
+            (de->LongDirEntry.LDIR_Attr & ATTR_LONG_NAME_MASK) ==
+            ATTR_LONG_NAME || !(de->ShortDirEntry.DIR_Atrr & ATTR_DIRECTORY)
+            || de->ShortDirEntry.DIR_Name[0] == '.')
+            continue;
+
+          start = (uint32_t) de->ShortDirEntry.DIR_FstClusHI << 16 |
+            de->ShortDirEntry.DIR_FstClusLO;
+          k = findFATRun(scan, start);
+          if (k == NO_RUN || scan->runs[k].flags &
+            (RUN_REFERENCED | RUN_DIRECTORY))
+            continue;
+          scan->runs[k].flags |= RUN_DIRECTORY;
+          stack[len++] = k;
+        }
+      }
+    }
+  }
+
+  free(stack);
+  free(buf);
+
+  return 0;
+}
+
+void countFragments(const struct sFATScan *scan, struct sFAT32Stats *stats) {
+  /*
+   * count the runs of every cluster chain, chains start with unreferenced
+   * runs
+   */
+
+  size_t j, k;
+  uint32_t fragments;
+  unsigned bucket;
+
+  for (j = 0; j < scan->len; j++) {
+    if (scan->runs[j].flags & RUN_REFERENCED)
+      continue;
+
+    fragments = 0;
+    for (k = j; k != NO_RUN; k = scan->runs[k].link)
+      fragments++;
+
+    for (bucket = 0; bucket < FRAGMENT_BUCKETS - 1 &&
+      fragments > 1U << bucket; bucket++);
+
+    if (scan->runs[j].flags & RUN_DIRECTORY) {
+      stats->dirs++;
+      stats->dirFragments[bucket]++;
+      if (fragments > 1)
+        stats->fragmentedDirs++;
+    }
+    else {
+      stats->files++;
+      stats->fileFragments[bucket]++;
+      if (fragments > 1)
+        stats->fragmentedFiles++;
+    }
+  }
+}
+
+int readFSInfo(struct sFileSystem *fs, struct sFAT32Stats *stats) {
+  /*
+   * read FSInfo sector and check its signatures
+   */
+
+  struct sFSInfo info;
+
+  stats->FSInfoValid = 0;
+  if (!fs->bs.BS_FSInfo || fs->bs.BS_FSInfo == 0xFFFF ||
+    fs->bs.BS_FSInfo >= fs->bs.BS_RsvdSecCnt)
+    return 0;
+
+  if (fs_seek(fs->fd, (int64_t) fs->bs.BS_FSInfo * fs->sectorSize, SEEK_SET) ==
+    -1) {
+    myerror("Seek error!");
+    return -1;
+  }
+  if (!fs_read(&info, 1, sizeof(info), fs->fd)) {
+    myerror("Failed to read from file!");
+    return -1;
+  }
+
+  if (info.FSI_LeadSig != FSI_LEAD_SIG || info.FSI_StrucSig != FSI_STRUC_SIG
+    || info.FSI_TrailSig != FSI_TRAIL_SIG)
+    return 0;
+
+  stats->FSInfoValid = 1;
+  stats->FSInfoFreeCount = info.FSI_Free_Count;
+  stats->FSInfoNextFree = info.FSI_Nxt_Free;
+
+  return 0;
+}
+
+int getFAT32Stats(struct sFileSystem *fs, struct sFAT32Stats *stats) {
+  /*
+   * scan FAT32, directories and FSInfo of a file system
+   */
+
+  struct sFATScan scan = { 0 };
+
+  memset(stats, 0, sizeof(*stats));
+
+  if (scanFAT32(fs, &scan, stats)) {
+    myerror("Failed to scan FAT32!");
+    free(scan.runs);
+    return -1;
+  }
+  stats->runs = scan.len;
+
+  linkFATRuns(&scan, stats);
+
+  if (markDirectories(fs, &scan)) {
+    myerror("Failed to find directories!");
+    free(scan.runs);
+    return -1;
+  }
+
+  countFragments(&scan, stats);
+
+  free(scan.runs);
+
+  if (readFSInfo(fs, stats)) {
+    myerror("Failed to read FSInfo!");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * This file contains/describes functions that collect allocation and
+ * fragmentation statistics of FAT32 file systems.
+ */
+
+#ifndef __fatstats_h__
+#define __fatstats_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct sFileSystem;
+
+// buckets of the fragment histogram: 1, 2, 3-4, 5-8, ..., 65 and more
+#define FRAGMENT_BUCKETS 8
+
+// flags of runs
+#define RUN_REFERENCED 0x01U // another run continues with this run
+#define RUN_DIRECTORY 0x02U // first run of a directory
+
+// no following run
+#define NO_RUN ((size_t) -1)
+
+struct sFATRun {
+  /*
+   * clusters start to end where each cluster points to the next one
+   */
+  uint32_t start, end;
+  uint32_t next; // FAT32 entry of the last cluster
+  size_t link; // run that continues the chain or NO_RUN
+  unsigned flags;
+};
+
+struct sFATScan {
+  /*
+   * state of the sequential FAT32 scan
+   */
+  struct sFATRun *runs; // runs in order of their first cluster
+  size_t len, size;
+  int open; // last run may still be continued by the next cluster
+};
+
+struct sFAT32Stats {
+  /*
+   * allocation and fragmentation statistics
+   */
+  uint32_t freeClusters, badClusters, EOCClusters;
+  size_t runs; // contiguous runs of allocated clusters
+  uint32_t files, dirs; // cluster chains of files and directories
+  uint32_t fragmentedFiles, fragmentedDirs;
+  uint32_t fileFragments[FRAGMENT_BUCKETS], dirFragments[FRAGMENT_BUCKETS];
+  uint32_t brokenLinks; // links to free, bad, used or invalid clusters
+  int FSInfoValid; // FSInfo sector with valid signatures was found
+  uint32_t FSInfoFreeCount, FSInfoNextFree;
+};
+
+// scan FAT32, directories and FSInfo of a file system
+int getFAT32Stats(struct sFileSystem *fs, struct sFAT32Stats *stats);
+
+#endif // __fatstats_h__
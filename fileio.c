@@ -2,34 +2,612 @@
  * This file contains file io functions
  */
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "fileio.h"
-#include <fileapi.h>
-#include <handleapi.h>
-#include <winnt.h>
 
-FILE *fs_open(char *path, char *mode) {
-  char q[PATH_MAX + 1] = {0};
-  strcat(q, "\\\\.\\");
-  strcat(q, path);
-  return CreateFile(q, strcmp(mode,
-      "r+b") ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE, 0, 0,
-    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "progress.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+struct sDevice {
+  /*
+   * device handle and position, the position is tracked here, because all
+   * transfers are positioned reads and writes
+   */
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  int fd;
+#endif
+  int64_t pos; // current offset
+  int64_t base, size; // offset and size of the partition or 0
+  uint32_t blockSize; // logical block size
+  char *buf; // block aligned buffer for direct I/O or 0
+#ifdef IO_TRACE
+  FILE *trace; // trace file or 0
+  unsigned long long reads, writes, seeks, bytesRead, bytesWritten;
+#endif
+  int simulated; // transfers are charged with the media model
+  struct sMediaModel model;
+  struct sMediaStats stats;
+  int64_t next; // offset behind the last request
+  int64_t open[MEDIA_MAX_OPEN_BLOCKS]; // open erase blocks, most recent first
+  unsigned opened; // number of open erase blocks
+};
+
+#ifdef IO_TRACE
+
+/*
+ * the I/O trace build appends one line per transfer and seek and the totals
+ * of every device to the file that ROSSO_IO_TRACE names, the check scripts
+ * compare the totals against upper bounds
+ */
+
+void openTrace(struct sDevice *dev, const char *path) {
+  const char *name = getenv("ROSSO_IO_TRACE");
+
+  dev->trace = name ? fopen(name, "a") : 0;
+  if (dev->trace)
+    fprintf(dev->trace, "O %s\n", path);
+}
+
+void traceTransfer(struct sDevice *dev, char op, size_t len) {
+  if (op == 'R') {
+    dev->reads++;
+    dev->bytesRead += len;
+  }
+  else {
+    dev->writes++;
+    dev->bytesWritten += len;
+  }
+  if (dev->trace)
+    fprintf(dev->trace, "%c %lld %llu\n", op, (long long) dev->pos,
+      (unsigned long long) len);
+}
+
+void traceSeek(struct sDevice *dev, int64_t pos) {
+  // seeks to the end of the last transfer don't move
+  if (pos == dev->pos)
+    return;
+  dev->seeks++;
+  if (dev->trace)
+    fprintf(dev->trace, "S %lld\n", (long long) pos);
+}
+
+void closeTrace(struct sDevice *dev) {
+  if (!dev->trace)
+    return;
+  fprintf(dev->trace, "T reads %llu writes %llu seeks %llu read %llu "
+    "written %llu\n", dev->reads, dev->writes, dev->seeks, dev->bytesRead,
+    dev->bytesWritten);
+  fclose(dev->trace);
 }
 
-int fs_seek(FILE *stream, long offset, int whence) {
-  return (int) SetFilePointer(stream, offset, 0, (unsigned) whence);
+#else
+
+#define openTrace(dev, path)
+#define traceTransfer(dev, op, len)
+#define traceSeek(dev, pos)
+#define closeTrace(dev)
+
+#endif
+
+int openEraseBlock(struct sDevice *dev, int64_t block) {
+  /*
+   * makes block the most recently written erase block, returns 1 if it had
+   * to be opened, so its old content is copied
+   */
+  unsigned j;
+  int copied = 1;
+
+  for (j = 0; j < dev->opened && dev->open[j] != block; j++);
+  if (j < dev->opened)
+    copied = 0;
+  else if (dev->opened < dev->model.openBlocks)
+    dev->opened++;
+  else
+    j--;
+
+  memmove(dev->open + 1, dev->open, j * sizeof(*dev->open));
+  dev->open[0] = block;
+
+  return copied;
 }
 
-size_t fs_read(void *ptr, size_t size, size_t j, FILE *stream) {
+void simulateTransfer(struct sDevice *dev, char op, int64_t offset,
+  size_t len) {
+  /*
+   * adds the simulated time of one request of the device, writes to an erase
+   * block that is not open copy the whole block
+   */
+  const struct sMediaModel *model = &dev->model;
+  unsigned long long bytes = len, rate;
+  int64_t block, last;
+  double time;
+
+  if (!dev->simulated || !len)
+    return;
+
+  dev->stats.requests++;
+  time = (double) model->request;
+  if (offset != dev->next) {
+    dev->stats.random++;
+    time += (double) model->seek;
+  }
+  dev->next = offset + (int64_t) len;
+
+  if (op == 'W' && model->eraseBlock) {
+    last = (offset + (int64_t) len - 1) / (int64_t) model->eraseBlock;
+    for (block = offset / (int64_t) model->eraseBlock; block <= last;
+      block++) {
+      if (openEraseBlock(dev, block)) {
+        dev->stats.erases++;
+        bytes += model->eraseBlock;
+      }
+    }
+  }
+
+  rate = op == 'R' ? model->readRate : model->writeRate;
+  dev->stats.time += time * 1e-6 + (rate ? (double) bytes / (double) rate :
+    0);
+}
+
+#ifdef _WIN32
+
+int64_t rawRead(struct sDevice *dev, void *ptr, size_t len, int64_t offset) {
+  /*
+   * reads len bytes at offset, returns the number of read bytes or -1
+   */
+  OVERLAPPED ov = { 0 };
   DWORD q;
-  return (size_t) ReadFile(stream, ptr, (unsigned) (size * j), &q, 0);
+
+  ov.Offset = (DWORD) offset;
+  ov.OffsetHigh = (DWORD) (offset >> 32);
+  if (!ReadFile(dev->handle, ptr, (DWORD) len, &q, &ov))
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  return q;
 }
 
-size_t fs_write(const void *ptr, size_t size, size_t j, FILE *stream) {
+int64_t rawWrite(struct sDevice *dev, const void *ptr, size_t len,
+  int64_t offset) {
+  /*
+   * writes len bytes at offset, returns the number of written bytes or -1
+   */
+  OVERLAPPED ov = { 0 };
   DWORD q;
-  return (size_t) WriteFile(stream, ptr, (unsigned) (size * j), &q, 0);
+
+  ov.Offset = (DWORD) offset;
+  ov.OffsetHigh = (DWORD) (offset >> 32);
+  if (!WriteFile(dev->handle, ptr, (DWORD) len, &q, &ov))
+    return -1;
+  return q;
+}
+
+int64_t rawSize(struct sDevice *dev) {
+  /*
+   * returns the size of the device or -1
+   */
+  GET_LENGTH_INFORMATION info;
+  LARGE_INTEGER size;
+  DWORD q;
+
+  if (DeviceIoControl(dev->handle, IOCTL_DISK_GET_LENGTH_INFO, 0, 0, &info,
+      sizeof(info), &q, 0))
+    return info.Length.QuadPart;
+  if (GetFileSizeEx(dev->handle, &size))
+    return size.QuadPart;
+  return -1;
+}
+
+void *allocAligned(size_t size, size_t alignment) {
+  return _aligned_malloc(size, alignment);
+}
+
+void freeAligned(void *ptr) {
+  _aligned_free(ptr);
+}
+
+int openDevice(struct sDevice *dev, const char *path, const char *mode,
+  int flags) {
+  char q[PATH_MAX + 1] = {0};
+  DISK_GEOMETRY geometry;
+  DWORD r;
+
+  strcat(q, "\\\\.\\");
+  strncat(q, path, PATH_MAX - 4);
+  dev->handle = CreateFile(q, strcmp(mode,
+      "r+b") ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+    flags & FS_SHARED ? FILE_SHARE_READ | FILE_SHARE_WRITE : 0, 0,
+    OPEN_EXISTING, flags & FS_DIRECT ? FILE_FLAG_NO_BUFFERING |
+    FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL, 0);
+  if (dev->handle == INVALID_HANDLE_VALUE)
+    return -1;
+
+  dev->blockSize = DIRECT_BLOCK_SIZE;
+  if (DeviceIoControl(dev->handle, IOCTL_DISK_GET_DRIVE_GEOMETRY, 0, 0,
+      &geometry, sizeof(geometry), &r, 0) && geometry.BytesPerSector)
+    dev->blockSize = geometry.BytesPerSector;
+
+  return 0;
+}
+
+int syncDevice(struct sDevice *dev) {
+  return FlushFileBuffers(dev->handle) ? 0 : -1;
+}
+
+int dropCache(struct sDevice *dev) {
+  // the cache of a handle can't be dropped, but volumes are not cached
+  (void) dev;
+  return 0;
+}
+
+int closeDevice(struct sDevice *dev) {
+  return CloseHandle(dev->handle) ? 0 : -1;
+}
+
+#else
+
+int64_t rawRead(struct sDevice *dev, void *ptr, size_t len, int64_t offset) {
+  /*
+   * reads len bytes at offset, returns the number of read bytes or -1
+   */
+  size_t done = 0;
+  ssize_t q;
+
+  while (done < len) {
+    q = pread(dev->fd, (char *) ptr + done, len - done, (off_t) (offset +
+        (int64_t) done));
+    if (q == -1 && errno == EINTR)
+      continue;
+    if (q == -1)
+      return -1;
+    if (!q)
+      break;
+    done += (size_t) q;
+  }
+  return (int64_t) done;
+}
+
+int64_t rawWrite(struct sDevice *dev, const void *ptr, size_t len,
+  int64_t offset) {
+  /*
+   * writes len bytes at offset, returns the number of written bytes or -1
+   */
+  size_t done = 0;
+  ssize_t q;
+
+  while (done < len) {
+    q = pwrite(dev->fd, (const char *) ptr + done, len - done,
+      (off_t) (offset + (int64_t) done));
+    if (q == -1 && errno == EINTR)
+      continue;
+    if (q == -1)
+      return -1;
+    done += (size_t) q;
+  }
+  return (int64_t) done;
+}
+
+int64_t rawSize(struct sDevice *dev) {
+  /*
+   * returns the size of the device or -1
+   */
+  off_t size = lseek(dev->fd, 0, SEEK_END);
+  return size == -1 ? -1 : (int64_t) size;
+}
+
+void *allocAligned(size_t size, size_t alignment) {
+  void *ptr;
+  return posix_memalign(&ptr, alignment, size) ? 0 : ptr;
+}
+
+void freeAligned(void *ptr) {
+  free(ptr);
+}
+
+int openDevice(struct sDevice *dev, const char *path, const char *mode,
+  int flags) {
+  struct stat st;
+  int oflags, size;
+
+  oflags = strcmp(mode, "r+b") ? O_RDONLY : O_RDWR;
+#ifdef O_DIRECT
+  if (flags & FS_DIRECT)
+    oflags |= O_DIRECT;
+#endif
+  dev->fd = open(path, oflags);
+  if (dev->fd == -1)
+    return -1;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+  if (flags & FS_DIRECT)
+    fcntl(dev->fd, F_NOCACHE, 1);
+#endif
+
+  // images are aligned to sectors, devices report their logical block size
+  dev->blockSize = DIRECT_BLOCK_SIZE;
+#ifdef BLKSSZGET
+  if (!fstat(dev->fd, &st) && S_ISBLK(st.st_mode) &&
+    !ioctl(dev->fd, BLKSSZGET, &size) && size > 0)
+    dev->blockSize = (uint32_t) size;
+#else
+  (void) st;
+  (void) size;
+#endif
+
+  return 0;
+}
+
+int syncDevice(struct sDevice *dev) {
+#ifdef __linux__
+  return fdatasync(dev->fd);
+#else
+  return fsync(dev->fd);
+#endif
+}
+
+int dropCache(struct sDevice *dev) {
+  /*
+   * clean pages of the device are dropped from the page cache, where the
+   * system doesn't support it the cache can't be bypassed
+   */
+#ifdef POSIX_FADV_DONTNEED
+  int ret;
+
+  ret = posix_fadvise(dev->fd, 0, 0, POSIX_FADV_DONTNEED);
+  if (ret) {
+    errno = ret;
+    return -1;
+  }
+#else
+  (void) dev;
+#endif
+  return 0;
+}
+
+int closeDevice(struct sDevice *dev) {
+  return close(dev->fd);
+}
+
+#endif
+
+struct sDevice *fs_open(const char *path, const char *mode, int flags) {
+  struct sDevice *dev;
+
+  dev = calloc(1, sizeof(*dev));
+  if (!dev)
+    return 0;
+
+  if (openDevice(dev, path, mode, flags)) {
+    free(dev);
+    return 0;
+  }
+  openTrace(dev, path);
+
+  // direct transfers go through one block aligned buffer per device
+  if (flags & FS_DIRECT) {
+    if (dev->blockSize & (dev->blockSize - 1) ||
+      dev->blockSize > DIRECT_BUFFER_SIZE) {
+      closeTrace(dev);
+      closeDevice(dev);
+      free(dev);
+      errno = EINVAL;
+      return 0;
+    }
+    dev->buf = allocAligned(DIRECT_BUFFER_SIZE, dev->blockSize > 4096 ?
+      dev->blockSize : 4096);
+    if (!dev->buf) {
+      closeTrace(dev);
+      closeDevice(dev);
+      free(dev);
+      errno = ENOMEM;
+      return 0;
+    }
+  }
+
+  return dev;
+}
+
+int fs_seek(struct sDevice *dev, int64_t offset, int whence) {
+  int64_t base = dev->base;
+
+  if (whence == SEEK_CUR)
+    base = dev->pos;
+  else if (whence == SEEK_END) {
+    if (dev->size)
+      base = dev->base + dev->size;
+    else {
+      base = rawSize(dev);
+      if (base == -1)
+        return -1;
+    }
+  }
+  if (base + offset < dev->base) {
+    errno = EINVAL;
+    return -1;
+  }
+  traceSeek(dev, base + offset);
+  dev->pos = base + offset;
+  return 0;
+}
+
+int directRead(struct sDevice *dev, char *ptr, size_t len) {
+  /*
+   * reads through the aligned buffer, the transfers are widened to whole
+   * blocks
+   */
+  size_t skip, chunk, span;
+  int64_t start, q;
+
+  while (len) {
+    start = dev->pos - dev->pos % dev->blockSize;
+    skip = (size_t) (dev->pos - start);
+    chunk = len < DIRECT_BUFFER_SIZE - skip ? len : DIRECT_BUFFER_SIZE - skip;
+    span = (skip + chunk + dev->blockSize - 1) / dev->blockSize *
+      dev->blockSize;
+
+    // the last block of an image may be incomplete
+    q = rawRead(dev, dev->buf, span, start);
+    if (q < (int64_t) (skip + chunk))
+      return -1;
+    simulateTransfer(dev, 'R', start, span);
+
+    memcpy(ptr, dev->buf + skip, chunk);
+    dev->pos += (int64_t) chunk;
+    ptr += chunk;
+    len -= chunk;
+  }
+  return 0;
+}
+
+int directWrite(struct sDevice *dev, const char *ptr, size_t len) {
+  /*
+   * writes through the aligned buffer, partially written blocks at both ends
+   * are read first
+   */
+  size_t skip, chunk, span;
+  int64_t start, q;
+
+  while (len) {
+    start = dev->pos - dev->pos % dev->blockSize;
+    skip = (size_t) (dev->pos - start);
+    chunk = len < DIRECT_BUFFER_SIZE - skip ? len : DIRECT_BUFFER_SIZE - skip;
+    span = (skip + chunk + dev->blockSize - 1) / dev->blockSize *
+      dev->blockSize;
+
+    // bytes behind the end of an image are written as zeros, not as the
+    // stale content of the buffer
+    if (skip) {
+      q = rawRead(dev, dev->buf, dev->blockSize, start);
+      if (q < (int64_t) skip)
+        return -1;
+      memset(dev->buf + (size_t) q, 0, dev->blockSize - (size_t) q);
+      simulateTransfer(dev, 'R', start, dev->blockSize);
+    }
+    if ((skip + chunk) % dev->blockSize && (span > dev->blockSize || !skip)) {
+      q = rawRead(dev, dev->buf + span - dev->blockSize, dev->blockSize,
+        start + (int64_t) (span - dev->blockSize));
+      if (q < 0)
+        return -1;
+      memset(dev->buf + span - dev->blockSize + (size_t) q, 0,
+        dev->blockSize - (size_t) q);
+      simulateTransfer(dev, 'R', start + (int64_t) (span - dev->blockSize),
+        dev->blockSize);
+    }
+
+    memcpy(dev->buf + skip, ptr, chunk);
+    if (rawWrite(dev, dev->buf, span, start) != (int64_t) span)
+      return -1;
+    simulateTransfer(dev, 'W', start, span);
+
+    dev->pos += (int64_t) chunk;
+    ptr += chunk;
+    len -= chunk;
+  }
+  return 0;
+}
+
+size_t fs_read(void *ptr, size_t size, size_t n, struct sDevice *dev) {
+  size_t len = size * n;
+
+  traceTransfer(dev, 'R', len);
+  if (dev->buf) {
+    if (directRead(dev, ptr, len))
+      return 0;
+  }
+  else {
+    if (rawRead(dev, ptr, len, dev->pos) != (int64_t) len)
+      return 0;
+    simulateTransfer(dev, 'R', dev->pos, len);
+    dev->pos += (int64_t) len;
+  }
+  addProgress(bytesRead, len);
+  return n;
+}
+
+size_t fs_write(const void *ptr, size_t size, size_t n, struct sDevice *dev) {
+  size_t len = size * n;
+
+  traceTransfer(dev, 'W', len);
+  if (dev->buf) {
+    if (directWrite(dev, ptr, len))
+      return 0;
+  }
+  else {
+    if (rawWrite(dev, ptr, len, dev->pos) != (int64_t) len)
+      return 0;
+    simulateTransfer(dev, 'W', dev->pos, len);
+    dev->pos += (int64_t) len;
+  }
+  addProgress(bytesWritten, len);
+  return n;
+}
+
+int fs_sync(struct sDevice *dev) {
+  return syncDevice(dev);
+}
+
+int fs_close(struct sDevice *dev) {
+  int ret;
+
+  closeTrace(dev);
+  ret = closeDevice(dev);
+  freeAligned(dev->buf);
+  free(dev);
+  return ret;
+}
+
+int fs_setPartition(struct sDevice *dev, int64_t offset, int64_t size) {
+  // positions stay absolute, so direct I/O is aligned to device blocks
+  if (offset < 0 || size < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  dev->base = offset;
+  dev->size = size;
+  return fs_seek(dev, 0, SEEK_SET);
+}
+
+int fs_dropCache(struct sDevice *dev) {
+  // direct I/O bypasses the cache anyway
+  if (dev->buf)
+    return 0;
+  return dropCache(dev);
+}
+
+uint32_t fs_blockSize(const struct sDevice *dev) {
+  return dev->blockSize;
+}
+
+void fs_simulate(struct sDevice *dev, const struct sMediaModel *model) {
+  dev->simulated = 1;
+  dev->model = *model;
+  if (!dev->model.openBlocks)
+    dev->model.openBlocks = 1;
+  else if (dev->model.openBlocks > MEDIA_MAX_OPEN_BLOCKS)
+    dev->model.openBlocks = MEDIA_MAX_OPEN_BLOCKS;
+  memset(&dev->stats, 0, sizeof(dev->stats));
+  dev->next = dev->pos;
+  dev->opened = 0;
 }
 
-int fs_close(FILE *file) {
-  return CloseHandle(file);
+void fs_mediaStats(const struct sDevice *dev, struct sMediaStats *stats) {
+  *stats = dev->stats;
 }
@@ -5,12 +5,68 @@
 #ifndef __fileio_h__
 #define __fileio_h__
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
-FILE *fs_open(char *path, char *mode);
-int fs_seek(FILE *stream, long offset, int whence);
-size_t fs_read(void *ptr, size_t size, size_t n, FILE *stream);
-size_t fs_write(const void *ptr, size_t size, size_t n, FILE *stream);
-int fs_close(FILE *file);
+// device or image file, opened by fs_open()
+struct sDevice;
+
+// flags of fs_open()
+#define FS_DIRECT 0x01 // bypass the system cache with block aligned I/O
+#define FS_SHARED 0x02 // other partitions of the device may be open, too
+
+// size of the block aligned buffer of devices that are opened for direct I/O
+#define DIRECT_BUFFER_SIZE 0x100000
+
+// block size of direct I/O if a device doesn't report its logical block size
+#define DIRECT_BLOCK_SIZE 512
+
+// most erase blocks a simulated device keeps open for writing
+#define MEDIA_MAX_OPEN_BLOCKS 16
+
+struct sMediaModel {
+  /*
+   * latency model of a simulated device like a cheap SD card, terms that are
+   * zero cost nothing
+   */
+  unsigned long long request; // microseconds of every request
+  unsigned long long seek; // extra microseconds of random requests
+  unsigned long long eraseBlock; // bytes of an erase block
+  unsigned openBlocks; // erase blocks that are written without being copied
+  unsigned long long readRate, writeRate; // bytes per second
+};
+
+struct sMediaStats {
+  /*
+   * simulated time and requests of a device
+   */
+  double time; // seconds
+  unsigned long long requests, random; // all and not sequential requests
+  unsigned long long erases; // erase blocks that were copied for writes
+};
+
+struct sDevice *fs_open(const char *path, const char *mode, int flags);
+int fs_seek(struct sDevice *dev, int64_t offset, int whence);
+size_t fs_read(void *ptr, size_t size, size_t n, struct sDevice *dev);
+size_t fs_write(const void *ptr, size_t size, size_t n, struct sDevice *dev);
+int fs_sync(struct sDevice *dev);
+int fs_close(struct sDevice *dev);
+
+// restrict a device to the size bytes at offset, all further seeks are
+// relative to offset
+int fs_setPartition(struct sDevice *dev, int64_t offset, int64_t size);
+
+// drop cached data of a device, so it is read from the device again
+int fs_dropCache(struct sDevice *dev);
+
+// returns the logical block size that direct I/O is aligned to
+uint32_t fs_blockSize(const struct sDevice *dev);
+
+// charge all further transfers of a device with the latency of model
+void fs_simulate(struct sDevice *dev, const struct sMediaModel *model);
+
+// returns the simulated time and requests of a device
+void fs_mediaStats(const struct sDevice *dev, struct sMediaStats *stats);
 
 #endif // __fileio_h__
@@ -0,0 +1,145 @@
+/*
+ * This file contains/describes the map of free clusters that is used to
+ * find contiguous runs of free clusters when cluster chains are relocated.
+ */
+
+#include "freespace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "FAT32.h"
+#include "fileio.h"
+
+int loadFreeSpace(struct sFileSystem *fs, struct sFreeSpace *space) {
+  /*
+   * read the free clusters from the first FAT32
+   */
+
+  uint32_t FAT32SizeInBytes, chunkSize, pos, len, j, cluster;
+  int64_t BSOffset;
+
+  uint32_t *chunk;
+
+  memset(space, 0, sizeof(*space));
+
+  FAT32SizeInBytes = fs->FAT32Size * fs->sectorSize;
+  space->clusters = (uint32_t) fs->clusters + 2;
+  if (space->clusters > FAT32SizeInBytes / 4)
+    space->clusters = FAT32SizeInBytes / 4;
+
+  space->map = calloc(space->clusters / 8 + 1, 1);
+  if (!space->map) {
+    stderror();
+    return -1;
+  }
+
+  // chunks are a multiple of the sector size
+  chunkSize = FAT32_CHECK_CHUNK_SIZE / fs->sectorSize * fs->sectorSize;
+  if (!chunkSize)
+    chunkSize = fs->sectorSize;
+
+  chunk = malloc(chunkSize);
+  if (!chunk) {
+    stderror();
+    freeFreeSpace(space);
+    return -1;
+  }
+
+  BSOffset = (int64_t) fs->bs.BS_RsvdSecCnt * fs->bs.BS_BytesPerSec;
+  if (fs_seek(fs->fd, BSOffset, SEEK_SET) == -1) {
+    myerror("Seek error!");
+    free(chunk);
+    freeFreeSpace(space);
+    return -1;
+  }
+
+  for (pos = 0; pos / 4 < space->clusters; pos += len) {
+    len = FAT32SizeInBytes - pos < chunkSize ? FAT32SizeInBytes - pos :
+      chunkSize;
+
+    if (!fs_read(chunk, 1, len, fs->fd)) {
+      myerror("Failed to read from file!");
+      free(chunk);
+      freeFreeSpace(space);
+      return -1;
+    }
+
+    for (j = 0; j < len / 4; j++) {
+      cluster = pos / 4 + j;
+      // the first two entries are reserved
+      if (cluster < 2 || cluster >= space->clusters)
+        continue;
+      if (!(chunk[j] & 0x0FFFFFFF)) {
+        space->map[cluster / 8] |= (unsigned char) (1U << cluster % 8);
+        space->free++;
+      }
+    }
+  }
+
+  free(chunk);
+
+  return 0;
+}
+
+uint32_t findFreeRun(const struct sFreeSpace *space, uint32_t len) {
+  /*
+   * find the first run of len free clusters, returns 0 if there is none
+   */
+
+  uint32_t cluster = 2, start = 0, found = 0;
+
+  if (!len || len > space->free)
+    return 0;
+
+  while (cluster < space->clusters) {
+    // skip eight used clusters at once
+    if (!(cluster % 8) && !space->map[cluster / 8]) {
+      found = 0;
+      cluster += 8;
+      continue;
+    }
+
+    if (space->map[cluster / 8] & 1U << cluster % 8) {
+      if (!found)
+        start = cluster;
+      if (++found == len)
+        return start;
+    }
+    else
+      found = 0;
+    cluster++;
+  }
+
+  return 0;
+}
+
+void markClusters(struct sFreeSpace *space, uint32_t start, uint32_t len,
+  int free) {
+  /*
+   * mark len clusters starting with start as used or free
+   */
+
+  uint32_t cluster;
+
+  for (cluster = start; cluster < start + len && cluster < space->clusters;
+    cluster++) {
+    if (free && !(space->map[cluster / 8] & 1U << cluster % 8)) {
+      space->map[cluster / 8] |= (unsigned char) (1U << cluster % 8);
+      space->free++;
+    }
+    else if (!free && space->map[cluster / 8] & 1U << cluster % 8) {
+      space->map[cluster / 8] &= (unsigned char) ~(1U << cluster % 8);
+      space->free--;
+    }
+  }
+}
+
+void freeFreeSpace(struct sFreeSpace *space) {
+  /*
+   * free map of free clusters
+   */
+
+  free(space->map);
+  memset(space, 0, sizeof(*space));
+}
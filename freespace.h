@@ -0,0 +1,35 @@
+/*
+ * This file contains/describes the map of free clusters that is used to
+ * find contiguous runs of free clusters when cluster chains are relocated.
+ */
+
+#ifndef __freespace_h__
+#define __freespace_h__
+
+#include <stdint.h>
+
+struct sFileSystem;
+
+struct sFreeSpace {
+  /*
+   * one bit per cluster, bits of free clusters are set
+   */
+  unsigned char *map;
+  uint32_t clusters; // number of entries including the two reserved ones
+  uint32_t free; // number of free clusters
+};
+
+// read the free clusters from the first FAT32
+int loadFreeSpace(struct sFileSystem *fs, struct sFreeSpace *space);
+
+// find the first run of len free clusters, returns 0 if there is none
+uint32_t findFreeRun(const struct sFreeSpace *space, uint32_t len);
+
+// mark len clusters starting with start as used or free
+void markClusters(struct sFreeSpace *space, uint32_t start, uint32_t len,
+  int free);
+
+// free map of free clusters
+void freeFreeSpace(struct sFreeSpace *space);
+
+#endif // __freespace_h__
@@ -0,0 +1,535 @@
+/*
+ * This file contains/describes the directory tree index. An index holds the
+ * listed directories and their entries, so listings and searches can be
+ * answered from a memory mapped file instead of rescanning the device.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "clusterchain.h"
+#include "dirfilter.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "listing.h"
+#include "options.h"
+#include "sort.h"
+
+int growIndexArray(void **array, size_t *size, size_t len, size_t elemSize) {
+  /*
+   * make room for one more element in an array of the index builder
+   */
+
+  void *tmp;
+  size_t newSize;
+
+  if (len < *size)
+    return 0;
+
+  newSize = *size ? *size * 2 : 256;
+  tmp = realloc(*array, newSize * elemSize);
+  if (!tmp) {
+    stderror();
+    return -1;
+  }
+  *array = tmp;
+  *size = newSize;
+
+  return 0;
+}
+
+int addIndexString(struct sIndexBuilder *ib, const char *str,
+  uint32_t *offset) {
+  /*
+   * append a string to the string pool
+   */
+
+  size_t len = strlen(str) + 1, newSize;
+  char *tmp;
+
+  if (ib->poolLen + len > UINT32_MAX) {
+    myerror("String pool of index is too large!");
+    return -1;
+  }
+
+  if (ib->poolLen + len > ib->poolSize) {
+    newSize = ib->poolSize ? ib->poolSize : 65536;
+    while (newSize < ib->poolLen + len)
+      newSize *= 2;
+    tmp = realloc(ib->pool, newSize);
+    if (!tmp) {
+      stderror();
+      return -1;
+    }
+    ib->pool = tmp;
+    ib->poolSize = newSize;
+  }
+
+  memcpy(ib->pool + ib->poolLen, str, len);
+  *offset = (uint32_t) ib->poolLen;
+  ib->poolLen += len;
+
+  return 0;
+}
+
+int addIndexDirectory(struct sIndexBuilder *ib, const char *path,
+  unsigned cluster, int clen) {
+  /*
+   * add a listed directory to the index
+   */
+
+  struct sIndexDir *dir;
+
+  if (growIndexArray((void **) &ib->dirs, &ib->dirSize, ib->dirLen,
+      sizeof(struct sIndexDir))) {
+    myerror("Failed to grow directory table!");
+    return -1;
+  }
+
+  dir = &ib->dirs[ib->dirLen];
+  if (addIndexString(ib, path, &dir->path)) {
+    myerror("Failed to add path to string pool!");
+    return -1;
+  }
+  dir->cluster = cluster;
+  dir->clen = (uint32_t) clen;
+  dir->entry = (uint32_t) ib->entryLen;
+  dir->entries = 0;
+  ib->dirLen++;
+
+  return 0;
+}
+
+int addIndexEntry(struct sIndexBuilder *ib, const char *lname,
+  const char *sname, const struct sShortDirEntry *sde) {
+  /*
+   * add an entry of the last added directory to the index
+   */
+
+  struct sIndexEntry *entry;
+
+  if (!ib->dirLen || ib->entryLen >= UINT32_MAX) {
+    myerror("Failed to add entry to index!");
+    return -1;
+  }
+
+  if (growIndexArray((void **) &ib->entries, &ib->entrySize, ib->entryLen,
+      sizeof(struct sIndexEntry))) {
+    myerror("Failed to grow entry table!");
+    return -1;
+  }
+
+  entry = &ib->entries[ib->entryLen];
+  if (addIndexString(ib, lname, &entry->name) ||
+    addIndexString(ib, sname, &entry->sname)) {
+    myerror("Failed to add names to string pool!");
+    return -1;
+  }
+  entry->cluster = (uint32_t) sde->DIR_FstClusHI << 16 | sde->DIR_FstClusLO;
+  entry->size = sde->DIR_FileSize;
+  entry->attr = sde->DIR_Atrr;
+  entry->crtTimeTenth = sde->DIR_CrtTimeTenth;
+  entry->crtTime = sde->DIR_CrtTime;
+  entry->crtDate = sde->DIR_CrtDate;
+  entry->wrtTime = sde->DIR_WrtTime;
+  entry->wrtDate = sde->DIR_WrtDate;
+  entry->accDate = sde->DIR_LstAccDate;
+  ib->entryLen++;
+  ib->dirs[ib->dirLen - 1].entries++;
+
+  return 0;
+}
+
+int writeIndex(const struct sIndexBuilder *ib, struct sFileSystem *fs,
+  const char *filename) {
+  /*
+   * write the index of a file system to a file
+   */
+
+  struct sIndexHeader header;
+  FILE *fd;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.volID = fs->bs.BS_VolID;
+  if (hashFAT32(fs, &header.FATHash)) {
+    myerror("Failed to hash FAT32!");
+    return -1;
+  }
+  if (hashRootDirectory(fs, &header.rootHash)) {
+    myerror("Failed to hash root directory!");
+    return -1;
+  }
+  header.dirs = (uint32_t) ib->dirLen;
+  header.entries = (uint32_t) ib->entryLen;
+  header.poolSize = (uint32_t) ib->poolLen;
+  header.clusterSize = fs->clusterSize;
+
+  fd = fopen(filename, "wb");
+  if (!fd) {
+    stderror();
+    myerror("Failed to open index '%s'!", filename);
+    return -1;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, fd) != 1 ||
+    fwrite(ib->dirs, sizeof(struct sIndexDir), ib->dirLen, fd) !=
+    ib->dirLen ||
+    fwrite(ib->entries, sizeof(struct sIndexEntry), ib->entryLen, fd) !=
+    ib->entryLen ||
+    fwrite(ib->pool, 1, ib->poolLen, fd) != ib->poolLen) {
+    stderror();
+    myerror("Failed to write index '%s'!", filename);
+    fclose(fd);
+    return -1;
+  }
+
+  if (fclose(fd)) {
+    stderror();
+    myerror("Failed to close index '%s'!", filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+void freeIndexBuilder(struct sIndexBuilder *ib) {
+  /*
+   * free the index that was built so far
+   */
+
+  free(ib->dirs);
+  free(ib->entries);
+  free(ib->pool);
+  memset(ib, 0, sizeof(*ib));
+}
+
+int validateIndex(struct sIndex *index) {
+  /*
+   * check that all tables and string offsets lie inside the mapped file
+   */
+
+  const struct sIndexHeader *header = index->map;
+  uint64_t size;
+  uint32_t j;
+
+  if (index->size < sizeof(struct sIndexHeader) ||
+    memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))) {
+    myerror("File is not an index!");
+    return -1;
+  }
+  if (header->version != INDEX_VERSION) {
+    myerror("Unsupported index version %u!", header->version);
+    return -1;
+  }
+
+  size = sizeof(struct sIndexHeader) +
+    (uint64_t) header->dirs * sizeof(struct sIndexDir) +
+    (uint64_t) header->entries * sizeof(struct sIndexEntry) +
+    header->poolSize;
+  if (size > index->size) {
+    myerror("Index is truncated!");
+    return -1;
+  }
+
+  index->header = header;
+  index->dirs = (const struct sIndexDir *) (header + 1);
+  index->entries = (const struct sIndexEntry *) (index->dirs + header->dirs);
+  index->pool = (const char *) (index->entries + header->entries);
+
+  // all strings are terminated by the last byte of the pool
+  if ((header->dirs || header->entries) &&
+    (!header->poolSize || index->pool[header->poolSize - 1])) {
+    myerror("Corrupt string pool in index!");
+    return -1;
+  }
+
+  for (j = 0; j < header->dirs; j++) {
+    if (index->dirs[j].path >= header->poolSize ||
+      index->dirs[j].entry > header->entries ||
+      index->dirs[j].entries > header->entries - index->dirs[j].entry) {
+      myerror("Corrupt directory %u in index!", j);
+      return -1;
+    }
+  }
+  for (j = 0; j < header->entries; j++) {
+    if (index->entries[j].name >= header->poolSize ||
+      index->entries[j].sname >= header->poolSize) {
+      myerror("Corrupt entry %u in index!", j);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int openIndex(const char *filename, struct sIndex *index) {
+  /*
+   * map an index file into memory and validate its structure
+   */
+
+#ifdef _WIN32
+  HANDLE file, mapping;
+  LARGE_INTEGER size;
+
+  memset(index, 0, sizeof(*index));
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (file == INVALID_HANDLE_VALUE) {
+    myerror("Failed to open index '%s'!", filename);
+    return -1;
+  }
+  if (!GetFileSizeEx(file, &size) ||
+    (uint64_t) size.QuadPart < sizeof(struct sIndexHeader)) {
+    myerror("File '%s' is not an index!", filename);
+    CloseHandle(file);
+    return -1;
+  }
+
+  // the view keeps the mapping and the file open
+  mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+  CloseHandle(file);
+  if (!mapping) {
+    myerror("Failed to map index '%s'!", filename);
+    return -1;
+  }
+  index->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!index->map) {
+    myerror("Failed to map index '%s'!", filename);
+    return -1;
+  }
+  index->size = (size_t) size.QuadPart;
+#else
+  struct stat st;
+  void *map;
+  int fd;
+
+  memset(index, 0, sizeof(*index));
+
+  fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    stderror();
+    myerror("Failed to open index '%s'!", filename);
+    return -1;
+  }
+  if (fstat(fd, &st) ||
+    (uint64_t) st.st_size < sizeof(struct sIndexHeader)) {
+    myerror("File '%s' is not an index!", filename);
+    close(fd);
+    return -1;
+  }
+
+  // the mapping stays valid after the file is closed
+  map = mmap(0, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    stderror();
+    myerror("Failed to map index '%s'!", filename);
+    return -1;
+  }
+  index->map = map;
+  index->size = (size_t) st.st_size;
+#endif
+
+  if (validateIndex(index)) {
+    myerror("Invalid index '%s'!", filename);
+    closeIndex(index);
+    return -1;
+  }
+
+  return 0;
+}
+
+int hashRootDirectory(struct sFileSystem *fs, uint64_t *hash) {
+  /*
+   * calculates the FNV-1a hash of the root directory clusters, it changes
+   * whenever entries of the root directory are renamed, added, changed or
+   * moved
+   */
+
+  struct sClusterChain *chain, *tmp;
+  const unsigned char *data;
+  unsigned j;
+
+  chain = newClusterChain();
+  if (!chain) {
+    myerror("Failed to generate new ClusterChain!");
+    return -1;
+  }
+  if (getClusterChain(fs, fs->bs.BS_RootClus, chain) == -1) {
+    myerror("Failed to get cluster chain!");
+    freeClusterChain(chain);
+    return -1;
+  }
+
+  *hash = 0xcbf29ce484222325ULL;
+  for (tmp = chain->next; tmp; tmp = tmp->next) {
+    // no directory is parsed while the index is written or checked
+    if (readCluster(fs, tmp->cluster, fs->clusterBuf)) {
+      myerror("Failed to read cluster!");
+      freeClusterChain(chain);
+      return -1;
+    }
+    data = (const unsigned char *) fs->clusterBuf;
+    for (j = 0; j < fs->clusterSize; j++)
+      *hash = (*hash ^ data[j]) * 0x100000001b3ULL;
+  }
+
+  freeClusterChain(chain);
+
+  return 0;
+}
+
+int checkIndex(struct sFileSystem *fs, const struct sIndex *index) {
+  /*
+   * check whether an index is up to date, returns 1 for stale indexes, the
+   * FAT32 hash detects allocated and freed clusters and the root directory
+   * hash any change of the root directory, changes of sub directories that
+   * keep their clusters are not detected
+   */
+
+  uint64_t hash;
+
+  if (index->header->volID != fs->bs.BS_VolID ||
+    index->header->clusterSize != fs->clusterSize)
+    return 1;
+
+  if (hashFAT32(fs, &hash)) {
+    myerror("Failed to hash FAT32!");
+    return -1;
+  }
+  if (hash != index->header->FATHash)
+    return 1;
+
+  if (hashRootDirectory(fs, &hash)) {
+    myerror("Failed to hash root directory!");
+    return -1;
+  }
+
+  return hash != index->header->rootHash;
+}
+
+int listIndex(struct sListing *listing, const struct sIndex *index) {
+  /*
+   * list directories and entries of an index, directories are selected by
+   * the directory filter like during a traversal of the file system
+   */
+
+  const struct sOptions *opts = listing->opts;
+  struct sDirFilterStack stack = { 0 };
+  struct sDirFilterState state, substate;
+  struct sShortDirEntry sde;
+  const struct sIndexDir *dir;
+  const struct sIndexEntry *entry;
+  const char *path;
+  char *components = 0, *name, *end, *tmp;
+  size_t len, size = 0;
+  uint32_t j, k;
+  int visible;
+
+  memset(&sde, 0, sizeof(sde));
+
+  for (j = 0; j < index->header->dirs; j++) {
+    dir = &index->dirs[j];
+    path = index->pool + dir->path;
+
+    // split path into components
+    len = strlen(path) + 1;
+    if (len > size) {
+      tmp = realloc(components, len);
+      if (!tmp) {
+        stderror();
+        free(components);
+        freeDirFilterStack(&stack);
+        return -1;
+      }
+      components = tmp;
+      size = len;
+    }
+    memcpy(components, path, len);
+
+    /*
+     * a directory is visited if the filter descends into it and all of its
+     * parents
+     */
+    stack.len = 0;
+    if (enterRootDirFilter(opts->dirFilter, &stack, &state)) {
+      myerror("Failed to initialize directory filter!");
+      free(components);
+      freeDirFilterStack(&stack);
+      return -1;
+    }
+    visible = descendsDirFilter(opts->dirFilter, &state);
+    for (name = components + 1; visible && (end = strchr(name, '/'));
+      name = end + 1) {
+      *end = 0;
+      if (enterDirFilter(opts->dirFilter, &stack, &state, name, &substate)) {
+        myerror("Failed to advance directory filter!");
+        free(components);
+        freeDirFilterStack(&stack);
+        return -1;
+      }
+      state = substate;
+      visible = descendsDirFilter(opts->dirFilter, &state);
+    }
+
+    if (!visible || !matchesDirFilter(opts->dirFilter, &state))
+      continue;
+
+    listDirectory(listing, path, dir->cluster, (int) dir->clen,
+      index->header->clusterSize);
+
+    for (k = 0; k < dir->entries; k++) {
+      entry = &index->entries[dir->entry + k];
+      sde.DIR_Atrr = entry->attr;
+      sde.DIR_CrtTimeTenth = entry->crtTimeTenth;
+      sde.DIR_CrtTime = entry->crtTime;
+      sde.DIR_CrtDate = entry->crtDate;
+      sde.DIR_LstAccDate = entry->accDate;
+      sde.DIR_FstClusHI = (uint16_t) (entry->cluster >> 16);
+      sde.DIR_WrtTime = entry->wrtTime;
+      sde.DIR_WrtDate = entry->wrtDate;
+      sde.DIR_FstClusLO = (uint16_t) entry->cluster;
+      sde.DIR_FileSize = entry->size;
+      listEntry(listing, path, index->pool + entry->name,
+        index->pool + entry->sname, &sde);
+    }
+  }
+
+  free(components);
+  freeDirFilterStack(&stack);
+
+  return 0;
+}
+
+void closeIndex(struct sIndex *index) {
+  /*
+   * unmap index
+   */
+
+  if (index->map) {
+#ifdef _WIN32
+    UnmapViewOfFile(index->map);
+#else
+    munmap(index->map, index->size);
+#endif
+  }
+  memset(index, 0, sizeof(*index));
+}
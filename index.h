@@ -0,0 +1,113 @@
+/*
+ * This file contains/describes the directory tree index. An index holds the
+ * listed directories and their entries, so listings and searches can be
+ * answered from a memory mapped file instead of rescanning the device.
+ *
+ * Layout of an index file (little endian):
+ *   struct sIndexHeader
+ *   struct sIndexDir[dirs]
+ *   struct sIndexEntry[entries]
+ *   string pool with null terminated names and paths
+ */
+
+#ifndef __index_h__
+#define __index_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct sFileSystem;
+struct sListing;
+struct sShortDirEntry;
+
+#define INDEX_MAGIC "ROSSOIDX"
+#define INDEX_VERSION 2
+
+struct sIndexHeader {
+  char magic[8]; // INDEX_MAGIC without terminating null
+  uint32_t version; // INDEX_VERSION
+  uint32_t volID; // BS_VolID of the indexed file system
+  uint64_t FATHash; // hash of the first FAT32, see hashFAT32()
+  uint64_t rootHash; // hash of the root directory, see hashRootDirectory()
+  uint32_t dirs; // number of directories
+  uint32_t entries; // number of directory entries
+  uint32_t poolSize; // size of the string pool in bytes
+  uint32_t clusterSize; // cluster size in bytes
+};
+
+struct sIndexDir {
+  uint32_t path; // offset of path in string pool
+  uint32_t cluster; // start cluster
+  uint32_t clen; // length of cluster chain
+  uint32_t entry; // first entry of directory
+  uint32_t entries; // number of entries
+};
+
+struct sIndexEntry {
+  uint32_t name; // offset of long name in string pool, empty if missing
+  uint32_t sname; // offset of short name in string pool
+  uint32_t cluster; // start cluster
+  uint32_t size; // file size in bytes
+  uint8_t attr; // file attributes
+  uint8_t crtTimeTenth;
+  uint16_t crtTime, crtDate, wrtTime, wrtDate, accDate;
+};
+
+struct sIndexBuilder {
+  /*
+   * index that is built while directories are listed, every traversal has
+   * a builder of its own
+   */
+  struct sIndexDir *dirs;
+  size_t dirLen, dirSize;
+  struct sIndexEntry *entries;
+  size_t entryLen, entrySize;
+  char *pool;
+  size_t poolLen, poolSize;
+};
+
+struct sIndex {
+  /*
+   * memory mapped index
+   */
+  const struct sIndexHeader *header;
+  const struct sIndexDir *dirs;
+  const struct sIndexEntry *entries;
+  const char *pool;
+  void *map;
+  size_t size;
+};
+
+// add a listed directory to the index
+int addIndexDirectory(struct sIndexBuilder *ib, const char *path,
+  unsigned cluster, int clen);
+
+// add an entry of the last added directory to the index
+int addIndexEntry(struct sIndexBuilder *ib, const char *lname,
+  const char *sname, const struct sShortDirEntry *sde);
+
+// write the index of a file system to a file
+int writeIndex(const struct sIndexBuilder *ib, struct sFileSystem *fs,
+  const char *filename);
+
+// free the index that was built so far
+void freeIndexBuilder(struct sIndexBuilder *ib);
+
+// map an index file into memory and validate its structure
+int openIndex(const char *filename, struct sIndex *index);
+
+// calculates a hash of the root directory clusters
+int hashRootDirectory(struct sFileSystem *fs, uint64_t *hash);
+
+// check whether an index is up to date, returns 1 for stale indexes, only
+// changes of the FAT32 or of the root directory are detected
+int checkIndex(struct sFileSystem *fs, const struct sIndex *index);
+
+// list directories and entries of an index that the directory filter of the
+// options of a listing selects
+int listIndex(struct sListing *listing, const struct sIndex *index);
+
+// unmap index
+void closeIndex(struct sIndex *index);
+
+#endif // __index_h__
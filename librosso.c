@@ -0,0 +1,507 @@
+/*
+ * This file contains/describes the library interface of rosso. All state of
+ * a device lives in a context, so several devices may be listed and sorted
+ * by one program, each context by one thread at a time. The command line
+ * program is built on top of it.
+ */
+
+#include "librosso.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clusterchain.h"
+#include "dirfilter.h"
+#include "entrylist.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "freespace.h"
+#include "index.h"
+#include "listing.h"
+#include "partition.h"
+#include "progress.h"
+#include "sort.h"
+#include "verify.h"
+
+struct rosso_ctx {
+  /*
+   * a device that is open for listing or sorting
+   */
+  const struct sOptions *opts;
+  char *device;
+  char *name; // device or partition in messages
+  struct sFileSystem fs;
+  FILE *out; // output of listings
+  struct sListing listing;
+  struct rosso_stats stats;
+};
+
+struct sListDirCallback {
+  /*
+   * callback of rosso_list_dir() and its argument
+   */
+  int (*callback)(void *arg, const struct rosso_entry *entry);
+  void *arg;
+};
+
+struct rosso_ctx *rosso_open(const char *device,
+  const struct sOptions *opts) {
+  /*
+   * opens a FAT32 device with options that must stay valid until
+   * rosso_close()
+   */
+  return rosso_open_partition(device, 0, opts);
+}
+
+struct rosso_ctx *rosso_open_partition(const char *device,
+  const struct sPartition *part, const struct sOptions *opts) {
+  /*
+   * opens the FAT32 file system of a partition in place, messages name the
+   * partition like "disk.img#2"
+   */
+
+  struct rosso_ctx *ctx;
+
+  ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) {
+    stderror();
+    return 0;
+  }
+  ctx->opts = opts;
+  ctx->out = stdout;
+  ctx->device = malloc(strlen(device) + 1);
+  ctx->name = malloc(strlen(device) + 12);
+  if (!ctx->device || !ctx->name) {
+    stderror();
+    free(ctx->device);
+    free(ctx->name);
+    free(ctx);
+    return 0;
+  }
+  strcpy(ctx->device, device);
+  if (part)
+    sprintf(ctx->name, "%s#%u", device, part->number);
+  else
+    strcpy(ctx->name, device);
+
+  if (openFileSystem(ctx->device, opts->list || opts->info ? "rb" : "r+b",
+      opts->direct ? FS_DIRECT : 0, part,
+      opts->simulate ? &opts->mediaModel : 0, &ctx->fs)) {
+    myerror("Failed to open file system!");
+    free(ctx->device);
+    free(ctx->name);
+    free(ctx);
+    return 0;
+  }
+
+  if (checkFAT32s(&ctx->fs)) {
+    myerror("FAT32s don't match! Please repair file system!");
+    rosso_close(ctx);
+    return 0;
+  }
+
+  if (ctx->fs.FSType == -1) {
+    myerror("File system not FAT32!");
+    rosso_close(ctx);
+    return 0;
+  }
+
+  // checksums of written directory clusters are kept for verification
+  ctx->fs.verify.enabled = opts->verify && !opts->list;
+
+  return ctx;
+}
+
+int rosso_partitions(const char *device, struct sPartition *parts, int max) {
+  /*
+   * reads the partition table of a device, returns the number of FAT32
+   * partitions
+   */
+
+  struct sDevice *dev;
+  int count;
+
+  dev = fs_open(device, "rb", FS_SHARED);
+  if (!dev) {
+    stderror();
+    myerror("Failed to open device '%s'!", device);
+    return -1;
+  }
+
+  count = readPartitions(dev, parts, max);
+  if (count == -1)
+    myerror("Failed to read partition table of '%s'!", device);
+
+  fs_close(dev);
+
+  return count;
+}
+
+void rosso_set_output(struct rosso_ctx *ctx, FILE *out) {
+  /*
+   * listings of rosso_sort_tree() are written to out instead of stdout
+   */
+  ctx->out = out;
+}
+
+int readDirectory(struct sFileSystem *fs, unsigned cluster, const char *path,
+  struct sDirEntryList *list, int (*visit)(void *arg, const char *path,
+    const char *lname, const char *sname, const struct sShortDirEntry *sde),
+  void *arg) {
+  /*
+   * puts the sub directories of a directory to list and passes all of its
+   * entries to visit, returns the value of parseClusterChain()
+   */
+
+  struct sClusterChain *chain;
+  int direntries, ret;
+  unsigned dropped;
+
+  chain = newClusterChain();
+  if (!chain) {
+    myerror("Failed to generate new ClusterChain!");
+    return -1;
+  }
+
+  if (getClusterChain(fs, cluster, chain) == -1) {
+    myerror("Failed to get cluster chain!");
+    freeClusterChain(chain);
+    return -1;
+  }
+
+  ret = parseClusterChain(fs, chain, list, &direntries, &dropped, path,
+    PARSE_LIST, visit, arg);
+  if (ret == -1)
+    myerror("Failed to parse cluster chain!");
+
+  freeClusterChain(chain);
+
+  return ret;
+}
+
+int equalsEntryName(const char *name, const char *str, size_t len) {
+  /*
+   * compares an entry name with a path component ignoring ASCII case,
+   * FAT32 names don't differ in case only
+   */
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (tolower((unsigned char) name[i]) != tolower((unsigned char) str[i]))
+      return 0;
+  }
+  return !name[len];
+}
+
+int findDirectory(struct sFileSystem *fs, const char *path,
+  unsigned *cluster) {
+  /*
+   * looks up the start cluster of directory path component by component,
+   * starting at the root directory, "." and ".." are not resolved
+   */
+
+  struct sDirEntryList *list, *tmp;
+  const char *name;
+  char *dir;
+  size_t len;
+  unsigned found;
+
+  *cluster = fs->bs.BS_RootClus;
+
+  // the directory that is read, for error messages
+  dir = malloc(strlen(path) + 2);
+  if (!dir) {
+    stderror();
+    return -1;
+  }
+  strcpy(dir, "/");
+
+  for (name = path; *name; name += len) {
+    while (*name == '/')
+      name++;
+    len = strcspn(name, "/");
+    if (!len)
+      break;
+
+    if ((len == 1 && name[0] == '.') ||
+      (len == 2 && name[0] == '.' && name[1] == '.')) {
+      myerror("Path component '%.*s' of '%s' is not supported!", (int) len,
+        name, path);
+      free(dir);
+      return -1;
+    }
+
+    list = newDirEntryList();
+    if (!list) {
+      myerror("Failed to generate new dirEntryList!");
+      free(dir);
+      return -1;
+    }
+    if (readDirectory(fs, *cluster, dir, list, 0, 0)) {
+      freeDirEntryList(list);
+      free(dir);
+      return -1;
+    }
+
+    // only sub directories match, never files, deleted entries, "." or ".."
+    found = 0;
+    for (tmp = list->next; tmp; tmp = tmp->next) {
+      if (tmp->rank != RANK_ENTRY || !(tmp->sde->DIR_Atrr & ATTR_DIRECTORY))
+        continue;
+      if ((tmp->lname && tmp->lname[0] &&
+          equalsEntryName(tmp->lname, name, len)) ||
+        equalsEntryName(tmp->sname, name, len)) {
+        found = (unsigned) tmp->sde->DIR_FstClusHI << 16 |
+          tmp->sde->DIR_FstClusLO;
+        break;
+      }
+    }
+    freeDirEntryList(list);
+
+    if (!found) {
+      myerror("Directory '%.*s' not found!", (int) (name + len - path), path);
+      free(dir);
+      return -1;
+    }
+    *cluster = found;
+
+    // the next component is looked up in this directory
+    memcpy(dir, path, (size_t) (name + len - path));
+    dir[name + len - path] = '/';
+    dir[name + len - path + 1] = 0;
+  }
+
+  free(dir);
+
+  return 0;
+}
+
+int visitListedEntry(void *arg, const char *path, const char *lname,
+  const char *sname, const struct sShortDirEntry *sde) {
+  /*
+   * passes a parsed entry to the callback of rosso_list_dir()
+   */
+  const struct sListDirCallback *cb = arg;
+  struct rosso_entry entry;
+
+  (void) path;
+
+  entry.name = lname[0] ? lname : sname;
+  entry.shortName = sname;
+  entry.attributes = sde->DIR_Atrr;
+  entry.size = sde->DIR_FileSize;
+  entry.cluster = (unsigned) sde->DIR_FstClusHI << 16 | sde->DIR_FstClusLO;
+  entry.date = sde->DIR_WrtDate;
+  entry.time = sde->DIR_WrtTime;
+
+  return cb->callback(cb->arg, &entry);
+}
+
+int rosso_list_dir(struct rosso_ctx *ctx, const char *path,
+  int (*callback)(void *arg, const struct rosso_entry *entry), void *arg) {
+  /*
+   * calls callback for every entry of the directory path in the order on
+   * the device, "." and ".." are skipped
+   */
+
+  struct sListDirCallback cb;
+  struct sDirEntryList *list;
+  unsigned cluster;
+  int ret;
+
+  if (findDirectory(&ctx->fs, path, &cluster))
+    return -1;
+
+  list = newDirEntryList();
+  if (!list) {
+    myerror("Failed to generate new dirEntryList!");
+    return -1;
+  }
+
+  cb.callback = callback;
+  cb.arg = arg;
+  ret = readDirectory(&ctx->fs, cluster, path, list, visitListedEntry, &cb);
+
+  freeDirEntryList(list);
+
+  return ret;
+}
+
+int rosso_sort_tree(struct rosso_ctx *ctx) {
+  /*
+   * sorts the directories that the options select, or lists them with the
+   * list option
+   */
+
+  const struct sOptions *opts = ctx->opts;
+  struct sFileSystem *fs = &ctx->fs;
+  struct sTraversal traversal = { 0 };
+  struct sTraversalRecord record;
+  unsigned long directories = 0;
+  unsigned long long hits, misses, lookups;
+  int ret;
+
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+  // the cache keeps clusters of earlier calls, only this call is counted
+  hits = fs->cache.hits;
+  misses = fs->cache.misses;
+  lookups = fs->names.lookups;
+
+  if (opts->list && startListing(&ctx->listing, opts, ctx->out)) {
+    myerror("Failed to start listing!");
+    return -1;
+  }
+
+  // answer listings from an up to date index
+  if (opts->index) {
+    ret = listFileSystemIndex(fs, &ctx->listing);
+    if (ret == -1) {
+      myerror("Failed to list index!");
+      return -1;
+    }
+    if (!ret) {
+      if (opts->simulate)
+        fs_mediaStats(fs->fd, &ctx->stats.media);
+      if (endListing(&ctx->listing)) {
+        myerror("Failed to end listing!");
+        return -1;
+      }
+      return 0;
+    }
+  }
+
+  traversal.opts = opts;
+  traversal.listing = &ctx->listing;
+
+  // free clusters are only needed to relocate directories and files
+  if ((opts->defragDirs || opts->reorderFiles) && !opts->list &&
+    loadFreeSpace(fs, &traversal.space)) {
+    myerror("Failed to load free clusters!");
+    return -1;
+  }
+
+  // messages name the device if several devices are sorted concurrently
+  traversal.prefix = malloc(strlen(ctx->name) + 3);
+  if (!traversal.prefix) {
+    stderror();
+    freeTraversal(&traversal);
+    return -1;
+  }
+  if (opts->targetCount > 1)
+    sprintf(traversal.prefix, "%s: ", ctx->name);
+  else
+    traversal.prefix[0] = 0;
+
+  /*
+   * root directory lies in cluster chain, so sort it like all other
+   * directories
+   */
+  if (enterRootDirFilter(opts->dirFilter, &traversal.filter, &record.state) ||
+    pushTraversalPath(&traversal, "", 0, "") ||
+    (descendsDirFilter(opts->dirFilter, &record.state) &&
+      pushTraversalRecord(&traversal, fs->bs.BS_RootClus, 0, 0,
+        &record.state))) {
+    myerror("Failed to initialize traversal!");
+    freeTraversal(&traversal);
+    return -1;
+  }
+
+  // depth first traversal driven by the work stack
+  while (traversal.len) {
+    record = traversal.records[--traversal.len];
+
+    // paths and filter states above the popped directory are not needed
+    traversal.pathLen =
+      record.path + strlen(traversal.paths + record.path) + 1;
+    traversal.filter.len = record.state.offset + record.state.count;
+
+    if (sortClusterChain(fs, &traversal, &record) == -1) {
+      myerror("Failed to sort cluster chain!");
+      freeTraversal(&traversal);
+      return -1;
+    }
+    addProgress(directories, 1);
+    ctx->stats.directories++;
+
+    // changes of the directories so far are made durable on request
+    if (!opts->list && opts->checkpoint &&
+      !(++directories % (unsigned) opts->checkpoint) && syncFileSystem(fs)) {
+      myerror("Failed to sync file system!");
+      freeTraversal(&traversal);
+      return -1;
+    }
+  }
+
+  // all changes are durable after a single flush
+  if (!opts->list && syncFileSystem(fs)) {
+    myerror("Failed to sync file system!");
+    freeTraversal(&traversal);
+    return -1;
+  }
+
+  // the written clusters are read back in one pass
+  if (fs->verify.enabled && verifyWrittenClusters(fs, traversal.prefix)) {
+    myerror("Failed to verify written directory clusters!");
+    freeTraversal(&traversal);
+    return -1;
+  }
+
+  ctx->stats.reclaimed = traversal.reclaimed;
+  ctx->stats.freed = traversal.freed;
+  ctx->stats.moved = traversal.moved;
+  ctx->stats.relocated = traversal.relocated;
+  ctx->stats.allocations = fs->allocations;
+  ctx->stats.cacheHits = fs->cache.hits - hits;
+  ctx->stats.cacheMisses = fs->cache.misses - misses;
+  ctx->stats.names = (unsigned long) fs->names.names;
+  ctx->stats.nameLookups = fs->names.lookups - lookups;
+  if (opts->simulate)
+    fs_mediaStats(fs->fd, &ctx->stats.media);
+
+  if (opts->writeIndex && writeIndex(&traversal.index, fs, opts->writeIndex)) {
+    myerror("Failed to write index!");
+    freeTraversal(&traversal);
+    return -1;
+  }
+
+  freeTraversal(&traversal);
+
+  if (opts->list && endListing(&ctx->listing)) {
+    myerror("Failed to end listing!");
+    return -1;
+  }
+
+  return 0;
+}
+
+void rosso_get_stats(const struct rosso_ctx *ctx, struct rosso_stats *stats) {
+  /*
+   * copies the statistics of the last rosso_sort_tree()
+   */
+  *stats = ctx->stats;
+}
+
+int rosso_close(struct rosso_ctx *ctx) {
+  /*
+   * closes the device, buffered changes are written, and frees the context
+   */
+
+  int ret = 0;
+
+  if (!ctx)
+    return 0;
+
+  if (closeFileSystem(&ctx->fs)) {
+    myerror("Failed to close file system!");
+    ret = -1;
+  }
+  freeListing(&ctx->listing);
+  free(ctx->device);
+  free(ctx->name);
+  free(ctx);
+
+  return ret;
+}
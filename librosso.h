@@ -0,0 +1,78 @@
+/*
+ * This file contains/describes the library interface of rosso. All state of
+ * a device lives in a context, so several devices may be listed and sorted
+ * by one program, each context by one thread at a time. The command line
+ * program is built on top of it.
+ */
+
+#ifndef __librosso_h__
+#define __librosso_h__
+
+#include <stdio.h>
+#include "fileio.h"
+#include "options.h"
+#include "partition.h"
+
+struct rosso_ctx;
+
+struct rosso_entry {
+  /*
+   * directory entry passed to the callback of rosso_list_dir()
+   */
+  const char *name; // long name or short name if there is none
+  const char *shortName;
+  unsigned attributes; // ATTR_* flags of FAT32.h
+  unsigned long size; // bytes
+  unsigned cluster; // start cluster
+  unsigned date, time; // FAT date and time of the last write
+};
+
+struct rosso_stats {
+  /*
+   * what the last rosso_sort_tree() did to the device
+   */
+  unsigned long directories; // directories that were sorted or listed
+  unsigned long long reclaimed; // bytes of dropped entries
+  unsigned freed; // clusters released by compaction
+  unsigned moved; // directories moved to contiguous runs
+  unsigned long long relocated; // bytes of file data moved
+  unsigned long allocations; // I/O buffers allocated
+  unsigned long long cacheHits, cacheMisses; // directory cluster reads
+  unsigned long names; // distinct names of entries parsed since rosso_open()
+  unsigned long long nameLookups; // names of entries parsed by this call
+  struct sMediaStats media; // simulated transfers with the simulate option
+};
+
+// opens a FAT32 device with options that must stay valid until
+// rosso_close(), the device is read only with the list or info option
+struct rosso_ctx *rosso_open(const char *device, const struct sOptions *opts);
+
+// opens the FAT32 file system of a partition in place, part comes from
+// rosso_partitions() or is 0 for the whole device
+struct rosso_ctx *rosso_open_partition(const char *device,
+  const struct sPartition *part, const struct sOptions *opts);
+
+// reads the MBR or GPT partition table of a device and puts up to max of
+// its FAT32 partitions to parts, returns their count, 0 if the device has
+// no partition table or -1 on failure
+int rosso_partitions(const char *device, struct sPartition *parts, int max);
+
+// listings of rosso_sort_tree() are written to out instead of stdout
+void rosso_set_output(struct rosso_ctx *ctx, FILE *out);
+
+// calls callback for every entry of the directory path, e.g. "/Music/",
+// returns 0, -1 on failure or the first non-zero value of callback
+int rosso_list_dir(struct rosso_ctx *ctx, const char *path,
+  int (*callback)(void *arg, const struct rosso_entry *entry), void *arg);
+
+// sorts the directories that the options select, or lists them with the
+// list option, all changes are durable when it returns 0
+int rosso_sort_tree(struct rosso_ctx *ctx);
+
+// copies the statistics of the last rosso_sort_tree()
+void rosso_get_stats(const struct rosso_ctx *ctx, struct rosso_stats *stats);
+
+// closes the device and frees the context
+int rosso_close(struct rosso_ctx *ctx);
+
+#endif // __librosso_h__
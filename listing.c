@@ -0,0 +1,262 @@
+/*
+ * This file contains/describes functions that print directory listings
+ * while directories are parsed. Every listing has an output buffer of its
+ * own, the buffering of stdout is left to the program.
+ */
+
+#include "listing.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dirfilter.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "options.h"
+
+void flushListing(struct sListing *listing) {
+  /*
+   * write the buffered records to the output of a listing
+   */
+
+  if (listing->len &&
+    fwrite(listing->buf, 1, listing->len, listing->out) != listing->len)
+    listing->failed = 1;
+  listing->len = 0;
+}
+
+void putListing(struct sListing *listing, const char *str, size_t len) {
+  /*
+   * append len characters of str to a listing
+   */
+
+  if (len > LIST_BUFFER_SIZE - listing->len)
+    flushListing(listing);
+  if (len > LIST_BUFFER_SIZE) {
+    if (fwrite(str, 1, len, listing->out) != len)
+      listing->failed = 1;
+    return;
+  }
+  memcpy(listing->buf + listing->len, str, len);
+  listing->len += len;
+}
+
+void printListing(struct sListing *listing, const char *format, ...) {
+  /*
+   * append formatted output to a listing, records that don't fit in the
+   * rest of the buffer are formatted again after it has been written
+   */
+
+  va_list args;
+  int len;
+
+  va_start(args, format);
+  len = vsnprintf(listing->buf + listing->len,
+    LIST_BUFFER_SIZE - listing->len, format, args);
+  va_end(args);
+  if (len < 0) {
+    listing->failed = 1;
+    return;
+  }
+
+  if ((size_t) len >= LIST_BUFFER_SIZE - listing->len) {
+    flushListing(listing);
+    va_start(args, format);
+    if ((size_t) len >= LIST_BUFFER_SIZE) {
+      if (vfprintf(listing->out, format, args) < 0)
+        listing->failed = 1;
+      len = 0;
+    }
+    else
+      vsnprintf(listing->buf, LIST_BUFFER_SIZE, format, args);
+    va_end(args);
+  }
+  listing->len += (size_t) len;
+}
+
+int startListing(struct sListing *listing, const struct sOptions *opts,
+  FILE *out) {
+  /*
+   * set up the buffer of a listing to out and print its header
+   */
+
+  if (!listing->buf) {
+    listing->buf = malloc(LIST_BUFFER_SIZE);
+    if (!listing->buf) {
+      stderror();
+      return -1;
+    }
+  }
+  listing->opts = opts;
+  listing->out = out;
+  listing->len = 0;
+  listing->failed = 0;
+
+  if (opts->listFormat == LIST_TSV) {
+    printListing(listing, "path\tname\tshort\tattr\tsize\tcluster\t"
+      "created\tmodified\taccessed\n");
+  }
+
+  return 0;
+}
+
+void listDirectory(struct sListing *listing, const char *path,
+  unsigned cluster, int clen, unsigned clusterSize) {
+  /*
+   * print the header of a directory, structured formats and search results
+   * have the path in every record instead
+   */
+  const struct sOptions *opts = listing->opts;
+
+  if (opts->listFormat != LIST_TEXT || opts->find)
+    return;
+
+  if (strcmp(path, "/"))
+    putListing(listing, "\n", 1);
+  printListing(listing, "%s\n", path);
+  if (opts->moreInfo) {
+    printListing(listing, "Start cluster: %08d, length: %d (%d bytes)\n",
+      cluster, clen, clen * (int) clusterSize);
+  }
+}
+
+void formatDateTime(char *str, uint16_t date, uint16_t time,
+  unsigned tenth) {
+  /*
+   * format FAT date and time as ISO 8601, str must hold 20 characters
+   */
+
+  if (!date) {
+    str[0] = 0;
+    return;
+  }
+  sprintf(str, "%04u-%02u-%02uT%02u:%02u:%02u", 1980U + (date >> 9),
+    date >> 5 & 0x0FU, date & 0x1FU, time >> 11 & 0x1FU, time >> 5 & 0x3FU,
+    (time & 0x1FU) * 2 + tenth / 100);
+}
+
+void putEscaped(struct sListing *listing, const char *str) {
+  /*
+   * print a string with JSON or TSV escapes
+   */
+  const char *run = str;
+  char esc[8];
+
+  for (; *str; str++) {
+    if ((unsigned char) *str >= 0x20 && *str != '"' && *str != '\\')
+      continue;
+    if (listing->opts->listFormat == LIST_TSV && *str == '"')
+      continue;
+
+    putListing(listing, run, (size_t) (str - run));
+    run = str + 1;
+    switch (*str) {
+    case '"':
+      putListing(listing, "\\\"", 2);
+      break;
+    case '\\':
+      putListing(listing, "\\\\", 2);
+      break;
+    case '\t':
+      putListing(listing, "\\t", 2);
+      break;
+    case '\n':
+      putListing(listing, "\\n", 2);
+      break;
+    default:
+      sprintf(esc, "\\u%04x", (unsigned char) *str);
+      putListing(listing, esc, 6);
+    }
+  }
+  putListing(listing, run, (size_t) (str - run));
+}
+
+void listEntry(struct sListing *listing, const char *path,
+  const char *lname, const char *sname, const struct sShortDirEntry *sde) {
+  /*
+   * print one directory entry
+   */
+
+  const struct sOptions *opts = listing->opts;
+  char created[20], modified[20], accessed[20];
+  const char *name = lname[0] ? lname : sname;
+  unsigned cluster;
+
+  if (opts->listFormat == LIST_NONE ||
+    (opts->find && !matchesGlob(opts->find, name)))
+    return;
+
+  if (opts->listFormat == LIST_TEXT) {
+    if (opts->find) {
+      if (opts->moreInfo)
+        printListing(listing, "%s%s (%s)\n", path, name, sname);
+      else
+        printListing(listing, "%s%s\n", path, name);
+    }
+    else if (opts->moreInfo)
+      printListing(listing, "%s (%s)\n", lname[0] ? lname : "n/a", sname);
+    else
+      printListing(listing, "%s\n", lname[0] ? lname : sname);
+    return;
+  }
+
+  cluster = (unsigned) sde->DIR_FstClusHI << 16 | sde->DIR_FstClusLO;
+  formatDateTime(created, sde->DIR_CrtDate, sde->DIR_CrtTime,
+    sde->DIR_CrtTimeTenth);
+  formatDateTime(modified, sde->DIR_WrtDate, sde->DIR_WrtTime, 0);
+  formatDateTime(accessed, sde->DIR_LstAccDate, 0, 0);
+  // the access time is a date only
+  accessed[10] = 0;
+
+  if (opts->listFormat == LIST_NDJSON) {
+    putListing(listing, "{\"path\":\"", 9);
+    putEscaped(listing, path);
+    putListing(listing, "\",\"name\":\"", 10);
+    putEscaped(listing, name);
+    putListing(listing, "\",\"short\":\"", 11);
+    putEscaped(listing, sname);
+    printListing(listing, "\",\"attr\":%u,\"size\":%lu,\"cluster\":%u,"
+      "\"created\":\"%s\",\"modified\":\"%s\",\"accessed\":\"%s\"}\n",
+      sde->DIR_Atrr, (unsigned long) sde->DIR_FileSize, cluster, created,
+      modified, accessed);
+  }
+  else {
+    putEscaped(listing, path);
+    putListing(listing, "\t", 1);
+    putEscaped(listing, name);
+    putListing(listing, "\t", 1);
+    putEscaped(listing, sname);
+    printListing(listing, "\t%u\t%lu\t%u\t%s\t%s\t%s\n", sde->DIR_Atrr,
+      (unsigned long) sde->DIR_FileSize, cluster, created, modified,
+      accessed);
+  }
+}
+
+int endListing(struct sListing *listing) {
+  /*
+   * write the buffered rest of a listing to its output and flush it
+   */
+
+  flushListing(listing);
+  if (fflush(listing->out)) {
+    stderror();
+    return -1;
+  }
+  if (listing->failed) {
+    myerror("Failed to write listing!");
+    return -1;
+  }
+
+  return 0;
+}
+
+void freeListing(struct sListing *listing) {
+  /*
+   * free the buffer of a listing
+   */
+
+  free(listing->buf);
+  listing->buf = 0;
+  listing->len = 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file contains/describes functions that print directory listings
+ * while directories are parsed. Every listing has an output buffer of its
+ * own, the buffering of stdout is left to the program.
+ */
+
+#ifndef __listing_h__
+#define __listing_h__
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct sOptions;
+struct sShortDirEntry;
+
+// listing formats
+#define LIST_TEXT 0
+#define LIST_NDJSON 1
+#define LIST_TSV 2
+#define LIST_NONE 3 // nothing is printed, e.g. when writing an index
+
+// size of the output buffer for listings
+#define LIST_BUFFER_SIZE (1 << 20)
+
+struct sListing {
+  /*
+   * output of a listing, records are collected in a buffer of its own and
+   * written to out in large blocks
+   */
+  const struct sOptions *opts;
+  FILE *out;
+  char *buf; // LIST_BUFFER_SIZE bytes, allocated by the first listing
+  size_t len; // bytes in buf
+  int failed; // a write to out failed
+};
+
+// set up the buffer of a listing to out and print its header
+int startListing(struct sListing *listing, const struct sOptions *opts,
+  FILE *out);
+
+// print the header of a directory
+void listDirectory(struct sListing *listing, const char *path,
+  unsigned cluster, int clen, unsigned clusterSize);
+
+// print one directory entry
+void listEntry(struct sListing *listing, const char *path,
+  const char *lname, const char *sname, const struct sShortDirEntry *sde);
+
+// write the buffered rest of a listing to its output
+int endListing(struct sListing *listing);
+
+// free the buffer of a listing
+void freeListing(struct sListing *listing);
+
+#endif // __listing_h__
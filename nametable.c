@@ -0,0 +1,127 @@
+/*
+ * This file contains/describes the table of interned names. Media cards
+ * repeat the same names in many directories, every distinct long or short
+ * name is stored once and keeps the sort key that was built for it, so the
+ * entries of all directories share both.
+ */
+
+#include "nametable.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+
+unsigned hashName(const char *str, size_t *len) {
+  /*
+   * FNV-1a hash of a name, len is set to its length
+   */
+
+  unsigned hash = NAME_HASH_INIT;
+  const char *p;
+
+  for (p = str; *p; p++) {
+    hash ^= (unsigned char) *p;
+    hash *= 16777619U;
+  }
+  *len = (size_t) (p - str);
+  return hash;
+}
+
+size_t findNameSlot(const struct sNameTable *table, const char *str,
+  size_t len, unsigned hash) {
+  /*
+   * returns the slot that holds str or the free slot where it belongs
+   */
+  const struct sName *name;
+  size_t j;
+
+  for (j = hash & (table->size - 1); table->slots[j];
+    j = (j + 1) & (table->size - 1)) {
+    name = table->slots[j];
+    if (name->hash == hash && name->len == len && !memcmp(name->str, str, len))
+      break;
+  }
+  return j;
+}
+
+int growNameTable(struct sNameTable *table) {
+  /*
+   * doubles the hash table
+   */
+
+  struct sName **old = table->slots;
+  size_t size = table->size, j, k;
+
+  table->size = size ? size * 2 : 1024;
+  table->slots = calloc(table->size, sizeof(*table->slots));
+  if (!table->slots) {
+    stderror();
+    table->slots = old;
+    table->size = size;
+    return -1;
+  }
+
+  for (j = 0; j < size; j++) {
+    if (old[j]) {
+      for (k = old[j]->hash & (table->size - 1); table->slots[k];
+        k = (k + 1) & (table->size - 1));
+      table->slots[k] = old[j];
+    }
+  }
+  free(old);
+
+  return 0;
+}
+
+struct sName *internName(struct sNameTable *table, const char *str) {
+  /*
+   * returns the interned copy of str, it is added if the table doesn't hold
+   * it yet
+   */
+
+  struct sName *name;
+  unsigned hash;
+  size_t j, len;
+
+  if ((table->names + 1) * 2 > table->size && growNameTable(table))
+    return 0;
+
+  table->lookups++;
+  hash = hashName(str, &len);
+  j = findNameSlot(table, str, len, hash);
+  if (table->slots[j])
+    return table->slots[j];
+
+  name = malloc(sizeof(*name) + len + 1);
+  if (!name) {
+    stderror();
+    return 0;
+  }
+  name->key = 0;
+  name->keylen = 0;
+  name->len = len;
+  name->hash = hash;
+  memcpy(name->str, str, len + 1);
+
+  table->slots[j] = name;
+  table->names++;
+
+  return name;
+}
+
+void freeNameTable(struct sNameTable *table) {
+  /*
+   * free all interned names and their sort keys, the counters are kept
+   */
+  size_t j;
+
+  for (j = 0; j < table->size; j++) {
+    if (table->slots[j]) {
+      free(table->slots[j]->key);
+      free(table->slots[j]);
+    }
+  }
+  free(table->slots);
+  table->slots = 0;
+  table->size = table->names = 0;
+}
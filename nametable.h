@@ -0,0 +1,45 @@
+/*
+ * This file contains/describes the table of interned names. Media cards
+ * repeat the same names in many directories, every distinct long or short
+ * name is stored once and keeps the sort key that was built for it, so the
+ * entries of all directories share both.
+ */
+
+#ifndef __nametable_h__
+#define __nametable_h__
+
+#include <stddef.h>
+
+// initial value of hashName()
+#define NAME_HASH_INIT 2166136261U
+
+struct sName {
+  /*
+   * interned name, the sort key is built when it is first needed
+   */
+  unsigned char *key; // name sort key or 0
+  size_t keylen; // length of name sort key
+  size_t len; // length of str
+  unsigned hash;
+  char str[]; // zero terminated name
+};
+
+struct sNameTable {
+  /*
+   * interned names in an open addressing hash table, the sort keys of one
+   * table are all built for the same sort specification
+   */
+  struct sName **slots; // 0 for unused slots
+  size_t size; // available slots, a power of two
+  size_t names; // distinct names
+  unsigned long long lookups; // names that were interned
+};
+
+// returns the interned copy of str, it is added if the table doesn't hold
+// it yet, 0 on failure
+struct sName *internName(struct sNameTable *table, const char *str);
+
+// free all interned names and their sort keys, the counters are kept
+void freeNameTable(struct sNameTable *table);
+
+#endif // __nametable_h__
@@ -6,21 +6,18 @@
 
 #include <getopt.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "batch.h"
+#include "dirfilter.h"
 #include "errors.h"
+#include "fileio.h"
+#include "listing.h"
+#include "orderfile.h"
+#include "sortkey.h"
 #include "stringlist.h"
 
-int OPT_VERSION, OPT_HELP, OPT_INFO, OPT_IGNORE_CASE, OPT_ORDER, OPT_LIST,
-  OPT_REVERSE, OPT_NATURAL_SORT, OPT_RECURSIVE, OPT_RANDOM, OPT_MORE_INFO,
-  OPT_MODIFICATION, OPT_ASCII;
-
-struct sStringList *OPT_INCL_DIRS = 0;
-struct sStringList *OPT_EXCL_DIRS = 0;
-struct sStringList *OPT_INCL_DIRS_REC = 0;
-struct sStringList *OPT_EXCL_DIRS_REC = 0;
-struct sStringList *OPT_IGNORE_PREFIXES_LIST = 0;
-
 int addDirPathToStringList(struct sStringList *stringList,
   const char (*str)[PATH_MAX + 1]) {
   /*
@@ -66,232 +63,618 @@ int addDirPathToStringList(struct sStringList *stringList,
 
 }
 
-int matchesDirPathLists(struct sStringList *includes,
-  struct sStringList *includes_recursion, struct sStringList *excludes,
-  struct sStringList *excludes_recursion, const char (*str)[PATH_MAX + 1]) {
+int addTarget(struct sOptions *opts, const char *filename) {
   /*
-   * evaluate whether str matches the include an exclude dir path lists or
-   * not
+   * add a device to the list of targets
    */
 
-  int incl, incl_rec, excl, excl_rec;
-
-  incl = matchesStringList(includes, (const char *) str);
-  incl_rec = matchesStringList(includes_recursion, (const char *) str);
-  excl = matchesStringList(excludes, (const char *) str);
-  excl_rec = matchesStringList(excludes_recursion, (const char *) str);
-
-  // if no options -d and -D are used
-  if (!includes->next && !includes_recursion->next) {
-    /*
-     * match all directories except those are supplied via -x and those and
-     * subdirs that are supplied via -X
-     */
-    if (excl != RETURN_EXACT_MATCH && excl_rec == RETURN_NO_MATCH) {
-      return 1; // match
-    }
+  if (addStringToStringList(opts->targets, filename)) {
+    myerror("Could not add device to string list");
+    return -1;
   }
-  // if options -d and -D are used
-  else {
-    /*
-     * match all dirs that are supplied via -d, and all dirs and subdirs that
-     * are supplied via -D, except those that excplicitly excluded via -x, or
-     * those and their subdirs that are supplied via -X
-     */
-    if ((incl == RETURN_EXACT_MATCH || incl_rec != RETURN_NO_MATCH) &&
-      excl != RETURN_EXACT_MATCH && excl_rec == RETURN_NO_MATCH) {
-      return 1; // match
+  opts->targetCount++;
+
+  return 0;
+}
+
+int readManifest(struct sOptions *opts, const char *filename) {
+  /*
+   * add the devices of a manifest file to the list of targets, the file has
+   * one device per line, empty lines and lines starting with # are skipped
+   */
+
+  char line[PATH_MAX + 2];
+  FILE *fd;
+  size_t len;
+
+  fd = fopen(filename, "r");
+  if (!fd) {
+    stderror();
+    myerror("Failed to open manifest '%s'!", filename);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fd)) {
+    len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      myerror("Line in manifest '%s' is too long!", filename);
+      fclose(fd);
+      return -1;
+    }
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = 0;
+    if (!len || line[0] == '#')
+      continue;
+    if (addTarget(opts, line)) {
+      fclose(fd);
+      return -1;
     }
   }
 
-  return 0; // no match
+  if (ferror(fd)) {
+    stderror();
+    myerror("Failed to read manifest '%s'!", filename);
+    fclose(fd);
+    return -1;
+  }
+
+  fclose(fd);
+
+  return 0;
 }
 
-int parse_options(int argc, char *argv[]) {
+int parseSize(const char *str, unsigned long long *size) {
   /*
-   * parses command line options
+   * parse a positive number of bytes with an optional K, M or G suffix
    */
 
-  int j;
+  unsigned long long value;
+  char *end;
 
-  static struct option longOpts[] = {
-    // name, has_arg, flag, val
-    {"help", 0, 0, 'h'},
-    {"version", 0, 0, 'v'},
-    {0, 0, 0, 0}
+  if (*str < '0' || *str > '9')
+    return -1;
+
+  value = strtoull(str, &end, 10);
+  switch (*end) {
+  case 'G':
+  case 'g':
+    value *= 1024;
+    // fall through
+  case 'M':
+  case 'm':
+    value *= 1024;
+    // fall through
+  case 'K':
+  case 'k':
+    value *= 1024;
+    end++;
+    break;
+  }
+  if (*end || !value)
+    return -1;
+
+  *size = value;
+
+  return 0;
+}
+
+int parseMediaModel(const char *spec, struct sMediaModel *model) {
+  /*
+   * parse a comma separated list of presets (sd, usb) and terms like
+   * seek=2000 or erase=4M into a latency model, later terms override
+   * earlier ones
+   */
+
+  static const struct {
+    const char *name;
+    struct sMediaModel model;
+  } presets[] = {
+    // cheap SD card, random writes copy 4 MiB allocation units
+    {"sd", {300, 1000, 4 << 20, 2, 20 << 20, 10 << 20}},
+    // USB stick with the latency of USB transfers and a single open block
+    {"usb", {1000, 500, 2 << 20, 1, 30 << 20, 8 << 20}}
   };
+  char term[32], *value, *end;
+  unsigned long long number;
+  size_t len, j;
+
+  memset(model, 0, sizeof(*model));
+
+  while (*spec) {
+    len = strcspn(spec, ",");
+    if (!len || len >= sizeof(term))
+      return -1;
+    memcpy(term, spec, len);
+    term[len] = 0;
+    spec += spec[len] ? len + 1 : len;
+
+    value = strchr(term, '=');
+    if (!value) {
+      for (j = 0; j < sizeof(presets) / sizeof(*presets) &&
+        strcmp(presets[j].name, term); j++);
+      if (j == sizeof(presets) / sizeof(*presets))
+        return -1;
+      *model = presets[j].model;
+      continue;
+    }
+    *value++ = 0;
+
+    if (!strcmp(term, "erase") || !strcmp(term, "read") ||
+      !strcmp(term, "write")) {
+      if (parseSize(value, &number))
+        return -1;
+    }
+    else {
+      if (*value < '0' || *value > '9')
+        return -1;
+      number = strtoull(value, &end, 10);
+      if (*end)
+        return -1;
+    }
+
+    if (!strcmp(term, "request"))
+      model->request = number;
+    else if (!strcmp(term, "seek"))
+      model->seek = number;
+    else if (!strcmp(term, "erase"))
+      model->eraseBlock = number;
+    else if (!strcmp(term, "open") && number && number <=
+      MEDIA_MAX_OPEN_BLOCKS)
+      model->openBlocks = (unsigned) number;
+    else if (!strcmp(term, "read"))
+      model->readRate = number;
+    else if (!strcmp(term, "write"))
+      model->writeRate = number;
+    else
+      return -1;
+  }
+
+  return 0;
+}
+
+int initOptions(struct sOptions *opts) {
+  /*
+   * set the default options, the string lists are empty
+   */
+
+  memset(opts, 0, sizeof(*opts));
 
   // no info by default
-  OPT_INFO = 0;
-  OPT_MORE_INFO = 0;
+  opts->info = 0;
+  opts->moreInfo = 0;
 
   // Default (1) is normal order, use -1 for reverse order.
-  OPT_REVERSE = 1;
+  opts->reverse = 1;
 
   // natural sort
-  OPT_NATURAL_SORT = 0;
+  opts->naturalSort = 0;
 
   // random sort order
-  OPT_RANDOM = 0;
+  opts->random = 0;
 
   // default order (directories first)
-  OPT_ORDER = 0;
+  opts->order = 0;
 
   // default is case sensitive
-  OPT_IGNORE_CASE = 0;
+  opts->ignoreCase = 0;
 
   // no version information by default
-  OPT_VERSION = 0;
+  opts->version = 0;
 
   // sort by last modification time
-  OPT_MODIFICATION = 0;
+  opts->modification = 0;
 
   // sort by using locale collation order
-  OPT_ASCII = 0;
+  opts->ascii = 0;
+
+  // plain text listing
+  opts->listFormat = LIST_TEXT;
+
+  // directories are scanned without index
+  opts->writeIndex = 0;
+  opts->index = 0;
+  opts->find = 0;
+
+  // deleted entries are kept
+  opts->compact = 0;
+  opts->compactFree = 0;
+
+  // directories and file data stay where they are
+  opts->defragDirs = 0;
+  opts->reorderFiles = 0;
+  opts->moveBudget = 0;
+
+  // devices are accessed through the system cache
+  opts->direct = 0;
+
+  // changes are flushed to the device once at the end
+  opts->checkpoint = 0;
+
+  // written clusters are not read back
+  opts->verify = 0;
+
+  // no progress lines
+  opts->progress = 0;
+
+  // devices are real
+  opts->simulate = 0;
+
+  // all FAT32 partitions of devices with a partition table
+  opts->partition = 0;
+
+  // one device at a time
+  opts->jobs = 1;
+  opts->targetCount = 0;
+
+  // sort keys are derived from the options above by default
+  opts->sortKey = 0;
+
+  // no curated order
+  opts->orderFile = 0;
 
   // empty string lists for inclusion and exclusion of dirs
-  OPT_INCL_DIRS = newStringList();
-  if (!OPT_INCL_DIRS) {
+  opts->inclDirs = newStringList();
+  if (!opts->inclDirs) {
     myerror("Could not create stringList!");
+    freeOptions(opts);
     return -1;
   }
-  OPT_INCL_DIRS_REC = newStringList();
-  if (!OPT_INCL_DIRS_REC) {
+  opts->inclDirsRec = newStringList();
+  if (!opts->inclDirsRec) {
     myerror("Could not create stringList!");
-    freeOptions();
+    freeOptions(opts);
     return -1;
   }
-  OPT_EXCL_DIRS = newStringList();
-  if (!OPT_EXCL_DIRS) {
+  opts->exclDirs = newStringList();
+  if (!opts->exclDirs) {
     myerror("Could not create stringList!");
-    freeOptions();
+    freeOptions(opts);
     return -1;
   }
-  OPT_EXCL_DIRS_REC = newStringList();
-  if (!OPT_EXCL_DIRS_REC) {
+  opts->exclDirsRec = newStringList();
+  if (!opts->exclDirsRec) {
     myerror("Could not create stringList!");
-    freeOptions();
+    freeOptions(opts);
     return -1;
   }
 
   // empty string list for to be ignored prefixes
-  OPT_IGNORE_PREFIXES_LIST = newStringList();
-  if (!OPT_IGNORE_PREFIXES_LIST) {
+  opts->ignorePrefixes = newStringList();
+  if (!opts->ignorePrefixes) {
+    myerror("Could not create stringList!");
+    freeOptions(opts);
+    return -1;
+  }
+
+  // empty string list for devices
+  opts->targets = newStringList();
+  if (!opts->targets) {
     myerror("Could not create stringList!");
-    freeOptions();
+    freeOptions(opts);
     return -1;
   }
 
+  return 0;
+}
+
+int prepareOptions(struct sOptions *opts) {
+  /*
+   * compile directory filter, order file and sort keys of the options
+   */
+
+  // queries imply listing
+  if (opts->index || opts->find)
+    opts->list = 1;
+
+  // compile directory paths into a trie that is walked during traversal
+  freeDirFilter(opts->dirFilter);
+  opts->dirFilter = newDirFilter(opts->inclDirs, opts->inclDirsRec,
+    opts->exclDirs, opts->exclDirsRec);
+  if (!opts->dirFilter) {
+    myerror("Failed to compile directory filter!");
+    return -1;
+  }
+
+  // the order file is read once for all devices
+  freeOrderTable(opts->orderTable);
+  opts->orderTable = 0;
+  if (opts->orderFile) {
+    opts->orderTable = loadOrderTable(opts->orderFile);
+    if (!opts->orderTable) {
+      myerror("Failed to read order file!");
+      return -1;
+    }
+  }
+
+  // compile sort keys once, cmpEntries() only runs the comparator chain
+  if (opts->sortKey ? compileSortSpec(opts, opts->sortKey) :
+    compileLegacySortSpec(opts)) {
+    myerror("Failed to compile sort keys!");
+    return -1;
+  }
+
+  return 0;
+}
+
+int parse_options(struct sOptions *opts, int argc, char *argv[]) {
+  /*
+   * parses command line options
+   */
+
+  int j;
+  char *manifest = 0, *end;
+  long number;
+
+  static struct option longOpts[] = {
+    // name, has_arg, flag, val
+    {"help", 0, 0, 'h'},
+    {"version", 0, 0, 'v'},
+    {"sort-key", 1, 0, 'k'},
+    {"list-format", 1, 0, 'F'},
+    {"write-index", 1, 0, 'W'},
+    {"index", 1, 0, 'N'},
+    {"find", 1, 0, 'f'},
+    {"jobs", 1, 0, 'j'},
+    {"manifest", 1, 0, 'M'},
+    {"compact", 0, 0, 'C'},
+    {"compact-free", 0, 0, 'E'},
+    {"defrag-dirs", 0, 0, 'G'},
+    {"reorder-files", 0, 0, 'O'},
+    {"move-budget", 1, 0, 'B'},
+    {"direct", 0, 0, 'U'},
+    {"checkpoint", 1, 0, 'K'},
+    {"order-file", 1, 0, 'P'},
+    {"progress", 0, 0, 'Q'},
+    {"simulate", 1, 0, 'S'},
+    {"verify", 0, 0, 'V'},
+    {"partition", 1, 0, 'T'},
+    {0, 0, 0, 0}
+  };
+
+  if (initOptions(opts))
+    return -1;
+
   opterr = 0;
   while ((j =
-      getopt_long(argc, argv, "imvhco:lrRnd:D:x:X:I:ta", longOpts,
+      getopt_long(argc, argv, "imvhco:lrRnd:D:x:X:I:tak:j:", longOpts,
         0)) != -1) {
     switch (j) {
     case 'a':
-      OPT_ASCII = 1;
+      opts->ascii = 1;
       break;
     case 'c':
-      OPT_IGNORE_CASE = 1;
+      opts->ignoreCase = 1;
+      break;
+    case 'C':
+      opts->compact = 1;
+      break;
+    case 'E':
+      opts->compact = 1;
+      opts->compactFree = 1;
+      break;
+    case 'G':
+      opts->defragDirs = 1;
+      break;
+    case 'O':
+      opts->reorderFiles = 1;
+      break;
+    case 'B':
+      opts->reorderFiles = 1;
+      if (parseSize(optarg, &opts->moveBudget)) {
+        myerror("Invalid move budget '%s'.", optarg);
+        myerror("Use -h for more help.");
+        freeOptions(opts);
+        return -1;
+      }
       break;
     case 'h':
-      OPT_HELP = 1;
+      opts->help = 1;
       break;
     case 'i':
-      OPT_INFO = 1;
+      opts->info = 1;
       break;
     case 'm':
-      OPT_MORE_INFO = 1;
+      opts->moreInfo = 1;
       break;
     case 'l':
-      OPT_LIST = 1;
+      opts->list = 1;
+      break;
+    case 'F':
+      opts->list = 1;
+      if (!strcmp(optarg, "text"))
+        opts->listFormat = LIST_TEXT;
+      else if (!strcmp(optarg, "ndjson"))
+        opts->listFormat = LIST_NDJSON;
+      else if (!strcmp(optarg, "tsv"))
+        opts->listFormat = LIST_TSV;
+      else if (!strcmp(optarg, "none"))
+        opts->listFormat = LIST_NONE;
+      else {
+        myerror("Unknown list format '%s'.", optarg);
+        myerror("Use -h for more help.");
+        freeOptions(opts);
+        return -1;
+      }
+      break;
+    case 'W':
+      opts->writeIndex = optarg;
+      break;
+    case 'N':
+      opts->index = optarg;
+      break;
+    case 'f':
+      opts->find = optarg;
       break;
     case 'o':
       switch (optarg[0]) {
       case 'd':
-        OPT_ORDER = 0;
+        opts->order = 0;
         break;
       case 'f':
-        OPT_ORDER = 1;
+        opts->order = 1;
         break;
       case 'a':
-        OPT_ORDER = 2;
+        opts->order = 2;
         break;
       default:
         myerror("Unknown flag '%c' for option 'o'.", optarg[0]);
         myerror("Use -h for more help.");
-        freeOptions();
+        freeOptions(opts);
         return -1;
       }
       break;
     case 'd':
-      if (addDirPathToStringList(OPT_INCL_DIRS,
+      if (addDirPathToStringList(opts->inclDirs,
           (const char (*)[PATH_MAX + 1]) optarg)) {
         myerror("Could not add directory path to dirPathList");
-        freeOptions();
+        freeOptions(opts);
         return -1;
       }
       break;
     case 'D':
-      if (addDirPathToStringList(OPT_INCL_DIRS_REC,
+      if (addDirPathToStringList(opts->inclDirsRec,
           (const char (*)[PATH_MAX + 1]) optarg)) {
         myerror("Could not add directory path to string list");
-        freeOptions();
+        freeOptions(opts);
         return -1;
       }
       break;
     case 'x':
-      if (addDirPathToStringList(OPT_EXCL_DIRS,
+      if (addDirPathToStringList(opts->exclDirs,
           (const char (*)[PATH_MAX + 1]) optarg)) {
         myerror("Could not add directory path to string list");
-        freeOptions();
+        freeOptions(opts);
         return -1;
       }
       break;
     case 'X':
-      if (addDirPathToStringList(OPT_EXCL_DIRS_REC,
+      if (addDirPathToStringList(opts->exclDirsRec,
           (const char (*)[PATH_MAX + 1]) optarg)) {
         myerror("Could not add directory path to string list");
-        freeOptions();
+        freeOptions(opts);
         return -1;
       }
       break;
     case 'I':
-      if (addStringToStringList(OPT_IGNORE_PREFIXES_LIST, optarg)) {
+      if (addStringToStringList(opts->ignorePrefixes, optarg)) {
         myerror("Could not add directory path to string list");
-        freeOptions();
+        freeOptions(opts);
+        return -1;
+      }
+      break;
+    case 'j':
+      number = strtol(optarg, &end, 10);
+      if (*end || number < 1 || number > MAX_JOBS) {
+        myerror("Number of jobs must be between 1 and %d.", MAX_JOBS);
+        freeOptions(opts);
+        return -1;
+      }
+      opts->jobs = (int) number;
+      break;
+    case 'k':
+      opts->sortKey = optarg;
+      break;
+    case 'K':
+      number = strtol(optarg, &end, 10);
+      if (*end || number < 1 || number != (int) number) {
+        myerror("Checkpoint interval must be a positive number.");
+        freeOptions(opts);
         return -1;
       }
+      opts->checkpoint = (int) number;
+      break;
+    case 'M':
+      manifest = optarg;
       break;
     case 'n':
-      OPT_NATURAL_SORT = 1;
+      opts->naturalSort = 1;
+      break;
+    case 'P':
+      opts->orderFile = optarg;
+      break;
+    case 'Q':
+      opts->progress = 1;
       break;
     case 'r':
-      OPT_REVERSE = -1;
+      opts->reverse = -1;
       break;
     case 'R':
-      OPT_RANDOM = 1;
+      opts->random = 1;
+      break;
+    case 'S':
+      opts->simulate = 1;
+      if (parseMediaModel(optarg, &opts->mediaModel)) {
+        myerror("Invalid media model '%s'.", optarg);
+        myerror("Use -h for more help.");
+        freeOptions(opts);
+        return -1;
+      }
       break;
     case 't':
-      OPT_MODIFICATION = 1;
+      opts->modification = 1;
+      break;
+    case 'U':
+      opts->direct = 1;
       break;
     case 'v':
-      OPT_VERSION = 1;
+      opts->version = 1;
+      break;
+    case 'V':
+      opts->verify = 1;
+      break;
+    case 'T':
+      number = strtol(optarg, &end, 10);
+      if (*end || number < 1 || number != (unsigned) number) {
+        myerror("Partition must be a positive number.");
+        freeOptions(opts);
+        return -1;
+      }
+      opts->partition = (unsigned) number;
       break;
     default:
       myerror("Unknown option '%c'.", optopt);
       myerror("Use -h for more help.");
-      freeOptions();
+      freeOptions(opts);
+      return -1;
+    }
+  }
+
+  // devices from the command line come before those of the manifest
+  for (j = optind; j < argc; j++) {
+    if (addTarget(opts, argv[j])) {
+      freeOptions(opts);
       return -1;
     }
   }
+  if (manifest && readManifest(opts, manifest)) {
+    myerror("Failed to read manifest!");
+    freeOptions(opts);
+    return -1;
+  }
+
+  if (prepareOptions(opts)) {
+    freeOptions(opts);
+    return -1;
+  }
 
   return 0;
 }
 
-void freeOptions() {
-  freeStringList(OPT_INCL_DIRS);
-  freeStringList(OPT_INCL_DIRS_REC);
-  freeStringList(OPT_EXCL_DIRS);
-  freeStringList(OPT_EXCL_DIRS_REC);
-  freeStringList(OPT_IGNORE_PREFIXES_LIST);
+void freeOptions(struct sOptions *opts) {
+  /*
+   * free the string lists and compiled state of the options
+   */
+
+  freeStringList(opts->inclDirs);
+  freeStringList(opts->inclDirsRec);
+  freeStringList(opts->exclDirs);
+  freeStringList(opts->exclDirsRec);
+  freeStringList(opts->ignorePrefixes);
+  freeStringList(opts->targets);
+  opts->inclDirs = opts->inclDirsRec = opts->exclDirs = opts->exclDirsRec =
+    opts->ignorePrefixes = opts->targets = 0;
+  freeDirFilter(opts->dirFilter);
+  opts->dirFilter = 0;
+  freeOrderTable(opts->orderTable);
+  opts->orderTable = 0;
 }
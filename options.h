@@ -5,24 +5,52 @@
 #ifndef __options_h__
 #define __options_h__
 
-#include <limits.h>
+#include "fileio.h"
+#include "sortkey.h"
+
+struct sDirFilter;
+struct sOrderTable;
 struct sStringList;
 
-extern int OPT_VERSION, OPT_HELP, OPT_INFO, OPT_IGNORE_CASE, OPT_ORDER,
-  OPT_LIST, OPT_REVERSE, OPT_NATURAL_SORT, OPT_RECURSIVE, OPT_RANDOM,
-  OPT_MORE_INFO, OPT_MODIFICATION, OPT_ASCII;
-extern struct sStringList *OPT_INCL_DIRS, *OPT_EXCL_DIRS, *OPT_INCL_DIRS_REC,
-  *OPT_EXCL_DIRS_REC, *OPT_IGNORE_PREFIXES_LIST;
+struct sOptions {
+  /*
+   * options of a run, every device is processed with one of them, the
+   * command line fills one with parse_options(), programs that link
+   * librosso may fill them by hand between initOptions() and
+   * prepareOptions()
+   */
+  int help, version, info, moreInfo;
+  int list, listFormat; // print current order only in LIST_* format
+  int reverse; // 1 for normal and -1 for reverse order
+  int naturalSort, random, ignoreCase, ascii, modification;
+  int order; // 0 directories first, 1 files first, 2 not differentiated
+  int compact, compactFree, defragDirs, reorderFiles;
+  unsigned long long moveBudget; // bytes of file data or 0 for no limit
+  int direct, checkpoint, progress, verify;
+  int simulate; // transfers are charged with mediaModel
+  struct sMediaModel mediaModel;
+  unsigned partition; // number of the partition to process or 0 for all
+  int jobs, targetCount;
+  struct sStringList *inclDirs, *exclDirs, *inclDirsRec, *exclDirsRec;
+  struct sStringList *ignorePrefixes, *targets;
+  char *sortKey, *writeIndex, *index, *find, *orderFile;
 
-// parses command line options
-int parse_options(int argc, char *argv[]);
+  // compiled by prepareOptions()
+  struct sDirFilter *dirFilter;
+  struct sOrderTable *orderTable;
+  struct sSortSpec sortSpec;
+};
+
+// set the default options
+int initOptions(struct sOptions *opts);
 
-// evaluate whether str matches the include an exclude dir path lists or not
-int matchesDirPathLists(struct sStringList *includes,
-  struct sStringList *includes_recursion, struct sStringList *excludes,
-  struct sStringList *excludes_recursion, const char (*str)[PATH_MAX + 1]);
+// compile directory filter, order file and sort keys of the options
+int prepareOptions(struct sOptions *opts);
+
+// parses command line options
+int parse_options(struct sOptions *opts, int argc, char *argv[]);
 
 // free options
-void freeOptions();
+void freeOptions(struct sOptions *opts);
 
 #endif // __options_h__
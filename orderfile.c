@@ -0,0 +1,302 @@
+/*
+ * This file contains/describes the order file that gives a curated order of
+ * files and directories, e.g. an m3u playlist or a plain list of paths. The
+ * paths are compiled into a hash table from path to rank once, so every
+ * entry is ranked with a single lookup.
+ */
+
+#include "orderfile.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "entrylist.h"
+#include "errors.h"
+
+unsigned char foldOrderChar(char c) {
+  /*
+   * ASCII case folding, FAT32 names don't differ in case only
+   */
+  return (unsigned char) (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+unsigned hashOrderPath(unsigned hash, const char *str) {
+  /*
+   * FNV-1a hash of a path that ignores ASCII case, continued from hash
+   */
+
+  for (; *str; str++) {
+    hash ^= foldOrderChar(*str);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+int equalsOrderPath(const char *a, const char *b, size_t len) {
+  /*
+   * compares the first len characters of two paths ignoring ASCII case
+   */
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (foldOrderChar(a[i]) != foldOrderChar(b[i]))
+      return 0;
+  }
+  return 1;
+}
+
+size_t normalizeOrderPath(const char *line, char *path) {
+  /*
+   * converts a line of an order file into an absolute path like
+   * "/Music/Album/01.mp3", backslashes and drive letters of Windows paths
+   * are accepted, returns the length of the path or 0 if the line doesn't
+   * name a path on the device
+   */
+
+  size_t len = 1;
+
+  // URLs of streams are not on the device
+  if (strstr(line, "://"))
+    return 0;
+
+  if (((line[0] >= 'A' && line[0] <= 'Z') ||
+      (line[0] >= 'a' && line[0] <= 'z')) && line[1] == ':')
+    line += 2;
+  while (line[0] == '.' && (line[1] == '/' || line[1] == '\\'))
+    line += 2;
+
+  path[0] = '/';
+  for (; *line; line++) {
+    if (*line == '/' || *line == '\\') {
+      if (path[len - 1] != '/')
+        path[len++] = '/';
+    }
+    else
+      path[len++] = *line;
+  }
+
+  // directories may be listed with a trailing slash
+  if (len > 1 && path[len - 1] == '/')
+    len--;
+  path[len] = 0;
+
+  return len > 1 ? len : 0;
+}
+
+size_t findOrderSlot(const struct sOrderTable *table, const char *path,
+  size_t len, unsigned hash) {
+  /*
+   * returns the slot that holds path or the free slot where it belongs
+   */
+  const struct sOrderPath *slot;
+  size_t j;
+
+  for (j = hash & (table->size - 1); table->slots[j].len;
+    j = (j + 1) & (table->size - 1)) {
+    slot = &table->slots[j];
+    if (slot->hash == hash && slot->len == len &&
+      equalsOrderPath(table->pool + slot->offset, path, len))
+      break;
+  }
+  return j;
+}
+
+int growOrderTable(struct sOrderTable *table) {
+  /*
+   * doubles the hash table
+   */
+
+  struct sOrderPath *old = table->slots;
+  size_t size = table->size, j, k;
+
+  table->size = size ? size * 2 : 1024;
+  table->slots = calloc(table->size, sizeof(*table->slots));
+  if (!table->slots) {
+    stderror();
+    table->slots = old;
+    table->size = size;
+    return -1;
+  }
+
+  for (j = 0; j < size; j++) {
+    if (old[j].len) {
+      for (k = old[j].hash & (table->size - 1); table->slots[k].len;
+        k = (k + 1) & (table->size - 1));
+      table->slots[k] = old[j];
+    }
+  }
+  free(old);
+
+  return 0;
+}
+
+int addOrderPath(struct sOrderTable *table, const char *path, size_t len) {
+  /*
+   * add a path with the next rank, only the first occurrence of a path
+   * counts
+   */
+
+  unsigned hash;
+  size_t j, size;
+  char *pool;
+
+  if ((table->paths + 1) * 2 > table->size && growOrderTable(table))
+    return -1;
+
+  hash = hashOrderPath(ORDER_HASH_INIT, path);
+  j = findOrderSlot(table, path, len, hash);
+  if (table->slots[j].len)
+    return 0;
+
+  if (table->poolLen + len + 1 > table->poolSize) {
+    size = table->poolSize ? table->poolSize : 0x10000;
+    while (table->poolLen + len + 1 > size)
+      size *= 2;
+    pool = realloc(table->pool, size);
+    if (!pool) {
+      stderror();
+      return -1;
+    }
+    table->pool = pool;
+    table->poolSize = size;
+  }
+  memcpy(table->pool + table->poolLen, path, len + 1);
+
+  table->slots[j].offset = table->poolLen;
+  table->slots[j].len = len;
+  table->slots[j].hash = hash;
+  table->slots[j].rank = (unsigned) table->paths++;
+  table->poolLen += len + 1;
+
+  return 0;
+}
+
+struct sOrderTable *loadOrderTable(const char *filename) {
+  /*
+   * read an m3u playlist or a list of paths into a new order table, the
+   * file has one path per line, empty lines and lines starting with # (like
+   * the #EXTINF lines of m3u playlists) are skipped
+   */
+
+  char line[PATH_MAX + 2], path[PATH_MAX + 2], *str;
+  struct sOrderTable *table;
+  FILE *fd;
+  size_t len;
+  int first = 1;
+
+  table = calloc(1, sizeof(*table));
+  if (!table) {
+    stderror();
+    return 0;
+  }
+
+  fd = fopen(filename, "r");
+  if (!fd) {
+    stderror();
+    myerror("Failed to open order file '%s'!", filename);
+    freeOrderTable(table);
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), fd)) {
+    len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      myerror("Line in order file '%s' is too long!", filename);
+      fclose(fd);
+      freeOrderTable(table);
+      return 0;
+    }
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = 0;
+
+    // m3u8 playlists may start with a byte order mark
+    str = line;
+    if (first && !strncmp(str, "\xEF\xBB\xBF", 3))
+      str += 3;
+    first = 0;
+
+    if (!str[0] || str[0] == '#')
+      continue;
+    len = normalizeOrderPath(str, path);
+    if (len && addOrderPath(table, path, len)) {
+      fclose(fd);
+      freeOrderTable(table);
+      return 0;
+    }
+  }
+
+  if (ferror(fd)) {
+    stderror();
+    myerror("Failed to read order file '%s'!", filename);
+    fclose(fd);
+    freeOrderTable(table);
+    return 0;
+  }
+
+  fclose(fd);
+
+  return table;
+}
+
+unsigned lookupOrderRank(const struct sOrderTable *table, const char *path,
+  size_t pathLen, unsigned pathHash, const char *name) {
+  /*
+   * returns the rank of name in directory path or ORDER_UNLISTED, the hash
+   * of the directory is continued with the name, so the full path of the
+   * entry is never built
+   */
+
+  const struct sOrderPath *slot;
+  size_t j, nameLen;
+  unsigned hash;
+
+  if (!table->paths)
+    return ORDER_UNLISTED;
+
+  nameLen = strlen(name);
+  hash = hashOrderPath(pathHash, name);
+  for (j = hash & (table->size - 1); table->slots[j].len;
+    j = (j + 1) & (table->size - 1)) {
+    slot = &table->slots[j];
+    if (slot->hash == hash && slot->len == pathLen + nameLen &&
+      equalsOrderPath(table->pool + slot->offset, path, pathLen) &&
+      equalsOrderPath(table->pool + slot->offset + pathLen, name, nameLen))
+      return slot->rank;
+  }
+
+  return ORDER_UNLISTED;
+}
+
+void assignOrderRanks(const struct sOrderTable *table, const char *path,
+  struct sDirEntryList *list) {
+  /*
+   * set the ranks of all entries of directory path, entries are looked up
+   * by their long name or by their short name if they have none
+   */
+
+  struct sDirEntryList *tmp;
+  size_t pathLen = strlen(path);
+  unsigned pathHash = hashOrderPath(ORDER_HASH_INIT, path);
+
+  for (tmp = list->next; tmp; tmp = tmp->next) {
+    if (tmp->rank != RANK_ENTRY)
+      tmp->order = ORDER_UNLISTED;
+    else {
+      tmp->order = lookupOrderRank(table, path, pathLen, pathHash,
+        tmp->lname && tmp->lname[0] ? tmp->lname : tmp->sname);
+    }
+  }
+}
+
+void freeOrderTable(struct sOrderTable *table) {
+  /*
+   * free an order table
+   */
+
+  if (!table)
+    return;
+  free(table->slots);
+  free(table->pool);
+  free(table);
+}
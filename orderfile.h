@@ -0,0 +1,59 @@
+/*
+ * This file contains/describes the order file that gives a curated order of
+ * files and directories, e.g. an m3u playlist or a plain list of paths. The
+ * paths are compiled into a hash table from path to rank once, so every
+ * entry is ranked with a single lookup.
+ */
+
+#ifndef __orderfile_h__
+#define __orderfile_h__
+
+#include <stddef.h>
+
+struct sDirEntryList;
+
+// rank of entries that are not listed in the order file
+#define ORDER_UNLISTED 0xFFFFFFFFU
+
+// initial value of hashOrderPath()
+#define ORDER_HASH_INIT 2166136261U
+
+struct sOrderPath {
+  /*
+   * one listed path in the hash table
+   */
+  size_t offset, len; // path in the string pool, 0 length for unused slots
+  unsigned hash;
+  unsigned rank; // line of the path among all listed paths
+};
+
+struct sOrderTable {
+  /*
+   * paths of the order file in an open addressing hash table
+   */
+  struct sOrderPath *slots;
+  size_t size; // available slots, a power of two
+  size_t paths; // listed paths without duplicates
+  char *pool; // all paths, zero terminated
+  size_t poolLen, poolSize;
+};
+
+// FNV-1a hash of a path that ignores ASCII case, continued from hash
+unsigned hashOrderPath(unsigned hash, const char *str);
+
+// read an m3u playlist or a list of paths into a new order table
+struct sOrderTable *loadOrderTable(const char *filename);
+
+// returns the rank of name in directory path or ORDER_UNLISTED, pathHash is
+// the hash of path
+unsigned lookupOrderRank(const struct sOrderTable *table, const char *path,
+  size_t pathLen, unsigned pathHash, const char *name);
+
+// set the ranks of all entries of directory path
+void assignOrderRanks(const struct sOrderTable *table, const char *path,
+  struct sDirEntryList *list);
+
+// free an order table
+void freeOrderTable(struct sOrderTable *table);
+
+#endif // __orderfile_h__
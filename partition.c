@@ -0,0 +1,245 @@
+/*
+ * This file contains/describes functions that read MBR and GPT partition
+ * tables, so the FAT32 file systems of whole disk images are opened in
+ * place at the offsets of their partitions.
+ */
+
+#include "partition.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "fileio.h"
+
+// MBR partition types of extended partitions and of GPT disks
+#define MBR_TYPE_EXTENDED 0x05
+#define MBR_TYPE_EXTENDED_LBA 0x0F
+#define MBR_TYPE_EXTENDED_LINUX 0x85
+#define MBR_TYPE_GPT 0xEE
+
+// offset of the four partition entries in an MBR or EBR
+#define MBR_ENTRIES 446
+
+// largest GPT partition entry array that is read
+#define GPT_MAX_ENTRIES_SIZE 0x100000
+
+uint32_t getLE32(const unsigned char *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+    (uint32_t) p[3] << 24;
+}
+
+uint64_t getLE64(const unsigned char *p) {
+  return (uint64_t) getLE32(p) | (uint64_t) getLE32(p + 4) << 32;
+}
+
+int readAt(struct sDevice *dev, uint64_t offset, void *buf, size_t len) {
+  /*
+   * reads len bytes at offset of the device
+   */
+
+  if (offset > INT64_MAX || fs_seek(dev, (int64_t) offset, SEEK_SET) == -1) {
+    stderror();
+    return -1;
+  }
+  if (!fs_read(buf, 1, len, dev)) {
+    myerror("Failed to read %lu bytes at offset %#llx!", (unsigned long) len,
+      (unsigned long long) offset);
+    return -1;
+  }
+  return 0;
+}
+
+int isFAT32Volume(const unsigned char *sector) {
+  /*
+   * quiet check of the boot sector of a FAT32 volume: jump instruction,
+   * signature, a sector size that is a power of two and 32-bit FAT32s only
+   */
+  unsigned bytesPerSector = sector[11] | (unsigned) sector[12] << 8;
+
+  return (sector[0] == 0xEB || sector[0] == 0xE9) && sector[510] == 0x55 &&
+    sector[511] == 0xAA && bytesPerSector >= 512 && bytesPerSector <= 4096 &&
+    !(bytesPerSector & (bytesPerSector - 1)) && sector[13] &&
+    !sector[22] && !sector[23] && getLE32(sector + 36);
+}
+
+int addPartition(struct sDevice *dev, struct sPartition *parts, int *count,
+  int max, unsigned number, uint64_t offset, uint64_t size) {
+  /*
+   * adds a partition if it holds a FAT32 file system
+   */
+  unsigned char sector[MBR_SECTOR_SIZE];
+
+  if (size < MBR_SECTOR_SIZE)
+    return 0;
+  if (readAt(dev, offset, sector, sizeof(sector))) {
+    myerror("Failed to read boot sector of partition %u!", number);
+    return -1;
+  }
+  if (!isFAT32Volume(sector))
+    return 0;
+
+  if (*count == max) {
+    myerror("Too many FAT32 partitions, at most %d are supported!", max);
+    return -1;
+  }
+  parts[*count].number = number;
+  parts[*count].offset = offset;
+  parts[*count].size = size;
+  (*count)++;
+
+  return 0;
+}
+
+int readLogicalPartitions(struct sDevice *dev, uint64_t extended,
+  struct sPartition *parts, int *count, int max) {
+  /*
+   * follows the chain of extended boot records, each of them describes one
+   * logical partition relative to itself and the next record relative to
+   * the extended partition
+   */
+
+  unsigned char ebr[MBR_SECTOR_SIZE], *entry;
+  uint64_t record = extended;
+  unsigned number;
+
+  // a chain that loops is cut after the largest number of partitions
+  for (number = 5; number < 5 + MAX_PARTITIONS; number++) {
+    if (readAt(dev, record * MBR_SECTOR_SIZE, ebr, sizeof(ebr)))
+      return -1;
+    if (ebr[510] != 0x55 || ebr[511] != 0xAA) {
+      myerror("Extended boot record at sector %llu is damaged!",
+        (unsigned long long) record);
+      return -1;
+    }
+
+    entry = ebr + MBR_ENTRIES;
+    if (entry[4] && getLE32(entry + 12) &&
+      addPartition(dev, parts, count, max, number,
+        (record + getLE32(entry + 8)) * MBR_SECTOR_SIZE,
+        (uint64_t) getLE32(entry + 12) * MBR_SECTOR_SIZE))
+      return -1;
+
+    entry += 16;
+    if (!entry[4] || !getLE32(entry + 8))
+      break;
+    record = extended + getLE32(entry + 8);
+  }
+
+  return 0;
+}
+
+int readGPTPartitions(struct sDevice *dev, struct sPartition *parts,
+  int *count, int max) {
+  /*
+   * reads the partition entries of a GPT disk, the header is in the second
+   * logical block, which has 512 or 4096 bytes
+   */
+
+  unsigned char header[MBR_SECTOR_SIZE], *entries, *entry, zero[16] = { 0 };
+  uint64_t blockSize, first, last;
+  uint32_t n, entrySize, j;
+
+  for (blockSize = 512; blockSize <= 4096; blockSize *= 8) {
+    if (readAt(dev, blockSize, header, sizeof(header)))
+      return -1;
+    if (!memcmp(header, "EFI PART", 8))
+      break;
+  }
+  if (blockSize > 4096) {
+    myerror("GPT header is missing!");
+    return -1;
+  }
+
+  n = getLE32(header + 80);
+  entrySize = getLE32(header + 84);
+  if (entrySize < 128 || entrySize % 8 ||
+    (uint64_t) n * entrySize > GPT_MAX_ENTRIES_SIZE) {
+    myerror("GPT header is damaged!");
+    return -1;
+  }
+  if (!n)
+    return 0;
+
+  entries = malloc((size_t) n * entrySize);
+  if (!entries) {
+    stderror();
+    return -1;
+  }
+  if (readAt(dev, getLE64(header + 72) * blockSize, entries,
+      (size_t) n * entrySize)) {
+    free(entries);
+    return -1;
+  }
+
+  // unused entries have a zero type
+  for (j = 0; j < n; j++) {
+    entry = entries + (size_t) j * entrySize;
+    first = getLE64(entry + 32);
+    last = getLE64(entry + 40);
+    if (!memcmp(entry, zero, sizeof(zero)) || last < first)
+      continue;
+    if (addPartition(dev, parts, count, max, j + 1, first * blockSize,
+        (last - first + 1) * blockSize)) {
+      free(entries);
+      return -1;
+    }
+  }
+
+  free(entries);
+
+  return 0;
+}
+
+int readPartitions(struct sDevice *dev, struct sPartition *parts, int max) {
+  /*
+   * reads the partition table of a device and puts its FAT32 partitions to
+   * parts, a FAT32 file system at offset 0 has no partition table
+   */
+
+  unsigned char mbr[MBR_SECTOR_SIZE], *entry;
+  int count = 0, gpt = 0, j;
+
+  if (readAt(dev, 0, mbr, sizeof(mbr)))
+    return -1;
+
+  // anything but a valid MBR is left to the boot sector checks
+  if (isFAT32Volume(mbr) || mbr[510] != 0x55 || mbr[511] != 0xAA)
+    return 0;
+  for (j = 0; j < 4; j++) {
+    entry = mbr + MBR_ENTRIES + 16 * j;
+    if (entry[0] != 0x00 && entry[0] != 0x80)
+      return 0;
+    if (entry[4] == MBR_TYPE_GPT)
+      gpt = 1;
+  }
+
+  if (gpt) {
+    if (readGPTPartitions(dev, parts, &count, max))
+      return -1;
+  }
+  else {
+    for (j = 0; j < 4; j++) {
+      entry = mbr + MBR_ENTRIES + 16 * j;
+      if (!entry[4] || !getLE32(entry + 12))
+        continue;
+      if (entry[4] == MBR_TYPE_EXTENDED || entry[4] == MBR_TYPE_EXTENDED_LBA ||
+        entry[4] == MBR_TYPE_EXTENDED_LINUX) {
+        if (readLogicalPartitions(dev, getLE32(entry + 8), parts, &count,
+            max))
+          return -1;
+      }
+      else if (addPartition(dev, parts, &count, max, (unsigned) j + 1,
+          (uint64_t) getLE32(entry + 8) * MBR_SECTOR_SIZE,
+          (uint64_t) getLE32(entry + 12) * MBR_SECTOR_SIZE))
+        return -1;
+    }
+  }
+
+  if (!count) {
+    myerror("Partition table has no FAT32 partition!");
+    return -1;
+  }
+
+  return count;
+}
@@ -0,0 +1,32 @@
+/*
+ * This file contains/describes functions that read MBR and GPT partition
+ * tables, so the FAT32 file systems of whole disk images are opened in
+ * place at the offsets of their partitions.
+ */
+
+#ifndef __partition_h__
+#define __partition_h__
+
+#include <stdint.h>
+
+struct sDevice;
+
+// upper limit for the number of partitions of a device
+#define MAX_PARTITIONS 128
+
+// size of the sectors that MBR addresses are given in
+#define MBR_SECTOR_SIZE 512
+
+struct sPartition {
+  /*
+   * FAT32 partition of a device, number 0 is the whole device
+   */
+  unsigned number; // 1-4 primary and 5+ logical MBR or GPT entry number
+  uint64_t offset, size; // bytes
+};
+
+// reads the partition table of a device and puts its FAT32 partitions to
+// parts, returns their count, 0 if the device has no partition table or -1
+int readPartitions(struct sDevice *dev, struct sPartition *parts, int max);
+
+#endif // __partition_h__
@@ -0,0 +1,165 @@
+/*
+ * This file contains/describes the progress counters and the reporter thread
+ * that prints them periodically. The counters are updated with relaxed atomic
+ * increments, so they are cheap enough to be always on.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "progress.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "errors.h"
+
+struct sProgress PROGRESS;
+
+struct sReporter {
+  /*
+   * state of the reporter thread
+   */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  int running, stopping;
+  double start, last; // start and time of the last line
+  unsigned long long bytes; // bytes read and written at the last line
+};
+
+struct sReporter reporter;
+
+double getProgressTime() {
+  /*
+   * returns a monotonic time in seconds
+   */
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+unsigned long long loadProgress(atomic_ullong *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void printProgress(int last) {
+  /*
+   * print one progress line with throughput since the last line and the
+   * time that remains for the directories that were found so far
+   */
+
+  unsigned long long done, queued, entries, bytesRead, bytesWritten;
+  double now, rate, eta;
+
+  done = loadProgress(&PROGRESS.directories);
+  queued = loadProgress(&PROGRESS.queued);
+  entries = loadProgress(&PROGRESS.entries);
+  bytesRead = loadProgress(&PROGRESS.bytesRead);
+  bytesWritten = loadProgress(&PROGRESS.bytesWritten);
+
+  now = getProgressTime();
+  rate = now > reporter.last ? (double) (bytesRead + bytesWritten -
+      reporter.bytes) / (now - reporter.last) : 0;
+  if (last)
+    rate = now > reporter.start ? (double) (bytesRead + bytesWritten) /
+      (now - reporter.start) : 0;
+  reporter.last = now;
+  reporter.bytes = bytesRead + bytesWritten;
+
+  fprintf(stderr, "Progress: %llu/%llu directories, %llu entries, "
+    "%.1f MB read, %.1f MB written, %.1f MB/s", done, queued, entries,
+    (double) bytesRead / 1048576, (double) bytesWritten / 1048576,
+    rate / 1048576);
+
+  // every directory is assumed to take the average time so far
+  if (last)
+    fprintf(stderr, ", done in %.0f s\n", now - reporter.start);
+  else if (done && queued > done) {
+    eta = (now - reporter.start) * (double) (queued - done) / (double) done;
+    fprintf(stderr, ", ETA %u:%02u\n", (unsigned) eta / 60,
+      (unsigned) eta % 60);
+  }
+  else
+    fprintf(stderr, "\n");
+}
+
+void *progressReporter(void *arg) {
+  /*
+   * print a progress line every PROGRESS_INTERVAL seconds until the
+   * reporter is stopped
+   */
+
+  struct timespec ts;
+  int ret;
+
+  (void) arg;
+
+  pthread_mutex_lock(&reporter.lock);
+  clock_gettime(CLOCK_REALTIME, &ts);
+  while (!reporter.stopping) {
+    ts.tv_sec += PROGRESS_INTERVAL;
+    do
+      ret = pthread_cond_timedwait(&reporter.stop, &reporter.lock, &ts);
+    while (!reporter.stopping && ret != ETIMEDOUT);
+    if (!reporter.stopping)
+      printProgress(0);
+  }
+  pthread_mutex_unlock(&reporter.lock);
+
+  return 0;
+}
+
+int startProgress() {
+  /*
+   * start the thread that prints progress lines to stderr
+   */
+
+  reporter.running = 0;
+  reporter.stopping = 0;
+  reporter.start = reporter.last = getProgressTime();
+  reporter.bytes = 0;
+
+  if (pthread_mutex_init(&reporter.lock, 0)) {
+    myerror("Failed to initialize mutex!");
+    return -1;
+  }
+  if (pthread_cond_init(&reporter.stop, 0)) {
+    myerror("Failed to initialize condition variable!");
+    pthread_mutex_destroy(&reporter.lock);
+    return -1;
+  }
+  if (pthread_create(&reporter.thread, 0, progressReporter, 0)) {
+    myerror("Failed to start progress thread!");
+    pthread_cond_destroy(&reporter.stop);
+    pthread_mutex_destroy(&reporter.lock);
+    return -1;
+  }
+  reporter.running = 1;
+
+  return 0;
+}
+
+void stopProgress() {
+  /*
+   * stop the reporter thread and print a last progress line
+   */
+
+  if (!reporter.running)
+    return;
+
+  pthread_mutex_lock(&reporter.lock);
+  reporter.stopping = 1;
+  pthread_cond_signal(&reporter.stop);
+  pthread_mutex_unlock(&reporter.lock);
+
+  pthread_join(reporter.thread, 0);
+  pthread_cond_destroy(&reporter.stop);
+  pthread_mutex_destroy(&reporter.lock);
+  reporter.running = 0;
+
+  printProgress(1);
+}
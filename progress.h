@@ -0,0 +1,38 @@
+/*
+ * This file contains/describes the progress counters and the reporter thread
+ * that prints them periodically. The counters are updated with relaxed atomic
+ * increments, so they are cheap enough to be always on.
+ */
+
+#ifndef __progress_h__
+#define __progress_h__
+
+#include <stdatomic.h>
+
+// seconds between two progress lines
+#define PROGRESS_INTERVAL 2
+
+struct sProgress {
+  /*
+   * counters of all devices that are processed
+   */
+  atomic_ullong directories; // directories that are done
+  atomic_ullong queued; // directories that were found so far
+  atomic_ullong entries; // directory entries of the done directories
+  atomic_ullong bytesRead, bytesWritten;
+};
+
+extern struct sProgress PROGRESS;
+
+// add n to a progress counter
+#define addProgress(counter, n) \
+  atomic_fetch_add_explicit(&PROGRESS.counter, (unsigned long long) (n), \
+    memory_order_relaxed)
+
+// start the thread that prints progress lines to stderr
+int startProgress();
+
+// stop the reporter thread and print a last progress line
+void stopProgress();
+
+#endif // __progress_h__
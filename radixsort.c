@@ -0,0 +1,177 @@
+/*
+ * This file contains/describes radix sort functions for arrays of directory
+ * entries with precomputed sort keys.
+ */
+
+#include "radixsort.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "entrylist.h"
+#include "FAT32.h"
+
+// buckets smaller than this are sorted by insertion sort
+#define MSD_INSERTION_CUTOFF 16
+
+int cmpKeys(struct sDirEntryList *de1, struct sDirEntryList *de2,
+  size_t depth) {
+  /*
+   * compare byte sort keys of two entries starting at depth
+   */
+
+  size_t len1, len2;
+  int ret;
+
+  len1 = de1->keylen - depth;
+  len2 = de2->keylen - depth;
+
+  ret = memcmp(de1->key + depth, de2->key + depth, len1 < len2 ? len1 : len2);
+  if (ret)
+    return ret;
+  if (len1 < len2)
+    return -1;
+  if (len1 > len2)
+    return 1;
+  return 0;
+}
+
+void insertionSortKeys(struct sDirEntryList **entries, size_t n, size_t depth,
+  int descending) {
+  /*
+   * stable insertion sort of small buckets
+   */
+
+  struct sDirEntryList *tmp;
+  size_t i, j;
+  int ret;
+
+  for (i = 1; i < n; i++) {
+    tmp = entries[i];
+    for (j = i; j > 0; j--) {
+      ret = cmpKeys(entries[j - 1], tmp, depth);
+      if (descending ? ret >= 0 : ret <= 0)
+        break;
+      entries[j] = entries[j - 1];
+    }
+    entries[j] = tmp;
+  }
+}
+
+void msdRadixSortFrom(struct sDirEntryList **entries,
+  struct sDirEntryList **aux, size_t n, size_t depth, int descending) {
+  /*
+   * sorts entries whose keys are equal up to depth by the remaining bytes
+   */
+
+  /*
+   * bucket 0 holds keys that end at the current depth, buckets 1 to 256 hold
+   * the byte values 0 to 255
+   */
+  size_t count[257], start[257];
+  size_t i, b, pos;
+
+  if (n < MSD_INSERTION_CUTOFF) {
+    insertionSortKeys(entries, n, depth, descending);
+    return;
+  }
+
+  // skip common prefixes without recursion
+  while (1) {
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      b = entries[i]->keylen > depth ? entries[i]->key[depth] + 1U : 0;
+      count[b]++;
+    }
+
+    b = entries[0]->keylen > depth ? entries[0]->key[depth] + 1U : 0;
+    if (count[b] != n || !b)
+      break;
+    depth++;
+  }
+
+  /*
+   * ended keys sort before longer keys in ascending order and after them in
+   * descending order
+   */
+  pos = 0;
+  if (descending) {
+    for (b = 257; b-- > 0;) {
+      start[b] = pos;
+      pos += count[b];
+    }
+  }
+  else {
+    for (b = 0; b < 257; b++) {
+      start[b] = pos;
+      pos += count[b];
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    b = entries[i]->keylen > depth ? entries[i]->key[depth] + 1U : 0;
+    aux[start[b]++] = entries[i];
+  }
+  memcpy(entries, aux, n * sizeof(*entries));
+
+  // start[b] now points behind bucket b, entries in bucket 0 are all equal
+  for (b = 1; b < 257; b++) {
+    if (count[b] > 1)
+      msdRadixSortFrom(entries + start[b] - count[b],
+        aux + start[b] - count[b], count[b], depth + 1, descending);
+  }
+}
+
+void msdRadixSort(struct sDirEntryList **entries, struct sDirEntryList **aux,
+  size_t n, int descending) {
+  /*
+   * stable MSD radix sort of entries by their byte sort keys
+   */
+
+  msdRadixSortFrom(entries, aux, n, 0, descending);
+}
+
+void lsdRadixSort(struct sDirEntryList **entries, struct sDirEntryList **aux,
+  size_t n, int descending) {
+  /*
+   * stable LSD radix sort of entries by their packed modification time
+   */
+
+  struct sDirEntryList **src = entries, **dst = aux, **tmp;
+  size_t count[256];
+  size_t i, b, pos;
+  uint32_t key;
+  unsigned shift;
+
+  // four passes over the 8-bit digits of DIR_WrtDate << 16 | DIR_WrtTime
+  for (shift = 0; shift < 32; shift += 8) {
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      key = (uint32_t) src[i]->sde->DIR_WrtDate << 16 |
+        src[i]->sde->DIR_WrtTime;
+      if (descending)
+        key = ~key;
+      count[key >> shift & 0xFF]++;
+    }
+
+    pos = 0;
+    for (b = 0; b < 256; b++) {
+      i = count[b];
+      count[b] = pos;
+      pos += i;
+    }
+
+    for (i = 0; i < n; i++) {
+      key = (uint32_t) src[i]->sde->DIR_WrtDate << 16 |
+        src[i]->sde->DIR_WrtTime;
+      if (descending)
+        key = ~key;
+      dst[count[key >> shift & 0xFF]++] = src[i];
+    }
+
+    tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  // an even number of passes leaves the result in entries
+}
@@ -0,0 +1,20 @@
+/*
+ * This file contains/describes radix sort functions for arrays of directory
+ * entries with precomputed sort keys.
+ */
+
+#ifndef __radixsort_h__
+#define __radixsort_h__
+
+#include <stddef.h>
+struct sDirEntryList;
+
+// stable MSD radix sort of entries by their byte sort keys
+void msdRadixSort(struct sDirEntryList **entries, struct sDirEntryList **aux,
+  size_t n, int descending);
+
+// stable LSD radix sort of entries by their packed modification time
+void lsdRadixSort(struct sDirEntryList **entries, struct sDirEntryList **aux,
+  size_t n, int descending);
+
+#endif // __radixsort_h__
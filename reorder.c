@@ -0,0 +1,266 @@
+/*
+ * This file contains/describes functions that move the data of the files of
+ * a directory to one contiguous run of free clusters, so the files are laid
+ * out on the device in the sorted order of the directory.
+ */
+
+#include "reorder.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clusterchain.h"
+#include "entrylist.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "fileio.h"
+#include "freespace.h"
+#include "sort.h"
+
+unsigned getFileCluster(const struct sDirEntryList *entry) {
+  /*
+   * returns the start cluster of a file that has data or 0 for all other
+   * entries
+   */
+
+  const struct sShortDirEntry *sde = entry->sde;
+
+  if ((sde->DIR_Name[0] & 0xFF) == DE_FREE || sde->DIR_Name[0] == '.' ||
+    sde->DIR_Atrr & (ATTR_DIRECTORY | ATTR_VOLUME_ID))
+    return 0;
+
+  return sde->DIR_FstClusHI * 65536U + sde->DIR_FstClusLO;
+}
+
+int copyClusters(struct sFileSystem *fs, struct sClusterChain *chain,
+  unsigned clen, unsigned start, char *buf, unsigned bufClusters) {
+  /*
+   * copies clen clusters of a cluster chain to the clusters following
+   * start, clusters that follow each other are copied at once
+   */
+
+  unsigned done = 0, n;
+  struct sClusterChain *tmp;
+
+  chain = chain->next; // head element
+  while (done < clen) {
+    // collect a run of adjacent clusters that fits into the buffer
+    for (n = 1, tmp = chain; n < bufClusters && done + n < clen &&
+      tmp->next->cluster == tmp->cluster + 1; n++)
+      tmp = tmp->next;
+
+    if (fs_seek(fs->fd, getClusterOffset(fs, chain->cluster), SEEK_SET) ==
+      -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_read(buf, fs->clusterSize, n, fs->fd)) {
+      myerror("Failed to read from file!");
+      return -1;
+    }
+    if (fs_seek(fs->fd, getClusterOffset(fs, start + done), SEEK_SET) ==
+      -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_write(buf, fs->clusterSize, n, fs->fd)) {
+      myerror("Failed to write to file!");
+      return -1;
+    }
+
+    done += n;
+    chain = tmp->next;
+  }
+
+  return 0;
+}
+
+int linkClusters(struct sFileSystem *fs, unsigned start, unsigned clen) {
+  /*
+   * links clen clusters following start to a cluster chain
+   */
+
+  unsigned j;
+
+  for (j = 0; j < clen; j++) {
+    if (setFAT32Entry(fs, start + j, j + 1 < clen ? start + j + 1 :
+        FAT32_EOC_MARK)) {
+      myerror("Failed to set FAT32 entry!");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int reorderFiles(struct sFileSystem *fs, struct sFreeSpace *space,
+  struct sDirEntryList *list, unsigned long long budget,
+  struct sFileMoves *moves) {
+  /*
+   * moves the files of a sorted directory entry list to one run of free
+   * clusters in list order and sets their new start clusters in list, the
+   * old cluster chains are returned in moves and still allocated, returns
+   * one of the REORDER_ results
+   */
+
+  struct sDirEntryList *ki;
+  struct sClusterChain *tmp;
+  unsigned *clens, cluster, prev = 0, start, total = 0, bufClusters;
+  size_t n = 0, j;
+  int clen, inOrder = 1;
+  char *buf;
+
+  memset(moves, 0, sizeof(*moves));
+
+  for (ki = list->next; ki; ki = ki->next) {
+    if (getFileCluster(ki))
+      n++;
+  }
+  if (!n)
+    return REORDER_IN_ORDER;
+
+  moves->chains = calloc(n, sizeof(*moves->chains));
+  clens = malloc(n * sizeof(*clens));
+  if (!moves->chains || !clens) {
+    stderror();
+    free(clens);
+    freeFileMoves(moves);
+    return -1;
+  }
+
+  // read the cluster chains of all files
+  for (ki = list->next; ki; ki = ki->next) {
+    cluster = getFileCluster(ki);
+    if (!cluster)
+      continue;
+
+    moves->chains[moves->len] = newClusterChain();
+    if (!moves->chains[moves->len]) {
+      myerror("Failed to generate new ClusterChain!");
+      free(clens);
+      freeFileMoves(moves);
+      return -1;
+    }
+    clen = getClusterChain(fs, cluster, moves->chains[moves->len++]);
+    if (clen == -1) {
+      myerror("Failed to get cluster chain of file '%s'!", ki->sname);
+      free(clens);
+      freeFileMoves(moves);
+      return -1;
+    }
+    clens[moves->len - 1] = (unsigned) clen;
+    total += (unsigned) clen;
+
+    // every file has to continue right behind the previous one
+    for (tmp = moves->chains[moves->len - 1]->next; tmp; tmp = tmp->next) {
+      if (prev && tmp->cluster != prev + 1)
+        inOrder = 0;
+      prev = tmp->cluster;
+    }
+  }
+
+  if (inOrder) {
+    free(clens);
+    freeFileMoves(moves);
+    return REORDER_IN_ORDER;
+  }
+  if ((unsigned long long) total * fs->clusterSize > budget) {
+    free(clens);
+    freeFileMoves(moves);
+    return REORDER_BUDGET;
+  }
+  start = findFreeRun(space, total);
+  if (!start) {
+    free(clens);
+    freeFileMoves(moves);
+    return REORDER_NO_SPACE;
+  }
+
+  // the directory buffer is not in use while files are moved
+  buf = fs->dirBuf;
+  bufClusters = (unsigned) ((fs->dirBufSize < MOVE_BUFFER_SIZE ?
+    fs->dirBufSize : MOVE_BUFFER_SIZE) / fs->clusterSize);
+
+  markClusters(space, start, total, 0);
+
+  // copy files one after another, the old chains stay intact
+  cluster = start;
+  j = 0;
+  for (ki = list->next; ki; ki = ki->next) {
+    if (!getFileCluster(ki))
+      continue;
+    if (copyClusters(fs, moves->chains[j], clens[j], cluster, buf,
+        bufClusters) || linkClusters(fs, cluster, clens[j])) {
+      myerror("Failed to move file '%s'!", ki->sname);
+      free(clens);
+      freeFileMoves(moves);
+      return -1;
+    }
+    ki->sde->DIR_FstClusHI = (uint16_t) (cluster >> 16);
+    ki->sde->DIR_FstClusLO = (uint16_t) (cluster & 0xFFFF);
+    cluster += clens[j++];
+  }
+
+  free(clens);
+
+  if (updateFSInfo(fs, 0, start + total)) {
+    myerror("Failed to update FSInfo!");
+    freeFileMoves(moves);
+    return -1;
+  }
+
+  moves->bytes = (unsigned long long) total * fs->clusterSize;
+
+  return REORDER_MOVED;
+}
+
+int releaseFileMoves(struct sFileSystem *fs, struct sFreeSpace *space,
+  struct sFileMoves *moves) {
+  /*
+   * release the old cluster chains of moved files
+   */
+
+  struct sClusterChain *tmp;
+  size_t j;
+
+  if (!moves->len) {
+    freeFileMoves(moves);
+    return 0;
+  }
+
+  // the entries with the new start clusters are durable before the old
+  // chains are freed, so they never point to free clusters
+  if (syncFileSystem(fs)) {
+    myerror("Failed to sync file system!");
+    return -1;
+  }
+
+  for (j = 0; j < moves->len; j++) {
+    for (tmp = moves->chains[j]->next; tmp; tmp = tmp->next) {
+      if (setFAT32Entry(fs, tmp->cluster, 0)) {
+        myerror("Failed to set FAT32 entry!");
+        return -1;
+      }
+      markClusters(space, tmp->cluster, 1, 1);
+    }
+  }
+
+  freeFileMoves(moves);
+
+  return 0;
+}
+
+void freeFileMoves(struct sFileMoves *moves) {
+  /*
+   * free the old cluster chains without releasing them on the device
+   */
+
+  size_t j;
+
+  if (moves->chains) {
+    for (j = 0; j < moves->len; j++)
+      freeClusterChain(moves->chains[j]);
+    free(moves->chains);
+  }
+  memset(moves, 0, sizeof(*moves));
+}
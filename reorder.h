@@ -0,0 +1,48 @@
+/*
+ * This file contains/describes functions that move the data of the files of
+ * a directory to one contiguous run of free clusters, so the files are laid
+ * out on the device in the sorted order of the directory.
+ */
+
+#ifndef __reorder_h__
+#define __reorder_h__
+
+#include <stddef.h>
+
+struct sClusterChain;
+struct sDirEntryList;
+struct sFileSystem;
+struct sFreeSpace;
+
+// maximum size of the buffer that is used to copy clusters
+#define MOVE_BUFFER_SIZE 0x100000
+
+// results of reorderFiles()
+#define REORDER_IN_ORDER 0 // files are already laid out in order
+#define REORDER_MOVED 1 // files were moved
+#define REORDER_NO_SPACE 2 // no free run is large enough
+#define REORDER_BUDGET 3 // moving the files would exceed the budget
+
+struct sFileMoves {
+  /*
+   * old cluster chains of moved files, they are released after the
+   * directory with the new start clusters has been written
+   */
+  struct sClusterChain **chains;
+  size_t len;
+  unsigned long long bytes; // bytes moved
+};
+
+// move the files of a sorted directory entry list to one run of free clusters
+int reorderFiles(struct sFileSystem *fs, struct sFreeSpace *space,
+  struct sDirEntryList *list, unsigned long long budget,
+  struct sFileMoves *moves);
+
+// release the old cluster chains of moved files
+int releaseFileMoves(struct sFileSystem *fs, struct sFreeSpace *space,
+  struct sFileMoves *moves);
+
+// free the old cluster chains without releasing them on the device
+void freeFileMoves(struct sFileMoves *moves);
+
+#endif // __reorder_h__
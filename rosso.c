@@ -7,25 +7,44 @@
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 // project includes
+#include "batch.h"
 #include "errors.h"
 #include "FAT32.h"
+#include "fatstats.h"
+#include "fileio.h"
+#include "librosso.h"
+#include "listing.h"
 #include "options.h"
+#include "partition.h"
+#include "progress.h"
 #include "rosso.h"
-#include "sort.h"
+#include "stringlist.h"
 
-int printFSInfo(char *filename) {
+// options of all devices
+struct sOptions OPTIONS;
+
+// buffer of stdout for listings
+char listBuffer[LIST_BUFFER_SIZE];
+
+int printFSInfo(const struct sTarget *target) {
   /*
    * print file system information
    */
 
-  unsigned value;
+  unsigned value, j;
+  char label[24];
 
   struct sFileSystem fs;
+  struct sFAT32Stats stats;
+  struct sMediaStats media;
 
-  if (openFileSystem(filename, "rb", &fs)) {
+  if (openFileSystem(target->filename, "rb", OPTIONS.direct ? FS_DIRECT : 0,
+      target->partition.number ? &target->partition : 0,
+      OPTIONS.simulate ? &OPTIONS.mediaModel : 0, &fs)) {
     myerror("Failed to open file system!");
     return -1;
   }
@@ -40,6 +59,8 @@ int printFSInfo(char *filename) {
     fs.FAT32Size * fs.sectorSize, fs.bs.BS_NumFAT32s,
     checkFAT32s(&fs) ? "different" : "same", fs.clusterSize,
     fs.maxClusterChainLength, fs.clusters, fs.FSSize >> 20);
+  if (OPTIONS.direct)
+    printf("Direct I/O block size: %u bytes\n", fs_blockSize(fs.fd));
 
   if (fs.FSType != -1) {
     if (getFAT32Entry(&fs, fs.bs.BS_RootClus, &value) == -1) {
@@ -49,9 +70,55 @@ int printFSInfo(char *filename) {
     }
 
     printf("FAT32 root first cluster: %#x\n"
-      "First cluster data offset: %#x\n"
+      "First cluster data offset: %#llx\n"
       "First cluster FAT32 entry: %#x\n", fs.bs.BS_RootClus,
-      getClusterOffset(&fs, fs.bs.BS_RootClus), value);
+      (unsigned long long) getClusterOffset(&fs, fs.bs.BS_RootClus), value);
+
+    if (getFAT32Stats(&fs, &stats) == -1) {
+      myerror("Failed to get FAT32 statistics!");
+      closeFileSystem(&fs);
+      return -1;
+    }
+
+    printf("Free clusters: %u (%llu MiBytes)\n"
+      "Bad clusters: %u\n"
+      "End of chain marks: %u\n"
+      "Contiguous runs: %llu\n"
+      "Directories: %u, fragmented: %u\n"
+      "Files: %u, fragmented: %u\n"
+      "Broken links: %u\n", stats.freeClusters,
+      (unsigned long long) stats.freeClusters * fs.clusterSize >> 20,
+      stats.badClusters, stats.EOCClusters, (unsigned long long) stats.runs,
+      stats.dirs, stats.fragmentedDirs, stats.files, stats.fragmentedFiles,
+      stats.brokenLinks);
+
+    printf("Fragments    Directories    Files\n");
+    for (j = 0; j < FRAGMENT_BUCKETS; j++) {
+      if (j < 2)
+        snprintf(label, sizeof(label), "%u", j + 1);
+      else if (j == FRAGMENT_BUCKETS - 1)
+        snprintf(label, sizeof(label), "%u+", (1U << (j - 1)) + 1);
+      else
+        snprintf(label, sizeof(label), "%u-%u", (1U << (j - 1)) + 1, 1U << j);
+      printf("%-12s %11u %8u\n", label, stats.dirFragments[j],
+        stats.fileFragments[j]);
+    }
+
+    if (!stats.FSInfoValid)
+      printf("FSInfo: missing or invalid signatures\n");
+    else if (stats.FSInfoFreeCount == FSI_UNKNOWN)
+      printf("FSInfo free count: unknown\n");
+    else {
+      printf("FSInfo free count: %u (%s)\n", stats.FSInfoFreeCount,
+        stats.FSInfoFreeCount == stats.freeClusters ? "matches" :
+        "differs from FAT32");
+    }
+  }
+
+  if (OPTIONS.simulate) {
+    fs_mediaStats(fs.fd, &media);
+    printf("Simulated device time: %.3f s, %llu requests, %llu random\n",
+      media.time, media.requests, media.random);
   }
 
   closeFileSystem(&fs);
@@ -60,6 +127,155 @@ int printFSInfo(char *filename) {
 
 }
 
+int sortFileSystem(const struct sTarget *target) {
+  /*
+   * sort FAT32 file system
+   */
+
+  struct rosso_ctx *ctx;
+  struct rosso_stats stats;
+  const char *prefix = OPTIONS.targetCount > 1 ? target->name : "",
+    *sep = OPTIONS.targetCount > 1 ? ": " : "";
+
+  ctx = rosso_open_partition(target->filename,
+    target->partition.number ? &target->partition : 0, &OPTIONS);
+  if (!ctx) {
+    myerror("Failed to open file system!");
+    return -1;
+  }
+
+  if (rosso_sort_tree(ctx)) {
+    rosso_close(ctx);
+    return -1;
+  }
+  rosso_get_stats(ctx, &stats);
+
+  if (OPTIONS.compact) {
+    printf("%s%sReclaimed %llu bytes of directory entries, freed %u "
+      "clusters\n", prefix, sep, stats.reclaimed, stats.freed);
+  }
+  if (OPTIONS.defragDirs) {
+    printf("%s%sMoved %u fragmented directories\n", prefix, sep,
+      stats.moved);
+  }
+  if (OPTIONS.reorderFiles) {
+    printf("%s%sMoved %llu bytes of file data\n", prefix, sep,
+      stats.relocated);
+  }
+  if (OPTIONS.moreInfo && !OPTIONS.list) {
+    printf("%s%sAllocated %lu I/O buffers\n", prefix, sep,
+      stats.allocations);
+    printf("%s%sCluster cache: %llu hits, %llu misses\n", prefix, sep,
+      stats.cacheHits, stats.cacheMisses);
+    printf("%s%sInterned names: %lu distinct, %llu lookups\n", prefix, sep,
+      stats.names, stats.nameLookups);
+  }
+
+  // listings keep stdout to themselves
+  if (OPTIONS.simulate) {
+    fprintf(OPTIONS.list ? stderr : stdout, "%s%sSimulated device time: "
+      "%.3f s, %llu requests, %llu random, %llu erase blocks copied\n",
+      prefix, sep, stats.media.time, stats.media.requests,
+      stats.media.random, stats.media.erases);
+  }
+
+  return rosso_close(ctx);
+}
+
+int processTarget(const struct sTarget *target) {
+  /*
+   * print information of or sort one device
+   */
+
+  if (OPTIONS.info) {
+    if (OPTIONS.targetCount > 1)
+      printf("%s:\n", target->name);
+    if (printFSInfo(target) == -1) {
+      myerror("Failed to print file system information");
+      return -1;
+    }
+  }
+  else {
+    if (sortFileSystem(target) == -1) {
+      myerror("Failed to sort file system!");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int addTargets(struct sTarget **targets, int *count, char *filename) {
+  /*
+   * add a device or each of its FAT32 partitions if it has a partition
+   * table, devices whose partition table can't be read are added as a whole
+   * and fail when they are processed
+   */
+
+  struct sPartition parts[MAX_PARTITIONS];
+  struct sTarget *tmp, *target;
+  int n, j;
+
+  n = rosso_partitions(filename, parts, MAX_PARTITIONS);
+  if (n == -1)
+    n = 0;
+
+  // a single partition is selected by its number
+  if (OPTIONS.partition) {
+    for (j = 0; j < n && parts[j].number != OPTIONS.partition; j++);
+    if (j == n) {
+      myerror("Device '%s' has no FAT32 partition %u!", filename,
+        OPTIONS.partition);
+      return -1;
+    }
+    parts[0] = parts[j];
+    n = 1;
+  }
+
+  tmp = realloc(*targets, (size_t) (*count + (n ? n : 1)) * sizeof(*tmp));
+  if (!tmp) {
+    stderror();
+    return -1;
+  }
+  *targets = tmp;
+
+  if (!n) {
+    target = &tmp[(*count)++];
+    memset(target, 0, sizeof(*target));
+    target->filename = target->name = filename;
+    return 0;
+  }
+
+  for (j = 0; j < n; j++) {
+    target = &tmp[*count];
+    memset(target, 0, sizeof(*target));
+    target->filename = filename;
+    target->partition = parts[j];
+    target->name = malloc(strlen(filename) + 12);
+    if (!target->name) {
+      stderror();
+      return -1;
+    }
+    sprintf(target->name, "%s#%u", filename, parts[j].number);
+    (*count)++;
+  }
+
+  return 0;
+}
+
+void freeTargets(struct sTarget *targets, int count) {
+  /*
+   * free the targets and the names of their partitions
+   */
+  int j;
+
+  for (j = 0; j < count; j++) {
+    if (targets[j].partition.number)
+      free(targets[j].name);
+  }
+  free(targets);
+}
+
 int main(int argc, char *argv[]) {
   /*
    * parse arguments and options and start sorting
@@ -74,17 +290,19 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  char *filename;
+  struct sTarget *targets;
+  struct sStringList *stringList;
+  int count, failures;
 
-  if (parse_options(argc, argv) == -1) {
+  if (parse_options(&OPTIONS, argc, argv) == -1) {
     myerror("Failed to parse options!");
     return -1;
   }
 
   // program information
-  if (OPT_HELP) {
+  if (OPTIONS.help) {
     printf("SYNOPSIS\n"
-      "  rosso [OPTIONS] DEVICE\n"
+      "  rosso [OPTIONS] DEVICE...\n"
       "\n"
       "DESCRIPTION\n"
       "  Rosso sorts directory structures of FAT32 file systems. Many hardware\n"
@@ -94,7 +312,7 @@ int main(int argc, char *argv[]) {
       "OPTIONS\n"
       "  -a    Use ASCIIbetical order for sorting\n"
       "  -c    Ignore case of file names\n"
-      "  -i    Print file system information only\n"
+      "  -i    Print file system information and allocation statistics only\n"
       "  -l    Print current order of files only\n"
       "  -m    Print more information\n"
       "  -n    Natural order sorting\n"
@@ -104,11 +322,55 @@ int main(int argc, char *argv[]) {
       "  -h, --help    Print some help\n"
       "  -v, --version    Print version information\n"
       "  -I PFX    Ignore file name PFX\n"
+      "  --compact    Drop deleted entries and their long name entries\n"
+      "  --compact-free    Compact and free unused directory clusters\n"
+      "  --defrag-dirs    Move fragmented directories to contiguous free\n"
+      "        clusters\n"
+      "  --reorder-files    Move file data, so files follow each other on\n"
+      "        the device in sorted order\n"
+      "  --move-budget N    Reorder files, but move at most N bytes per\n"
+      "        device, N may end with K, M or G\n"
+      "  --direct    Bypass the system cache with block aligned I/O\n"
+      "  --verify    Read written directory clusters back after the last\n"
+      "        flush and print those whose CRC32C differs\n"
+      "  --checkpoint N    Flush changes to the device after every N\n"
+      "        directories instead of only at the end\n"
+      "  --progress    Print directories, entries, MB read and written,\n"
+      "        throughput and estimated time left to stderr periodically\n"
+      "  --simulate MODEL    Print the time a slow device would need for\n"
+      "        the transfers, MODEL is a comma separated list of the presets\n"
+      "        sd and usb and the terms request=US, seek=US (per request and\n"
+      "        extra per random request in microseconds), erase=N, open=N\n"
+      "        (erase block size and blocks written without copying) and\n"
+      "        read=N, write=N (bytes per second)\n"
+      "  --order-file FILE    Sort files and directories listed in FILE\n"
+      "        first in the order of FILE, which is an m3u playlist or a list\n"
+      "        of paths like /Music/Album/01.mp3\n"
+      "  -j, --jobs N    Process up to N devices concurrently\n"
+      "  --manifest FILE    Process devices listed in FILE, one per line\n"
+      "  --partition N    Process only partition N of devices with a\n"
+      "        partition table\n"
+      "  --list-format FMT    Print current order of files only, where FMT\n"
+      "        is text (default), ndjson, tsv or none\n"
+      "  --write-index FILE    Write sorted or listed directories to index\n"
+      "        FILE\n"
+      "  --index FILE    List directory tree from index FILE if it is up to\n"
+      "        date, otherwise the file system is scanned. Only changes of\n"
+      "        the FAT and of the root directory make an index stale,\n"
+      "        renames, new empty files, changed sizes or times within\n"
+      "        allocated clusters and sorts by other programs in sub\n"
+      "        directories are not detected\n"
+      "  --find PAT    Print paths of files and directories whose name\n"
+      "        matches PAT, which may contain the glob characters *, ? and [...]\n"
+      "  -k, --sort-key KEYS    Sort by comma separated list of KEYS where\n"
+      "        each key is one of type, name, mtime, ctime, size or order,\n"
+      "        followed by modifiers :asc, :desc and for name :natural,\n"
+      "        :ascii, :icase (example: type,mtime:desc,name:natural)\n"
       "  -o FLAG    Sort order of files where FLAG is one of:\n"
       "    d    Directories first (default)\n"
       "    f    Files first\n"
-      "    a    Files and directories are not differentiated\n"
-      "\n"
+      "    a    Files and directories are not differentiated\n");
+    printf("\n"
       "  The following options can be specified multiple times:\n"
       "\n"
       "  -d DIR    Sort directory DIR only\n"
@@ -116,50 +378,111 @@ int main(int argc, char *argv[]) {
       "  -x DIR    Do not sort directory DIR\n"
       "  -X DIR    Do not sort directory DIR and its subdirectories\n"
       "\n"
+      "  Path components of DIR may contain the glob characters *, ? and\n"
+      "  [...], e.g. -X '/*/Podcasts/'.\n"
+      "\n"
       "EXAMPLES\n"
       "  rosso -l F:\n"
       "  rosso F:\n"
       "  rosso -l -d / F:\n"
       "  rosso -d / F:\n"
+      "  rosso -k type,mtime:desc,name F:\n"
+      "  rosso --simulate sd,open=1 card.img\n"
+      "  rosso --order-file playlist.m3u -D /Music/ F:\n"
+      "  rosso --list-format=none --write-index card.idx F:\n"
+      "  rosso --index card.idx --find '*.mp3' F:\n"
+      "\n"
+      "  rosso -j 4 --manifest cards.txt\n"
+      "  rosso -j 2 disk.img\n"
+      "  rosso -l --partition 2 disk.img\n"
       "\n"
       "NOTES\n"
-      "  DEVICE must be a FAT32 file system.\n"
+      "  DEVICE must be a FAT32 file system or have an MBR or GPT partition\n"
+      "  table, then all of its FAT32 partitions are sorted in place like\n"
+      "  devices of their own. If several devices or partitions are given, a\n"
+      "  summary is printed and the exit status is non-zero if any failed.\n"
+      "  Listings and indexes are limited to one device.\n"
       "  WARNING: THE FILESYSTEM MUST BE CONSISTENT, OTHERWISE YOU MAY DAMAGE IT!\n"
       "  IF SOMEONE ELSE HAS ACCESS TO THE DEVICE HE MIGHT EXPLOIT ROSSO WITH A\n"
       "  FORGED CORRUPT FILESYSTEM! USE THIS PROGRAM AT YOUR OWN RISK!\n");
     return 0;
   }
-  if (OPT_VERSION) {
+  if (OPTIONS.version) {
     printf("%d.%d.%d\n", MAJOR, MINOR, PATCH);
     return 0;
   }
-  if (optind < argc - 1) {
-    myerror("Too many arguments!");
-    myerror("Use -h for more help.");
-    return -1;
-  }
-  if (optind == argc) {
+  if (!OPTIONS.targetCount) {
     myerror("Device must be given!");
     myerror("Use -h for more help.");
     return -1;
   }
 
-  filename = argv[optind];
+  // stdout is still unused, large listings are written in large blocks
+  if (OPTIONS.list && setvbuf(stdout, listBuffer, _IOFBF, LIST_BUFFER_SIZE)) {
+    myerror("Failed to set output buffer!");
+    freeOptions(&OPTIONS);
+    return -1;
+  }
 
-  if (OPT_INFO) {
-    if (printFSInfo(filename) == -1) {
-      myerror("Failed to print file system information");
+  // partitions of whole disk images are processed like devices of their own
+  targets = 0;
+  count = 0;
+  for (stringList = OPTIONS.targets->next; stringList;
+    stringList = stringList->next) {
+    if (addTargets(&targets, &count, stringList->str)) {
+      freeTargets(targets, count);
+      freeOptions(&OPTIONS);
       return -1;
     }
   }
-  else {
-    if (sortFileSystem(filename) == -1) {
-      myerror("Failed to sort file system!");
+  OPTIONS.targetCount = count;
+
+  // progress lines are printed by a thread of their own
+  if (OPTIONS.progress && startProgress()) {
+    myerror("Failed to start progress reporting!");
+    freeTargets(targets, count);
+    freeOptions(&OPTIONS);
+    return -1;
+  }
+
+  if (count == 1) {
+    if (processTarget(&targets[0]) == -1) {
+      stopProgress();
+      freeTargets(targets, count);
+      freeOptions(&OPTIONS);
       return -1;
     }
+    stopProgress();
+    freeTargets(targets, count);
+    freeOptions(&OPTIONS);
+    return 0;
+  }
+
+  // output of listings and indexes would be mixed up
+  if (OPTIONS.list || OPTIONS.writeIndex) {
+    myerror("Listings and indexes are limited to one device!");
+    myerror("Use -h for more help.");
+    stopProgress();
+    freeTargets(targets, count);
+    freeOptions(&OPTIONS);
+    return -1;
+  }
+
+  // file system information is printed in the order of the devices
+  failures = runBatch(targets, count, OPTIONS.info ? 1 : OPTIONS.jobs,
+    processTarget);
+  stopProgress();
+  if (failures == -1) {
+    myerror("Failed to process devices!");
+    freeTargets(targets, count);
+    freeOptions(&OPTIONS);
+    return -1;
   }
 
-  freeOptions();
+  printBatchSummary(targets, count);
 
-  return 0;
+  freeTargets(targets, count);
+  freeOptions(&OPTIONS);
+
+  return failures ? -1 : 0;
 }
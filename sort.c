@@ -10,11 +10,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include "clusterchain.h"
+#include "dirfilter.h"
 #include "entrylist.h"
 #include "errors.h"
 #include "FAT32.h"
 #include "fileio.h"
+#include "index.h"
+#include "listing.h"
 #include "options.h"
+#include "orderfile.h"
+#include "progress.h"
+#include "reorder.h"
+#include "verify.h"
 
 int parseLongFilenamePart(struct sLongDirEntry *lde, char *str, iconv_t cd) {
   /*
@@ -87,7 +94,7 @@ int checkLongDirEntries(struct sDirEntryList *list) {
   if (list->entries > 1) {
     calculatedChecksum = calculateChecksum(list->sde->DIR_Name);
     if (list->ldel->lde->LDIR_Ord != DE_FREE && // ignore deleted entries
-      list->ldel->lde->LDIR_Ord & ~LAST_LONG_ENTRY) {
+      !(list->ldel->lde->LDIR_Ord & LAST_LONG_ENTRY)) {
       myerror("LongDirEntry should be marked as last long dir entry but "
         "isn't!");
       return -1;
@@ -117,29 +124,40 @@ int checkLongDirEntries(struct sDirEntryList *list) {
 }
 
 int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
-  struct sDirEntryList *list, int *direntries) {
+  struct sDirEntryList *list, int *direntries, unsigned *dropped,
+  const char *path, int flags, int (*visit)(void *arg, const char *path,
+    const char *lname, const char *sname, const struct sShortDirEntry *sde),
+  void *arg) {
   /*
-   * parses a cluster chain and puts found directory entries to list
+   * parses a cluster chain and puts found directory entries to list, in
+   * listing mode entries are passed to visit as they are parsed and only sub
+   * directories are put to list, in compaction mode deleted entries and
+   * their long name entries are dropped and counted, returns -1 on failure,
+   * 0 or the value of visit that stopped parsing
    */
 
-  unsigned j, entries = 0;
-  int ret;
+  unsigned j, entries = 0, lfns = 0;
+  int ret, stop;
   union sDirEntry de;
-  struct sDirEntryList *lnde;
+  struct sDirEntryList *lnde, *last = list;
   struct sLongDirEntryList *llist;
   char tmp[PATH_MAX + 1], dummy[PATH_MAX + 1], sname[PATH_MAX + 1],
     lname[PATH_MAX + 1];
 
   *direntries = 0;
+  *dropped = 0;
 
   chain = chain->next; // head element
 
   llist = 0;
   lname[0] = 0;
-  char *q = malloc(fs->clusterSize);
+  char *q;
   while (chain) {
-    fs_seek(fs->fd, getClusterOffset(fs, chain->cluster), SEEK_SET);
-    fs_read(q, 1, fs->clusterSize, fs->fd);
+    q = fs->clusterBuf;
+    if (readCluster(fs, chain->cluster, q)) {
+      myerror("Failed to read cluster!");
+      return -1;
+    }
     for (j = 0; j < fs->maxDirEntriesPerCluster; j++) {
       memcpy(&de, q, DIR_ENTRY_SIZE);
       q += DIR_ENTRY_SIZE;
@@ -151,7 +169,7 @@ int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
         myerror("Failed to parse directory entry!");
         return -1;
       case 0: // current dir entry and following dir entries are free
-        if (llist) {
+        if (lfns) {
           // short dir entry is still missing!
           myerror("ShortDirEntry is missing after LongDirEntries "
             "(cluster: %08lx, entry %u)!", chain->cluster, j);
@@ -159,19 +177,50 @@ int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
         }
         return 0;
       case 1: // short dir entry
+        addProgress(entries, 1);
         parseShortFilename(&de.ShortDirEntry, sname);
-        if (OPT_LIST && strcmp(sname, ".") && strcmp(sname, "..") &&
-          (sname[0] & 0xFF) != DE_FREE && de.ShortDirEntry.DIR_Atrr &
-          ~ATTR_VOLUME_ID) {
-
-          if (OPT_MORE_INFO)
-            printf("%s (%s)\n", lname[0] ? lname : "n/a", sname);
-          else {
-            printf("%s\n", lname[0] ? lname : sname);
+        if (flags & PARSE_LIST) {
+          if (strcmp(sname, ".") && strcmp(sname, "..") &&
+            (sname[0] & 0xFF) != DE_FREE && de.ShortDirEntry.DIR_Atrr &
+            ~ATTR_VOLUME_ID) {
+            if (visit) {
+              stop = visit(arg, path, lname, sname, &de.ShortDirEntry);
+              if (stop)
+                return stop;
+            }
+
+            // the traversal only needs the sub directories
+            if (de.ShortDirEntry.DIR_Atrr & ATTR_DIRECTORY) {
+              lnde = newDirEntry(&fs->names, sname, lname,
+                &de.ShortDirEntry, 0, 0);
+              if (!lnde) {
+                myerror("Failed to create DirEntry!");
+                return -1;
+              }
+              last->next = lnde;
+              last = lnde;
+              (*direntries)++;
+            }
           }
+          entries = 0;
+          lfns = 0;
+          lname[0] = 0;
+          break;
+        }
+
+        // deleted entry orphans all of its long name entries
+        if (flags & PARSE_COMPACT && (sname[0] & 0xFF) == DE_FREE) {
+          *dropped += entries;
+          freeLongDirEntryList(llist);
+          entries = 0;
+          lfns = 0;
+          llist = 0;
+          lname[0] = 0;
+          break;
         }
 
-        lnde = newDirEntry(sname, lname, &de.ShortDirEntry, llist, entries);
+        lnde = newDirEntry(&fs->names, sname, lname, &de.ShortDirEntry,
+          llist, entries);
         if (!lnde) {
           myerror("Failed to create DirEntry!");
           return -1;
@@ -183,23 +232,35 @@ int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
           return -1;
         }
 
-        insertDirEntryList(lnde, list);
+        // entries are sorted after the whole chain has been parsed
+        last->next = lnde;
+        last = lnde;
         (*direntries)++;
         entries = 0;
+        lfns = 0;
         llist = 0;
         lname[0] = 0;
         break;
       case 2: // long dir entry
+        if (flags & PARSE_COMPACT && de.LongDirEntry.LDIR_Ord == DE_FREE) {
+          (*dropped)++;
+          entries--;
+          break;
+        }
+
         if (parseLongFilenamePart(&de.LongDirEntry, tmp, fs->cd)) {
           myerror("Failed to parse long filename part!");
           return -1;
         }
 
         // insert long dir entry in list
-        llist = insertLongDirEntryList(&de.LongDirEntry, llist);
-        if (!llist) {
-          myerror("Failed to insert LongDirEntry!");
-          return -1;
+        lfns++;
+        if (!(flags & PARSE_LIST)) {
+          llist = insertLongDirEntryList(&de.LongDirEntry, llist);
+          if (!llist) {
+            myerror("Failed to insert LongDirEntry!");
+            return -1;
+          }
         }
 
         strncpy(dummy, tmp, PATH_MAX);
@@ -218,7 +279,7 @@ int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
     chain = chain->next;
   }
 
-  if (llist) {
+  if (lfns) {
     // short dir entry is still missing!
     myerror("ShortDirEntry is missing after LongDirEntries "
       "(root directory entry %d)!", j);
@@ -276,135 +337,543 @@ int getClusterChain(struct sFileSystem *fs, unsigned startCluster,
 int writeClusterChain(struct sFileSystem *fs, struct sDirEntryList *list,
   struct sClusterChain *chain) {
   /*
-   * writes all entries from list to the cluster chain
+   * writes all entries from list densely to the cluster chain and zero-fills
+   * the rest of it, returns the number of clusters that hold entries
    */
 
-  unsigned i = 0, entries = 0;
-  struct sLongDirEntryList *tmp;
-  struct sDirEntryList *ki = list->next;
-
-  chain = chain->next; // we don't need to look at the head element
+  size_t size, pos = 0;
+  unsigned used;
+  struct sClusterChain *tmp;
+  struct sLongDirEntryList *ldel;
+  struct sDirEntryList *ki;
+  char *buf = fs->dirBuf;
 
-  if (fs_seek(fs->fd, getClusterOffset(fs, chain->cluster), SEEK_SET) == -1) {
-    myerror("Seek error!");
-    return -1;
-  }
+  // the whole directory is built in the directory buffer
+  size = 0;
+  for (tmp = chain->next; tmp && size < fs->dirBufSize; tmp = tmp->next)
+    size += fs->clusterSize;
 
-  char *ya = malloc(fs->clusterSize);
-  char *zu = ya;
-  fs_read(ya, 1, fs->clusterSize, fs->fd);
-  fs_seek(fs->fd, (long) -fs->clusterSize, SEEK_CUR);
-  while (ki) {
-    if (entries + ki->entries <= fs->maxDirEntriesPerCluster) {
-      tmp = ki->ldel;
-      for (i = 1; i < ki->entries; i++) {
-        memcpy(zu, tmp->lde, DIR_ENTRY_SIZE);
-        zu += DIR_ENTRY_SIZE;
-        tmp = tmp->next;
-      }
-      memcpy(zu, ki->sde, DIR_ENTRY_SIZE);
-      zu += DIR_ENTRY_SIZE;
-      entries += ki->entries;
-    }
-    else {
-      tmp = ki->ldel;
-      for (i = 1; i <= fs->maxDirEntriesPerCluster - entries; i++) {
-        memcpy(zu, tmp->lde, DIR_ENTRY_SIZE);
-        zu += DIR_ENTRY_SIZE;
-        tmp = tmp->next;
-      }
-      chain = chain->next;
-      // next cluster
-      entries = ki->entries - (fs->maxDirEntriesPerCluster - entries);
-      if (fs_seek(fs->fd, getClusterOffset(fs, chain->cluster),
-          SEEK_SET) == -1) {
-        myerror("Seek error!");
+  for (ki = list->next; ki; ki = ki->next) {
+    for (ldel = ki->ldel; ldel; ldel = ldel->next) {
+      if (pos + DIR_ENTRY_SIZE > size) {
+        myerror("Directory entries don't fit into cluster chain!");
         return -1;
       }
-      while (tmp) {
-        memcpy(zu, tmp->lde, DIR_ENTRY_SIZE);
-        zu += DIR_ENTRY_SIZE;
-        tmp = tmp->next;
-      }
-      memcpy(zu, ki->sde, DIR_ENTRY_SIZE);
-      zu += DIR_ENTRY_SIZE;
+      memcpy(buf + pos, ldel->lde, DIR_ENTRY_SIZE);
+      pos += DIR_ENTRY_SIZE;
+    }
+    if (pos + DIR_ENTRY_SIZE > size) {
+      myerror("Directory entries don't fit into cluster chain!");
+      return -1;
     }
-    ki = ki->next;
+    memcpy(buf + pos, ki->sde, DIR_ENTRY_SIZE);
+    pos += DIR_ENTRY_SIZE;
   }
-  if (entries < fs->maxDirEntriesPerCluster) {
-    memset(zu, 0, DIR_ENTRY_SIZE);
-    if (!fs_write(ya, 1, fs->clusterSize, fs->fd)) {
+  memset(buf + pos, 0, size - pos);
+
+  // a directory keeps at least one cluster
+  used = (unsigned) ((pos + fs->clusterSize - 1) / fs->clusterSize);
+  if (!used)
+    used = 1;
+
+  // clusters beyond the largest possible directory are zero-filled
+  memset(fs->clusterBuf, 0, fs->clusterSize);
+  pos = 0;
+  for (tmp = chain->next; tmp; tmp = tmp->next) {
+    if (writeCluster(fs, tmp->cluster, pos < size ? buf + pos :
+        fs->clusterBuf))
+      return -1;
+    pos += fs->clusterSize;
+  }
+
+  return (int) used;
+}
+
+int pushTraversalPath(struct sTraversal *traversal, const char *parent,
+  size_t parentLen, const char *name) {
+  /*
+   * append the path of a subdirectory to the shared path buffer
+   */
+  size_t len, size;
+  char *paths;
+
+  len = parentLen + strlen(name) + 2;
+  if (traversal->pathLen + len > traversal->pathSize) {
+    size = traversal->pathSize ? traversal->pathSize : PATH_MAX + 1;
+    while (traversal->pathLen + len > size)
+      size *= 2;
+    paths = realloc(traversal->paths, size);
+    if (!paths) {
       stderror();
       return -1;
     }
+    // parent may point into the old buffer
+    if (parent >= traversal->paths &&
+      parent < traversal->paths + traversal->pathSize)
+      parent = paths + (parent - traversal->paths);
+    traversal->paths = paths;
+    traversal->pathSize = size;
   }
 
+  paths = traversal->paths + traversal->pathLen;
+  memcpy(paths, parent, parentLen);
+  strcpy(paths + parentLen, name);
+  strcat(paths + parentLen, "/");
+  traversal->pathLen += len;
+
   return 0;
+}
+
+int pushTraversalRecord(struct sTraversal *traversal, unsigned cluster,
+  unsigned parent, size_t path, const struct sDirFilterState *state) {
+  /*
+   * push a directory on the work stack
+   */
+  struct sTraversalRecord *records;
+  size_t size;
 
+  if (traversal->len == traversal->size) {
+    size = traversal->size ? traversal->size * 2 : 64;
+    records = realloc(traversal->records, size * sizeof(*records));
+    if (!records) {
+      stderror();
+      return -1;
+    }
+    traversal->records = records;
+    traversal->size = size;
+  }
+
+  traversal->records[traversal->len].cluster = cluster;
+  traversal->records[traversal->len].parent = parent;
+  traversal->records[traversal->len].path = path;
+  traversal->records[traversal->len].state = *state;
+  traversal->len++;
+  addProgress(queued, 1);
+
+  return 0;
 }
 
-int sortSubdirectories(struct sFileSystem *fs, struct sDirEntryList *list,
-  const char (*path)[PATH_MAX + 1]) {
+void freeTraversal(struct sTraversal *traversal) {
   /*
-   * sorts sub directories in a FAT32 file system
+   * free work stack, path buffer, filter stack and index of a traversal
    */
-  struct sDirEntryList *ki;
-  char newpath[PATH_MAX + 1] = { 0 };
+  free(traversal->records);
+  free(traversal->paths);
+  free(traversal->prefix);
+  freeFreeSpace(&traversal->space);
+  freeDirFilterStack(&traversal->filter);
+  freeIndexBuilder(&traversal->index);
+  memset(traversal, 0, sizeof(*traversal));
+}
+
+int pushSubdirectories(struct sFileSystem *fs, struct sTraversal *traversal,
+  const struct sTraversalRecord *record, struct sDirEntryList *list) {
+  /*
+   * pushes the sub directories of a directory on the work stack
+   */
+  struct sDirEntryList *ki, **subdirs;
+  struct sDirFilterState substate;
+  size_t i, n = 0, parentLen, path;
+  const char *name;
   unsigned qu, value;
 
-  // sort sub directories
-  ki = list->next;
-  while (ki) {
+  for (ki = list->next; ki; ki = ki->next) {
     if (ki->sde->DIR_Atrr & ATTR_DIRECTORY && (ki->sde->DIR_Name[0] &
         0xFF) != DE_FREE && ki->sde->DIR_Atrr & ~ATTR_VOLUME_ID &&
-      strcmp(ki->sname, ".") && strcmp(ki->sname, "..")) {
-      qu = (ki->sde->DIR_FstClusHI * 65536U + ki->sde->DIR_FstClusLO);
-      if (getFAT32Entry(fs, qu, &value) == -1) {
-        myerror("Failed to get FAT32 entry!");
-        return -1;
-      }
+      strcmp(ki->sname, ".") && strcmp(ki->sname, ".."))
+      n++;
+  }
+  if (!n)
+    return 0;
 
-      strncpy(newpath, (char *) path, PATH_MAX - strlen(newpath));
-      newpath[PATH_MAX] = 0;
-      if (ki->lname && ki->lname[0]) {
-        strncat(newpath, ki->lname, PATH_MAX - strlen(newpath));
-        newpath[PATH_MAX] = 0;
-        strncat(newpath, "/", PATH_MAX - strlen(newpath));
-        newpath[PATH_MAX] = 0;
-      }
-      else {
-        strncat(newpath, ki->sname, PATH_MAX - strlen(newpath));
-        newpath[PATH_MAX] = 0;
-        strncat(newpath, "/", PATH_MAX - strlen(newpath));
-        newpath[PATH_MAX] = 0;
-      }
+  subdirs = malloc(n * sizeof(*subdirs));
+  if (!subdirs) {
+    stderror();
+    return -1;
+  }
+  i = 0;
+  for (ki = list->next; ki; ki = ki->next) {
+    if (ki->sde->DIR_Atrr & ATTR_DIRECTORY && (ki->sde->DIR_Name[0] &
+        0xFF) != DE_FREE && ki->sde->DIR_Atrr & ~ATTR_VOLUME_ID &&
+      strcmp(ki->sname, ".") && strcmp(ki->sname, ".."))
+      subdirs[i++] = ki;
+  }
+
+  parentLen = strlen(traversal->paths + record->path);
 
-      if (sortClusterChain(fs, qu,
-          (const char (*)[PATH_MAX + 1]) newpath) == -1) {
-        myerror("Failed to sort cluster chain!");
+  /*
+   * sub directories are pushed in reverse order, so they are popped in
+   * directory order and the paths and filter states of the last pushed
+   * directory are always on top of their stacks
+   */
+  while (i--) {
+    ki = subdirs[i];
+    name = ki->lname && ki->lname[0] ? ki->lname : ki->sname;
+
+    // advance directory filter by one path component
+    if (enterDirFilter(traversal->opts->dirFilter, &traversal->filter,
+        &record->state, name, &substate)) {
+      myerror("Failed to advance directory filter!");
+      free(subdirs);
+      return -1;
+    }
+    if (!descendsDirFilter(traversal->opts->dirFilter, &substate)) {
+      leaveDirFilter(&traversal->filter, &substate);
+      continue;
+    }
+
+    qu = (ki->sde->DIR_FstClusHI * 65536U + ki->sde->DIR_FstClusLO);
+    if (getFAT32Entry(fs, qu, &value) == -1) {
+      myerror("Failed to get FAT32 entry!");
+      free(subdirs);
+      return -1;
+    }
+
+    path = traversal->pathLen;
+    if (pushTraversalPath(traversal, traversal->paths + record->path,
+        parentLen, name) ||
+      pushTraversalRecord(traversal, qu, record->cluster, path, &substate)) {
+      myerror("Failed to push sub directory!");
+      free(subdirs);
+      return -1;
+    }
+  }
+
+  free(subdirs);
+
+  return 0;
+}
+
+int truncateClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
+  unsigned keep) {
+  /*
+   * ends a cluster chain after keep clusters and frees the remaining
+   * clusters, buffered clusters are made durable first, returns the number
+   * of freed clusters
+   */
+
+  unsigned j, freed = 0;
+
+  chain = chain->next; // head element
+  for (j = 1; j < keep && chain; j++)
+    chain = chain->next;
+  if (!chain || !chain->next)
+    return 0;
+
+  // the compacted entries are on the device before the FAT drops the
+  // clusters behind them, and the chain is ended before they are freed, so
+  // neither the directory nor the chain ever refers to free clusters
+  if (syncFileSystem(fs)) {
+    myerror("Failed to sync file system!");
+    return -1;
+  }
+  if (setFAT32Entry(fs, chain->cluster, FAT32_EOC_MARK)) {
+    myerror("Failed to set FAT32 entry!");
+    return -1;
+  }
+  for (chain = chain->next; chain; chain = chain->next) {
+    if (setFAT32Entry(fs, chain->cluster, 0)) {
+      myerror("Failed to set FAT32 entry!");
+      return -1;
+    }
+    freed++;
+  }
+
+  if (updateFSInfo(fs, (int) freed, 0)) {
+    myerror("Failed to update FSInfo!");
+    return -1;
+  }
+
+  return (int) freed;
+}
+
+int isContiguousClusterChain(struct sClusterChain *chain, int clen) {
+  /*
+   * checks whether the first clen clusters of a cluster chain follow each
+   * other on the device
+   */
+
+  int j;
+
+  chain = chain->next; // head element
+  for (j = 1; j < clen && chain && chain->next; j++) {
+    if (chain->next->cluster != chain->cluster + 1)
+      return 0;
+    chain = chain->next;
+  }
+
+  return 1;
+}
+
+void setEntryCluster(struct sShortDirEntry *sde, unsigned cluster) {
+  /*
+   * sets the start cluster of a short directory entry
+   */
+
+  sde->DIR_FstClusHI = (uint16_t) (cluster >> 16);
+  sde->DIR_FstClusLO = (uint16_t) (cluster & 0xFFFF);
+}
+
+int updateParentEntry(struct sFileSystem *fs, unsigned parent, unsigned old,
+  unsigned cluster, char *buf) {
+  /*
+   * sets the start cluster of the entry of a moved directory in its parent
+   * directory, buf holds one cluster
+   */
+
+  struct sClusterChain *chain, *tmp;
+  struct sShortDirEntry *sde;
+  union sDirEntry *de;
+  unsigned offset;
+
+  chain = newClusterChain();
+  if (!chain) {
+    myerror("Failed to generate new ClusterChain!");
+    return -1;
+  }
+  if (getClusterChain(fs, parent, chain) == -1) {
+    myerror("Failed to get cluster chain!");
+    freeClusterChain(chain);
+    return -1;
+  }
+
+  for (tmp = chain->next; tmp; tmp = tmp->next) {
+    if (readCluster(fs, tmp->cluster, buf)) {
+      freeClusterChain(chain);
+      return -1;
+    }
+    for (offset = 0; offset < fs->clusterSize; offset += DIR_ENTRY_SIZE) {
+      de = (union sDirEntry *) (buf + offset);
+      if (!parseEntry(de))
+        break;
+      sde = &de->ShortDirEntry;
+      if ((sde->DIR_Name[0] & 0xFF) == DE_FREE || sde->DIR_Name[0] == '.' ||
+        (de->LongDirEntry.LDIR_Attr & ATTR_LONG_NAME_MASK) ==
+        ATTR_LONG_NAME || !(sde->DIR_Atrr & ATTR_DIRECTORY) ||
+        (sde->DIR_FstClusHI * 65536U + sde->DIR_FstClusLO) != old)
+        continue;
+
+      setEntryCluster(sde, cluster);
+      if (writeCluster(fs, tmp->cluster, buf)) {
+        freeClusterChain(chain);
         return -1;
       }
+      freeClusterChain(chain);
+      return 0;
+    }
+  }
+
+  freeClusterChain(chain);
+  myerror("Directory entry not found in parent directory!");
+  return -1;
+}
+
+int updateDotEntry(struct sFileSystem *fs, unsigned dir, unsigned entry,
+  unsigned cluster, char *buf) {
+  /*
+   * sets the start cluster of the "." (entry 0) or ".." (entry 1) entry of a
+   * directory, buf holds one cluster
+   */
+
+  struct sShortDirEntry *sde;
 
+  if (readCluster(fs, dir, buf))
+    return -1;
+
+  sde = &((union sDirEntry *) buf)[entry].ShortDirEntry;
+  if (memcmp(sde->DIR_Name, entry ? "..         " : ".          ",
+      11)) {
+    myerror("Dot entry not found in directory!");
+    return -1;
+  }
+
+  setEntryCluster(sde, cluster);
+
+  return writeCluster(fs, dir, buf);
+}
+
+int relocateDirectory(struct sFileSystem *fs, struct sTraversal *traversal,
+  const struct sTraversalRecord *record, struct sClusterChain *chain,
+  int clen, struct sDirEntryList *list) {
+  /*
+   * moves a directory to the first contiguous run of free clusters and
+   * updates the entry in its parent directory, its "." entry and the ".."
+   * entries of its sub directories, returns the new start cluster or 0 if
+   * there is no run that is large enough
+   */
+
+  struct sClusterChain *tmp;
+  struct sDirEntryList *ki;
+  unsigned start, j;
+  char *buf = fs->clusterBuf;
+
+  start = findFreeRun(&traversal->space, (uint32_t) clen);
+  if (!start)
+    return 0;
+
+  // the old clusters are still in use until the new chain is linked
+  for (j = 0, tmp = chain->next; j < (unsigned) clen; j++, tmp = tmp->next) {
+    if (readCluster(fs, tmp->cluster, buf) ||
+      writeCluster(fs, start + j, buf)) {
+      return -1;
+    }
+  }
+  for (j = 0; j < (unsigned) clen; j++) {
+    if (setFAT32Entry(fs, start + j, j + 1 < (unsigned) clen ? start + j + 1 :
+        FAT32_EOC_MARK)) {
+      myerror("Failed to set FAT32 entry!");
+      return -1;
+    }
+  }
+  markClusters(&traversal->space, start, (uint32_t) clen, 0);
+
+  // switch all references over to the new chain
+  if (updateDotEntry(fs, start, 0, start, buf) ||
+    updateParentEntry(fs, record->parent, record->cluster, start, buf)) {
+    myerror("Failed to update directory entries!");
+    return -1;
+  }
+  for (ki = list->next; ki; ki = ki->next) {
+    if (!(ki->sde->DIR_Atrr & ATTR_DIRECTORY) || (ki->sde->DIR_Name[0] &
+        0xFF) == DE_FREE || !(ki->sde->DIR_Atrr & ~ATTR_VOLUME_ID) ||
+      !strcmp(ki->sname, ".") || !strcmp(ki->sname, ".."))
+      continue;
+    if (updateDotEntry(fs, ki->sde->DIR_FstClusHI * 65536U +
+        ki->sde->DIR_FstClusLO, 1, start, buf)) {
+      myerror("Failed to update sub directory!");
+      return -1;
+    }
+  }
+
+  // the new location is durable before the old one is released
+  if (syncFileSystem(fs)) {
+    myerror("Failed to sync file system!");
+    return -1;
+  }
+
+  // release old chain
+  for (j = 0, tmp = chain->next; j < (unsigned) clen; j++, tmp = tmp->next) {
+    if (setFAT32Entry(fs, tmp->cluster, 0)) {
+      myerror("Failed to set FAT32 entry!");
+      return -1;
+    }
+    markClusters(&traversal->space, tmp->cluster, 1, 1);
+  }
+
+  if (updateFSInfo(fs, 0, start + (unsigned) clen)) {
+    myerror("Failed to update FSInfo!");
+    return -1;
+  }
+
+  return (int) start;
+}
+
+int reorderDirectoryFiles(struct sFileSystem *fs, struct sTraversal *traversal,
+  const char *path, struct sDirEntryList *list, struct sFileMoves *moves) {
+  /*
+   * moves the files of a sorted directory, so they follow each other in
+   * sorted order, as long as the move budget allows it
+   */
+
+  unsigned long long budget = ULLONG_MAX;
+  int ret;
+
+  if (traversal->opts->moveBudget)
+    budget = traversal->opts->moveBudget - traversal->relocated;
+
+  ret = reorderFiles(fs, &traversal->space, list, budget, moves);
+  switch (ret) {
+  case -1:
+    return -1;
+  case REORDER_MOVED:
+    traversal->relocated += moves->bytes;
+    if (traversal->opts->moreInfo) {
+      printf("%sMoved %llu bytes of file data\n", traversal->prefix,
+        moves->bytes);
+    }
+    break;
+  case REORDER_NO_SPACE:
+    printf("%sNo contiguous free space for files of directory %s\n",
+      traversal->prefix, path);
+    break;
+  case REORDER_BUDGET:
+    if (traversal->opts->moreInfo) {
+      printf("%sMove budget exceeded, files of directory %s stay in place\n",
+        traversal->prefix, path);
+    }
+    break;
+  }
+
+  return 0;
+}
+
+int indexDirEntryList(struct sIndexBuilder *ib, const char *path,
+  unsigned cluster, int clen, struct sDirEntryList *list) {
+  /*
+   * add a sorted directory to the index, entries are selected like in
+   * listings
+   */
+
+  struct sDirEntryList *tmp;
+
+  if (addIndexDirectory(ib, path, cluster, clen)) {
+    myerror("Failed to add directory to index!");
+    return -1;
+  }
+
+  for (tmp = list->next; tmp; tmp = tmp->next) {
+    if (!strcmp(tmp->sname, ".") || !strcmp(tmp->sname, "..") ||
+      (tmp->sname[0] & 0xFF) == DE_FREE ||
+      !(tmp->sde->DIR_Atrr & ~ATTR_VOLUME_ID))
+      continue;
+    if (addIndexEntry(ib, tmp->lname, tmp->sname, tmp->sde)) {
+      myerror("Failed to add entry to index!");
+      return -1;
     }
-    ki = ki->next;
   }
 
   return 0;
 }
 
-int sortClusterChain(struct sFileSystem *fs, unsigned cluster,
-  const char (*path)[PATH_MAX + 1]) {
+int listParsedEntry(void *arg, const char *path, const char *lname,
+  const char *sname, const struct sShortDirEntry *sde) {
   /*
-   * sorts directory entries in a cluster
+   * lists an entry of a selected directory while it is parsed, arg is the
+   * traversal
    */
+  struct sTraversal *traversal = arg;
 
-  int direntries, clen, match;
+  listEntry(traversal->listing, path, lname, sname, sde);
+  if (traversal->opts->writeIndex &&
+    addIndexEntry(&traversal->index, lname, sname, sde)) {
+    myerror("Failed to add entry to index!");
+    return -1;
+  }
+
+  return 0;
+}
+
+int sortClusterChain(struct sFileSystem *fs, struct sTraversal *traversal,
+  const struct sTraversalRecord *record) {
+  /*
+   * sorts directory entries in a cluster chain and pushes its sub
+   * directories on the work stack
+   */
+
+  const struct sOptions *opts = traversal->opts;
+  int direntries, clen, match, used, freed, moved;
+  unsigned cluster = record->cluster, dropped;
+  const char *path = traversal->paths + record->path;
   struct sClusterChain *ClusterChain;
   struct sDirEntryList *list;
+  struct sTraversalRecord current = *record;
+  struct sFileMoves moves = { 0 };
 
-  match =
-    matchesDirPathLists(OPT_INCL_DIRS, OPT_INCL_DIRS_REC, OPT_EXCL_DIRS,
-    OPT_EXCL_DIRS_REC, path);
+  /*
+   * directories that don't match are still parsed if one of their
+   * subdirectories may match
+   */
+  match = matchesDirFilter(opts->dirFilter, &record->state);
 
   ClusterChain = newClusterChain();
   if (!ClusterChain) {
@@ -419,103 +888,195 @@ int sortClusterChain(struct sFileSystem *fs, unsigned cluster,
     return -1;
   }
 
+  clen = getClusterChain(fs, cluster, ClusterChain);
+  if (clen == -1) {
+    myerror("Failed to get cluster chain!");
+    freeDirEntryList(list);
+    freeClusterChain(ClusterChain);
+    return -1;
+  }
+
   if (match) {
-    clen = getClusterChain(fs, cluster, ClusterChain);
-    if (clen == -1) {
-      myerror("Failed to get cluster chain!");
+    if (opts->list) {
+      listDirectory(traversal->listing, path, cluster, clen,
+        fs->clusterSize);
+      if (opts->writeIndex &&
+        addIndexDirectory(&traversal->index, path, cluster, clen)) {
+        myerror("Failed to add directory to index!");
+        freeDirEntryList(list);
+        freeClusterChain(ClusterChain);
+        return -1;
+      }
+    }
+    else {
+      printf(opts->random ? "%sRandom sorting directory %s\n" :
+        "%sSorting directory %s\n", traversal->prefix, path);
+      if (opts->moreInfo) {
+        printf("%sStart cluster: %08d, length: %d (%d bytes)\n",
+          traversal->prefix, cluster, clen, clen * (int) fs->clusterSize);
+      }
+    }
+  }
+
+  if (parseClusterChain(fs, ClusterChain, list, &direntries, &dropped, path,
+      (opts->list ? PARSE_LIST : 0) | (opts->compact ? PARSE_COMPACT : 0),
+      match ? listParsedEntry : 0, (void *) traversal)) {
+    myerror("Failed to parse cluster chain!");
+    freeDirEntryList(list);
+    freeClusterChain(ClusterChain);
+    return -1;
+  }
+
+  // sort directory if it is selected, listings are printed while parsing
+  if (match && !opts->list) {
+    if (opts->orderTable)
+      assignOrderRanks(opts->orderTable, path, list);
+
+    if (sortDirEntryList(&opts->sortSpec, list, direntries) == -1) {
+      myerror("Failed to sort directory entry list!");
       freeDirEntryList(list);
       freeClusterChain(ClusterChain);
       return -1;
     }
 
-    if (OPT_LIST) {
-      if (strcmp((char *) path, "/"))
-        puts("");
-      printf("%s\n", (char *) path);
-      if (OPT_MORE_INFO) {
-        printf("Start cluster: %08d, length: %d (%d bytes)\n", cluster, clen,
-          clen * (int) fs->clusterSize);
-      }
+    if (opts->random)
+      randomizeDirEntryList(list, direntries);
+
+    // file data is copied first, entries point to it once they are written
+    if (opts->reorderFiles &&
+      reorderDirectoryFiles(fs, traversal, path, list, &moves)) {
+      myerror("Failed to reorder files!");
+      freeDirEntryList(list);
+      freeClusterChain(ClusterChain);
+      return -1;
     }
-    else {
-      printf(OPT_RANDOM ? "Random sorting directory %s\n" :
-        "Sorting directory %s\n", (char *) path);
-      if (OPT_MORE_INFO) {
-        printf("Start cluster: %08d, length: %d (%d bytes)\n", cluster, clen,
-          clen * (int) fs->clusterSize);
-      }
+
+    used = writeClusterChain(fs, list, ClusterChain);
+    if (used == -1) {
+      myerror("Failed to write cluster chain!");
+      freeFileMoves(&moves);
+      freeDirEntryList(list);
+      freeClusterChain(ClusterChain);
+      return -1;
     }
 
-    if (parseClusterChain(fs, ClusterChain, list, &direntries) == -1) {
-      myerror("Failed to parse cluster chain!");
+    if (releaseFileMoves(fs, &traversal->space, &moves)) {
+      myerror("Failed to release moved files!");
+      freeFileMoves(&moves);
       freeDirEntryList(list);
       freeClusterChain(ClusterChain);
       return -1;
     }
 
-    // sort directory if it is selected
-    if (!OPT_LIST) {
+    // clusters behind the compacted entries are released on request
+    freed = 0;
+    if (opts->compactFree && used < clen) {
+      freed = truncateClusterChain(fs, ClusterChain, (unsigned) used);
+      if (freed == -1) {
+        myerror("Failed to truncate cluster chain!");
+        freeDirEntryList(list);
+        freeClusterChain(ClusterChain);
+        return -1;
+      }
+      clen = used;
+    }
 
-      if (OPT_RANDOM)
-        randomizeDirEntryList(list, direntries);
+    if (opts->compact) {
+      traversal->reclaimed += dropped * DIR_ENTRY_SIZE;
+      traversal->freed += (unsigned) freed;
+      if (opts->moreInfo && (dropped || freed)) {
+        printf("%sReclaimed %u bytes, freed %d clusters\n", traversal->prefix,
+          dropped * DIR_ENTRY_SIZE, freed);
+      }
+    }
 
-      if (writeClusterChain(fs, list, ClusterChain) == -1) {
-        myerror("Failed to write cluster chain!");
+    // the root directory is never moved, its cluster is in the boot sector
+    if (opts->defragDirs && cluster != fs->bs.BS_RootClus &&
+      !isContiguousClusterChain(ClusterChain, clen)) {
+      moved = relocateDirectory(fs, traversal, record, ClusterChain, clen,
+        list);
+      if (moved == -1) {
+        myerror("Failed to relocate directory!");
         freeDirEntryList(list);
         freeClusterChain(ClusterChain);
         return -1;
       }
+      if (moved) {
+        cluster = (unsigned) moved;
+        current.cluster = cluster;
+        traversal->moved++;
+        if (opts->moreInfo) {
+          printf("%sMoved directory to cluster %08u\n", traversal->prefix,
+            cluster);
+        }
+      }
+      else {
+        printf("%sNo contiguous free space for directory %s\n",
+          traversal->prefix, path);
+      }
     }
 
-    freeClusterChain(ClusterChain);
-
-    // sort subdirectories
-    if (sortSubdirectories(fs, list, path) == -1) {
-      myerror("Failed to sort subdirectories!");
+    // the index describes the new order
+    if (opts->writeIndex &&
+      indexDirEntryList(&traversal->index, path, cluster, clen, list)) {
+      myerror("Failed to add directory to index!");
+      freeDirEntryList(list);
+      freeClusterChain(ClusterChain);
       return -1;
     }
   }
 
+  freeClusterChain(ClusterChain);
+
+  /*
+   * the entry list is released as soon as the sub directories are known,
+   * they refer to the current location of this directory
+   */
+  if (pushSubdirectories(fs, traversal, &current, list) == -1) {
+    myerror("Failed to push subdirectories!");
+    freeDirEntryList(list);
+    return -1;
+  }
+
   freeDirEntryList(list);
 
   return 0;
 }
 
-int sortFileSystem(char *filename) {
+int listFileSystemIndex(struct sFileSystem *fs, struct sListing *listing) {
   /*
-   * sort FAT32 file system
+   * list file system from an index, returns 1 if the index is stale and the
+   * file system has to be scanned
    */
 
-  struct sFileSystem fs;
+  const struct sOptions *opts = listing->opts;
+  struct sIndex index;
+  int stale;
 
-  if (openFileSystem(filename, OPT_LIST ? "rb" : "r+b", &fs)) {
-    myerror("Failed to open file system!");
+  if (openIndex(opts->index, &index)) {
+    myerror("Failed to open index!");
     return -1;
   }
 
-  if (checkFAT32s(&fs)) {
-    myerror("FAT32s don't match! Please repair file system!");
-    closeFileSystem(&fs);
+  stale = checkIndex(fs, &index);
+  if (stale == -1) {
+    myerror("Failed to check index!");
+    closeIndex(&index);
     return -1;
   }
-
-  if (fs.FSType == -1) {
-    myerror("File system not FAT32!");
-    closeFileSystem(&fs);
-    return -1;
+  if (stale) {
+    myerror("Index '%s' is stale, scanning file system.", opts->index);
+    closeIndex(&index);
+    return 1;
   }
-  /*
-   * root directory lies in cluster chain, so sort it like all other
-   * directories
-   */
-  if (sortClusterChain(&fs, fs.bs.BS_RootClus,
-      (const char (*)[PATH_MAX + 1]) "/") == -1) {
-    myerror("Failed to sort first cluster chain!");
-    closeFileSystem(&fs);
+
+  if (listIndex(listing, &index)) {
+    myerror("Failed to list index!");
+    closeIndex(&index);
     return -1;
   }
 
-  closeFileSystem(&fs);
+  closeIndex(&index);
 
   return 0;
 }
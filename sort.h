@@ -5,19 +5,80 @@
 #ifndef __sort_h__
 #define __sort_h__
 
-#include <limits.h>
+#include <stddef.h>
+#include "dirfilter.h"
+#include "freespace.h"
+#include "index.h"
+
+// flags of parseClusterChain()
+#define PARSE_LIST 0x01 // pass entries to visit, keep only sub directories
+#define PARSE_COMPACT 0x02 // drop deleted entries
+
 struct sClusterChain;
+struct sDirEntryList;
 struct sFileSystem;
+struct sListing;
+struct sOptions;
+struct sShortDirEntry;
+
+struct sTraversalRecord {
+  /*
+   * directory on the work stack of a traversal
+   */
+  unsigned cluster; // start cluster
+  unsigned parent; // start cluster of the parent directory
+  size_t path; // offset of the path in the path buffer
+  struct sDirFilterState state; // directory filter state
+};
+
+struct sTraversal {
+  /*
+   * state of an iterative depth first traversal, paths and filter states of
+   * pending directories are kept in shared stack-like buffers
+   */
+  struct sTraversalRecord *records; // work stack
+  size_t len, size;
+  char *paths; // path buffer
+  size_t pathLen, pathSize;
+  struct sDirFilterStack filter; // directory filter stack
+  const struct sOptions *opts; // options of the traversal
+  struct sListing *listing; // output of the list option
+  struct sIndexBuilder index; // index that is written on request
+  char *prefix; // printed before messages, names the device in batch mode
+  unsigned long long reclaimed; // bytes of dropped entries
+  unsigned freed; // clusters released by compaction
+  unsigned moved; // directories moved to contiguous runs
+  unsigned long long relocated; // bytes of file data moved
+  struct sFreeSpace space; // free clusters, loaded for relocations
+};
 
-// sorts FAT32 file system
-int sortFileSystem(char *filename);
+// appends the path of a subdirectory to the shared path buffer
+int pushTraversalPath(struct sTraversal *traversal, const char *parent,
+  size_t parentLen, const char *name);
 
-// sorts directory entries in a cluster
-int sortClusterChain(struct sFileSystem *fs, unsigned cluster,
-  const char (*path)[PATH_MAX + 1]);
+// pushes a directory on the work stack
+int pushTraversalRecord(struct sTraversal *traversal, unsigned cluster,
+  unsigned parent, size_t path, const struct sDirFilterState *state);
+
+// frees work stack, path buffer, filter stack and index of a traversal
+void freeTraversal(struct sTraversal *traversal);
+
+// parses a cluster chain and puts found directory entries to list
+int parseClusterChain(struct sFileSystem *fs, struct sClusterChain *chain,
+  struct sDirEntryList *list, int *direntries, unsigned *dropped,
+  const char *path, int flags, int (*visit)(void *arg, const char *path,
+    const char *lname, const char *sname, const struct sShortDirEntry *sde),
+  void *arg);
+
+// sorts directory entries in a cluster chain and pushes its sub directories
+int sortClusterChain(struct sFileSystem *fs, struct sTraversal *traversal,
+  const struct sTraversalRecord *record);
 
 // returns cluster chain for a given start cluster
 int getClusterChain(struct sFileSystem *fs, unsigned startCluster,
   struct sClusterChain *chain);
 
+// lists file system from an index, returns 1 if the index is stale
+int listFileSystemIndex(struct sFileSystem *fs, struct sListing *listing);
+
 #endif // __sort_h__
@@ -0,0 +1,258 @@
+/*
+ * This file contains/describes the sort key specification that is compiled
+ * once from the command line options into a chain of comparators.
+ */
+
+#include "sortkey.h"
+
+#include <stdint.h>
+#include <string.h>
+#include "entrylist.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "natstrcmp.h"
+#include "options.h"
+
+int cmpType(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * directories before files
+   */
+  return (de2->sde->DIR_Atrr & ATTR_DIRECTORY) -
+    (de1->sde->DIR_Atrr & ATTR_DIRECTORY);
+}
+
+int cmpNameKey(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * compare precomputed byte name keys
+   */
+  int ret;
+
+  ret = memcmp(de1->key, de2->key,
+    de1->keylen < de2->keylen ? de1->keylen : de2->keylen);
+  if (ret)
+    return ret;
+  if (de1->keylen != de2->keylen)
+    return de1->keylen < de2->keylen ? -1 : 1;
+  return 0;
+}
+
+int cmpNatural(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  return natstrcmp((char *) de1->key, (char *) de2->key);
+}
+
+int cmpNaturalIgnoreCase(struct sDirEntryList *de1,
+  struct sDirEntryList *de2) {
+  return natstrcasecmp((char *) de1->key, (char *) de2->key);
+}
+
+int cmpOrder(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * compare ranks in the order file, unlisted entries come last
+   */
+  return (de1->order > de2->order) - (de1->order < de2->order);
+}
+
+int cmpMTime(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * compare date and time of last write
+   */
+  uint32_t md1, md2;
+
+  md1 = (uint32_t) de1->sde->DIR_WrtDate << 16 | de1->sde->DIR_WrtTime;
+  md2 = (uint32_t) de2->sde->DIR_WrtDate << 16 | de2->sde->DIR_WrtTime;
+  return (md1 > md2) - (md1 < md2);
+}
+
+int cmpCTime(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * compare date and time of creation
+   */
+  uint64_t cd1, cd2;
+
+  cd1 = (uint64_t) de1->sde->DIR_CrtDate << 24 |
+    (uint64_t) de1->sde->DIR_CrtTime << 8 | de1->sde->DIR_CrtTimeTenth;
+  cd2 = (uint64_t) de2->sde->DIR_CrtDate << 24 |
+    (uint64_t) de2->sde->DIR_CrtTime << 8 | de2->sde->DIR_CrtTimeTenth;
+  return (cd1 > cd2) - (cd1 < cd2);
+}
+
+int cmpSize(struct sDirEntryList *de1, struct sDirEntryList *de2) {
+  /*
+   * compare file sizes
+   */
+  return (de1->sde->DIR_FileSize > de2->sde->DIR_FileSize) -
+    (de1->sde->DIR_FileSize < de2->sde->DIR_FileSize);
+}
+
+void setRadixStrategy(struct sSortSpec *spec) {
+  /*
+   * determine whether a radix sort gives the same order as the comparator
+   * chain
+   */
+  int first = 0;
+
+  spec->radix = RADIX_NONE;
+  spec->typeOrder = 0;
+  spec->radixOrder = 1;
+
+  if (spec->count && spec->keys[0].cmp == cmpType) {
+    spec->typeOrder = spec->keys[0].order;
+    first = 1;
+  }
+
+  if (spec->count == first)
+    spec->radix = RADIX_RANK;
+  else if (spec->count == first + 1) {
+    spec->radixOrder = spec->keys[first].order;
+    if (spec->keys[first].cmp == cmpNameKey)
+      spec->radix = RADIX_NAME;
+    else if (spec->keys[first].cmp == cmpMTime)
+      spec->radix = RADIX_MTIME;
+  }
+}
+
+int addSortKey(struct sSortSpec *spec,
+  int (*cmp)(struct sDirEntryList *, struct sDirEntryList *), int order) {
+  /*
+   * append a comparator to the chain
+   */
+  if (spec->count == MAX_SORT_KEYS) {
+    myerror("Too many sort keys (max. %d)!", MAX_SORT_KEYS);
+    return -1;
+  }
+  spec->keys[spec->count].cmp = cmp;
+  spec->keys[spec->count].order = order;
+  spec->count++;
+  return 0;
+}
+
+int addNameSortKey(struct sSortSpec *spec, unsigned flags, int order) {
+  /*
+   * append the name comparator, names are compared by one precomputed key
+   * per entry, so there can only be one name key
+   */
+  if (spec->needsNameKey) {
+    myerror("Sort key 'name' must not be given more than once!");
+    return -1;
+  }
+  spec->needsNameKey = 1;
+  spec->nameFlags = flags;
+
+  if (!(flags & NAME_NATURAL))
+    return addSortKey(spec, cmpNameKey, order);
+  if (flags & NAME_IGNORE_CASE)
+    return addSortKey(spec, cmpNaturalIgnoreCase, order);
+  return addSortKey(spec, cmpNatural, order);
+}
+
+int compileSortSpec(struct sOptions *opts, const char *str) {
+  /*
+   * compile a sort key specification like "type,mtime:desc,name:natural"
+   * into the sort keys of the options
+   */
+
+  struct sSortSpec spec;
+  const char *field, *end, *mod, *next;
+  size_t len, fieldLen;
+  unsigned flags;
+  int order, ret;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.prefixes = opts->ignorePrefixes;
+
+  for (field = str; *field; field = *end ? end + 1 : end) {
+    end = strchr(field, ',');
+    if (!end)
+      end = field + strlen(field);
+
+    // modifiers default to the other options
+    order = 1;
+    flags = (opts->ascii ? NAME_ASCII : 0) |
+      (opts->ignoreCase ? NAME_IGNORE_CASE : 0) |
+      (opts->naturalSort ? NAME_NATURAL : 0);
+
+    mod = memchr(field, ':', (size_t) (end - field));
+    fieldLen = (size_t) ((mod ? mod : end) - field);
+
+    while (mod) {
+      mod++;
+      next = memchr(mod, ':', (size_t) (end - mod));
+      len = (size_t) ((next ? next : end) - mod);
+      if (len == 3 && !strncmp(mod, "asc", len))
+        order = 1;
+      else if (len == 4 && !strncmp(mod, "desc", len))
+        order = -1;
+      else if (len == 7 && !strncmp(mod, "natural", len))
+        flags = (flags & ~NAME_ASCII) | NAME_NATURAL;
+      else if (len == 5 && !strncmp(mod, "ascii", len))
+        flags = (flags & ~NAME_NATURAL) | NAME_ASCII;
+      else if (len == 5 && !strncmp(mod, "icase", len))
+        flags |= NAME_IGNORE_CASE;
+      else {
+        myerror("Unknown sort key modifier '%.*s'!", (int) len, mod);
+        return -1;
+      }
+      mod = next;
+    }
+
+    // -r reverses all keys except the grouping of files and directories and
+    // the curated order
+    if (fieldLen == 4 && !strncmp(field, "type", fieldLen))
+      ret = addSortKey(&spec, cmpType, order);
+    else if (fieldLen == 4 && !strncmp(field, "name", fieldLen))
+      ret = addNameSortKey(&spec, flags, order * opts->reverse);
+    else if (fieldLen == 5 && !strncmp(field, "mtime", fieldLen))
+      ret = addSortKey(&spec, cmpMTime, order * opts->reverse);
+    else if (fieldLen == 5 && !strncmp(field, "ctime", fieldLen))
+      ret = addSortKey(&spec, cmpCTime, order * opts->reverse);
+    else if (fieldLen == 4 && !strncmp(field, "size", fieldLen))
+      ret = addSortKey(&spec, cmpSize, order * opts->reverse);
+    else if (fieldLen == 5 && !strncmp(field, "order", fieldLen)) {
+      if (!opts->orderTable) {
+        myerror("Sort key 'order' needs an order file!");
+        return -1;
+      }
+      ret = addSortKey(&spec, cmpOrder, order);
+    }
+    else {
+      myerror("Unknown sort key '%.*s'!", (int) fieldLen, field);
+      return -1;
+    }
+    if (ret)
+      return -1;
+  }
+
+  // listing and random order keep all entries in their order, the keys are
+  // only validated
+  if (opts->list || opts->random) {
+    memset(&spec, 0, sizeof(spec));
+    spec.prefixes = opts->ignorePrefixes;
+  }
+
+  setRadixStrategy(&spec);
+  opts->sortSpec = spec;
+
+  return 0;
+}
+
+int compileLegacySortSpec(struct sOptions *opts) {
+  /*
+   * compile the sort key specification equivalent to the legacy options
+   */
+
+  char str[32] = { 0 };
+
+  // directories first (default) or files first
+  if (opts->order == 0)
+    strcat(str, "type,");
+  else if (opts->order == 1)
+    strcat(str, "type:desc,");
+
+  // listed entries come first in the order of the order file
+  if (opts->orderTable)
+    strcat(str, "order,");
+
+  strcat(str, opts->modification ? "mtime" : "name");
+
+  return compileSortSpec(opts, str);
+}
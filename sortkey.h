@@ -0,0 +1,55 @@
+/*
+ * This file contains/describes the sort key specification that is compiled
+ * once from the command line options into a chain of comparators.
+ */
+
+#ifndef __sortkey_h__
+#define __sortkey_h__
+
+struct sDirEntryList;
+struct sOptions;
+struct sStringList;
+
+#define MAX_SORT_KEYS 8
+
+// flags for the name sort key
+#define NAME_ASCII 0x01U
+#define NAME_IGNORE_CASE 0x02U
+#define NAME_NATURAL 0x04U
+
+// radix sort strategies that are equivalent to the compiled key chain
+#define RADIX_NONE 0 // only the comparison sort is possible
+#define RADIX_RANK 1 // order by position class only
+#define RADIX_NAME 2 // MSD radix sort by name key
+#define RADIX_MTIME 3 // LSD radix sort by modification time
+
+struct sSortKey {
+  /*
+   * one element of the comparator chain
+   */
+  int (*cmp)(struct sDirEntryList *de1, struct sDirEntryList *de2);
+  int order; // 1 for ascending, -1 for descending order
+};
+
+struct sSortSpec {
+  /*
+   * compiled sort specification
+   */
+  struct sSortKey keys[MAX_SORT_KEYS];
+  int count; // number of keys in chain
+  unsigned nameFlags; // NAME_* flags used to build name keys
+  int needsNameKey; // entries need a precomputed name key
+  int radix; // RADIX_* strategy for large directories
+  int typeOrder; // direction of a leading type key or 0 if there is none
+  int radixOrder; // direction of the radix sorted key
+  const struct sStringList *prefixes; // name prefixes that are ignored
+};
+
+// compile a sort key specification like "type,mtime:desc,name:natural" into
+// the sort keys of the options
+int compileSortSpec(struct sOptions *opts, const char *spec);
+
+// compile the sort key specification equivalent to the legacy options
+int compileLegacySortSpec(struct sOptions *opts);
+
+#endif // __sortkey_h__
@@ -0,0 +1,127 @@
+/*
+ * This file contains/describes the verification of written directory
+ * clusters. Only a CRC32C of every written cluster is kept, after the last
+ * flush the clusters are read back in one pass ordered by offset and their
+ * checksums are compared.
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32c.h"
+#include "errors.h"
+#include "FAT32.h"
+#include "fileio.h"
+
+int recordWrittenCluster(struct sVerify *verify, uint32_t cluster,
+  const void *data, size_t size) {
+  /*
+   * record the checksum of a cluster that is written, a later write of the
+   * same cluster replaces it
+   */
+
+  struct sClusterSlot *slot;
+  int grown;
+
+  slot = addCluster(&verify->table, cluster, &grown);
+  if (!slot)
+    return -1;
+  slot->value.crc = crc32c(0, data, size);
+
+  return 0;
+}
+
+void forgetWrittenCluster(struct sVerify *verify, uint32_t cluster) {
+  /*
+   * forget a freed cluster, its content may change legitimately
+   */
+
+  struct sClusterSlot *slot = findCluster(&verify->table, cluster);
+
+  if (slot)
+    removeClusterSlot(&verify->table, slot);
+}
+
+int cmpWrittenClusters(const void *a, const void *b) {
+  /*
+   * orders written clusters by cluster number
+   */
+
+  uint32_t x = ((const struct sClusterSlot *) a)->cluster,
+    y = ((const struct sClusterSlot *) b)->cluster;
+
+  return x < y ? -1 : x > y;
+}
+
+long verifyWrittenClusters(struct sFileSystem *fs, const char *prefix) {
+  /*
+   * read back all written clusters and compare their checksums, adjacent
+   * clusters are read with one request into the directory buffer, the
+   * hash table is sorted in place and can't be used afterwards
+   */
+
+  struct sVerify *verify = &fs->verify;
+  struct sClusterSlot *slots = verify->table.slots;
+  size_t n = 0, j, k, run, maxRun;
+  long mismatches = 0;
+
+  if (!verify->table.len)
+    return 0;
+
+  for (j = 0; j < verify->table.size; j++) {
+    if (slots[j].cluster)
+      slots[n++] = slots[j];
+  }
+  qsort(slots, n, sizeof(*slots), cmpWrittenClusters);
+  memset(slots + n, 0, (verify->table.size - n) * sizeof(*slots));
+  verify->enabled = 0;
+  verify->table.len = 0;
+
+  // the clusters have to come from the device, not from the system cache
+  if (fs_dropCache(fs->fd)) {
+    stderror();
+    myerror("Failed to drop cached clusters!");
+    return -1;
+  }
+
+  maxRun = fs->dirBufSize / fs->clusterSize;
+  for (j = 0; j < n; j += run) {
+    for (run = 1; j + run < n && run < maxRun &&
+      slots[j + run].cluster == slots[j].cluster + run; run++);
+
+    if (fs_seek(fs->fd, getClusterOffset(fs, slots[j].cluster), SEEK_SET) ==
+      -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_read(fs->dirBuf, fs->clusterSize, run, fs->fd)) {
+      myerror("Failed to read from file!");
+      return -1;
+    }
+
+    for (k = 0; k < run; k++) {
+      if (crc32c(0, fs->dirBuf + k * fs->clusterSize, fs->clusterSize) !=
+        slots[j + k].value.crc) {
+        printf("%sCluster %u differs from the written content\n", prefix,
+          slots[j + k].cluster);
+        mismatches++;
+      }
+    }
+  }
+
+  printf("%sVerified %lu directory clusters, %ld differ\n", prefix,
+    (unsigned long) n, mismatches);
+
+  return mismatches;
+}
+
+void freeVerify(struct sVerify *verify) {
+  /*
+   * free the recorded checksums
+   */
+
+  freeClusterTable(&verify->table);
+  memset(verify, 0, sizeof(*verify));
+}
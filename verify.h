@@ -0,0 +1,40 @@
+/*
+ * This file contains/describes the verification of written directory
+ * clusters. Only a CRC32C of every written cluster is kept, after the last
+ * flush the clusters are read back in one pass ordered by offset and their
+ * checksums are compared.
+ */
+
+#ifndef __verify_h__
+#define __verify_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "clustertable.h"
+
+struct sFileSystem;
+
+struct sVerify {
+  /*
+   * written clusters with the checksum of the last content that was
+   * written to them
+   */
+  int enabled; // checksums are recorded
+  struct sClusterTable table;
+};
+
+// record the checksum of a cluster that is written
+int recordWrittenCluster(struct sVerify *verify, uint32_t cluster,
+  const void *data, size_t size);
+
+// forget a freed cluster, its content may change legitimately
+void forgetWrittenCluster(struct sVerify *verify, uint32_t cluster);
+
+// read back all written clusters and compare their checksums, prints the
+// clusters that differ and returns their number or -1
+long verifyWrittenClusters(struct sFileSystem *fs, const char *prefix);
+
+// free the recorded checksums
+void freeVerify(struct sVerify *verify);
+
+#endif // __verify_h__
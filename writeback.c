@@ -0,0 +1,210 @@
+/*
+ * This file contains/describes the write-back buffer of directory clusters.
+ * Written directory clusters are collected in memory and written at once,
+ * ordered by their offset and with adjacent clusters merged into single
+ * requests.
+ */
+
+#include "writeback.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "errors.h"
+#include "FAT32.h"
+#include "fileio.h"
+
+int growPool(struct sFileSystem *fs) {
+  /*
+   * allocates a slab of WRITEBACK_MERGE_SIZE and adds its clusters to the
+   * pool of unused cluster buffers
+   */
+
+  struct sWriteBack *wb = &fs->wb;
+  size_t n, j;
+  char **tmp, *slab;
+
+  n = WRITEBACK_MERGE_SIZE / fs->clusterSize;
+  if (!n)
+    n = 1;
+
+  tmp = realloc(wb->slabs, (wb->slabLen + 1) * sizeof(*tmp));
+  if (!tmp) {
+    stderror();
+    return -1;
+  }
+  wb->slabs = tmp;
+  tmp = realloc(wb->pool, (wb->poolSize + n) * sizeof(*tmp));
+  if (!tmp) {
+    stderror();
+    return -1;
+  }
+  wb->pool = tmp;
+  wb->poolSize += n;
+
+  slab = allocBuffer(fs, n * fs->clusterSize);
+  if (!slab)
+    return -1;
+  fs->allocations += 2;
+  wb->slabs[wb->slabLen++] = slab;
+
+  for (j = 0; j < n; j++)
+    wb->pool[wb->pooled++] = slab + j * fs->clusterSize;
+
+  return 0;
+}
+
+int bufferCluster(struct sFileSystem *fs, uint32_t cluster, const void *data) {
+  /*
+   * buffer the content of a cluster, the buffer is written when it exceeds
+   * WRITEBACK_LIMIT
+   */
+
+  struct sWriteBack *wb = &fs->wb;
+  struct sClusterSlot *slot;
+  int grown;
+
+  slot = addCluster(&wb->table, cluster, &grown);
+  if (!slot)
+    return -1;
+  if (grown)
+    fs->allocations++;
+
+  if (!slot->value.data) {
+    // buffers of written clusters are reused
+    if (!wb->pooled && growPool(fs)) {
+      removeClusterSlot(&wb->table, slot);
+      return -1;
+    }
+    slot->value.data = wb->pool[--wb->pooled];
+  }
+  memcpy(slot->value.data, data, fs->clusterSize);
+
+  if (wb->table.len * fs->clusterSize > WRITEBACK_LIMIT)
+    return flushWriteBack(fs);
+
+  return 0;
+}
+
+const char *findBufferedCluster(const struct sWriteBack *wb, uint32_t cluster) {
+  /*
+   * returns the buffered content of a cluster or 0
+   */
+
+  struct sClusterSlot *slot = findCluster(&wb->table, cluster);
+
+  return slot ? slot->value.data : 0;
+}
+
+void discardBufferedCluster(struct sWriteBack *wb, uint32_t cluster) {
+  /*
+   * drop a buffered cluster without writing it, its buffer is reused
+   */
+
+  struct sClusterSlot *slot = findCluster(&wb->table, cluster);
+
+  if (!slot)
+    return;
+
+  wb->pool[wb->pooled++] = slot->value.data;
+  removeClusterSlot(&wb->table, slot);
+}
+
+int cmpDirtyClusters(const void *a, const void *b) {
+  /*
+   * orders dirty clusters by cluster number
+   */
+
+  uint32_t x = (*(struct sClusterSlot * const *) a)->cluster,
+    y = (*(struct sClusterSlot * const *) b)->cluster;
+
+  return x < y ? -1 : x > y;
+}
+
+int flushWriteBack(struct sFileSystem *fs) {
+  /*
+   * write all buffered clusters ordered by offset, runs of adjacent
+   * clusters are written with one request
+   */
+
+  struct sWriteBack *wb = &fs->wb;
+  struct sClusterTable *table = &wb->table;
+  struct sClusterSlot **dirty;
+  size_t j, k, n = 0, run, maxRun;
+
+  if (!table->len)
+    return 0;
+
+  maxRun = WRITEBACK_MERGE_SIZE / fs->clusterSize;
+  if (!maxRun)
+    maxRun = 1;
+
+  // the buffers of flushes are allocated once and grow with the table
+  if (!wb->merge) {
+    wb->merge = allocBuffer(fs, maxRun * fs->clusterSize);
+    if (!wb->merge)
+      return -1;
+  }
+  if (wb->dirtySize < table->size) {
+    dirty = realloc(wb->dirty, table->size * sizeof(*dirty));
+    if (!dirty) {
+      stderror();
+      return -1;
+    }
+    fs->allocations++;
+    wb->dirty = dirty;
+    wb->dirtySize = table->size;
+  }
+  dirty = wb->dirty;
+
+  for (j = 0; j < table->size; j++) {
+    if (table->slots[j].cluster)
+      dirty[n++] = &table->slots[j];
+  }
+  qsort(dirty, n, sizeof(*dirty), cmpDirtyClusters);
+
+  for (j = 0; j < n; j += run) {
+    for (run = 1; j + run < n && run < maxRun &&
+      dirty[j + run]->cluster == dirty[j]->cluster + run; run++);
+    for (k = 0; k < run; k++) {
+      memcpy(wb->merge + k * fs->clusterSize, dirty[j + k]->value.data,
+        fs->clusterSize);
+      if (fs->verify.enabled && recordWrittenCluster(&fs->verify,
+          dirty[j + k]->cluster, dirty[j + k]->value.data, fs->clusterSize))
+        return -1;
+    }
+
+    if (fs_seek(fs->fd, getClusterOffset(fs, dirty[j]->cluster), SEEK_SET) ==
+      -1) {
+      myerror("Seek error!");
+      return -1;
+    }
+    if (!fs_write(wb->merge, fs->clusterSize, run, fs->fd)) {
+      myerror("Failed to write to file!");
+      return -1;
+    }
+  }
+
+  // the table and the cluster buffers are kept for the following clusters
+  for (j = 0; j < n; j++)
+    wb->pool[wb->pooled++] = dirty[j]->value.data;
+  clearClusterTable(table);
+
+  return 0;
+}
+
+void freeWriteBack(struct sWriteBack *wb) {
+  /*
+   * free buffered clusters without writing them
+   */
+
+  size_t j;
+
+  for (j = 0; j < wb->slabLen; j++)
+    free(wb->slabs[j]);
+  free(wb->slabs);
+  freeClusterTable(&wb->table);
+  free(wb->pool);
+  free(wb->dirty);
+  free(wb->merge);
+  memset(wb, 0, sizeof(*wb));
+}
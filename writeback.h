@@ -0,0 +1,56 @@
+/*
+ * This file contains/describes the write-back buffer of directory clusters.
+ * Written directory clusters are collected in memory and written at once,
+ * ordered by their offset and with adjacent clusters merged into single
+ * requests.
+ */
+
+#ifndef __writeback_h__
+#define __writeback_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "clustertable.h"
+
+struct sFileSystem;
+
+// buffered clusters are written when they exceed this size, cluster buffers
+// are only allocated until the limit is reached
+#ifndef WRITEBACK_LIMIT
+#define WRITEBACK_LIMIT 0x1000000
+#endif
+
+// maximum size of a merged write request
+#define WRITEBACK_MERGE_SIZE 0x100000
+
+struct sWriteBack {
+  /*
+   * dirty clusters with their buffered content, cluster buffers and the
+   * buffers of flushes are kept for reuse
+   */
+  struct sClusterTable table;
+  char **slabs; // cluster buffers are allocated in slabs of several clusters
+  size_t slabLen;
+  char **pool; // unused cluster buffers
+  size_t pooled, poolSize;
+  struct sClusterSlot **dirty; // dirty clusters ordered for a flush
+  size_t dirtySize;
+  char *merge; // merged write request
+};
+
+// buffer the content of a cluster
+int bufferCluster(struct sFileSystem *fs, uint32_t cluster, const void *data);
+
+// returns the buffered content of a cluster or 0
+const char *findBufferedCluster(const struct sWriteBack *wb, uint32_t cluster);
+
+// drop a buffered cluster without writing it, used for freed clusters
+void discardBufferedCluster(struct sWriteBack *wb, uint32_t cluster);
+
+// write all buffered clusters ordered by offset
+int flushWriteBack(struct sFileSystem *fs);
+
+// free buffered clusters without writing them
+void freeWriteBack(struct sWriteBack *wb);
+
+#endif // __writeback_h__